@@ -28,14 +28,21 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "ply-array.h"
+#include "ply-buffer.h"
 #include "ply-event-loop.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-utils.h"
 
+#ifndef PLY_BOOT_CLIENT_MAX_REQUESTS_PER_WRITE
+#define PLY_BOOT_CLIENT_MAX_REQUESTS_PER_WRITE 64
+#endif
+
 struct _ply_boot_client
 {
   ply_event_loop_t *loop;
@@ -43,17 +50,23 @@ struct _ply_boot_client
   ply_fd_watch_t *daemon_has_reply_watch;
   ply_list_t *requests_to_send;
   ply_list_t *requests_waiting_for_replies;
+  ply_buffer_t *reply_buffer;
   int socket_fd;
+  int protocol_version;
+  uint32_t next_sequence;
 
   ply_boot_client_disconnect_handler_t disconnect_handler;
   void *disconnect_handler_user_data;
 
   uint32_t is_connected : 1;
+  uint32_t is_negotiating_protocol : 1;
+  uint32_t has_negotiated_protocol : 1;
 };
 
 typedef struct
 {
   ply_boot_client_t *client;
+  uint32_t sequence;
   char *command;
   char *argument;
   ply_boot_client_response_handler_t handler;
@@ -74,6 +87,9 @@ ply_boot_client_new (void)
   client->daemon_has_reply_watch = NULL;
   client->requests_to_send = ply_list_new ();
   client->requests_waiting_for_replies = ply_list_new ();
+  client->reply_buffer = ply_buffer_new ();
+  client->protocol_version = 1;
+  client->next_sequence = 1;
   client->loop = NULL;
   client->is_connected = false;
   client->disconnect_handler = NULL;
@@ -165,6 +181,7 @@ ply_boot_client_free (ply_boot_client_t *client)
 
   ply_list_free (client->requests_to_send);
   ply_list_free (client->requests_waiting_for_replies);
+  ply_buffer_free (client->reply_buffer);
 
   free (client);
 }
@@ -189,6 +206,7 @@ ply_boot_client_connect (ply_boot_client_t *client,
   client->disconnect_handler_user_data = user_data;
 
   client->is_connected = true;
+
   return true;
 }
 
@@ -239,65 +257,131 @@ ply_boot_client_cancel_request (ply_boot_client_t         *client,
   ply_boot_client_request_free (request);
 }
 
-static void
-ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
+static uint32_t
+ply_boot_client_get_uint32 (const uint8_t *bytes)
+{
+  return (bytes[0] << 0) |
+         (bytes[1] << 8) |
+         (bytes[2] << 16) |
+         ((uint32_t) bytes[3] << 24);
+}
+
+static uint8_t *
+ply_boot_client_put_uint32 (uint8_t  *bytes,
+                            uint32_t  value)
+{
+  bytes[0] = (value >> 0) & 0xFF;
+  bytes[1] = (value >> 8) & 0xFF;
+  bytes[2] = (value >> 16) & 0xFF;
+  bytes[3] = (value >> 24) & 0xFF;
+
+  return bytes + sizeof (uint32_t);
+}
+
+/* Returns the size of the version 1 reply at the front of bytes, or 0
+ * if the whole reply hasn't arrived yet.
+ */
+static size_t
+ply_boot_client_get_reply_size (const uint8_t *bytes,
+                                size_t         size)
+{
+  uint32_t answer_size;
+
+  if (size < 1)
+    return 0;
+
+  if (memcmp (bytes, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER, sizeof (uint8_t))
+      && memcmp (bytes, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS, sizeof (uint8_t)))
+    return 1;
+
+  if (size < 1 + sizeof (uint32_t))
+    return 0;
+
+  answer_size = ply_boot_client_get_uint32 (bytes + 1);
+
+  if (size - 1 - sizeof (uint32_t) < answer_size)
+    return 0;
+
+  return 1 + sizeof (uint32_t) + answer_size;
+}
+
+static ply_list_node_t *
+ply_boot_client_find_request_with_sequence (ply_boot_client_t *client,
+                                            uint32_t           sequence)
 {
   ply_list_node_t *request_node;
   ply_boot_client_request_t *request;
-  bool processed_reply;
-  uint8_t byte[2] = "";
-  uint32_t size;
-
-  assert (client != NULL);
 
-  processed_reply = false;
-  if (ply_list_get_length (client->requests_waiting_for_replies) == 0)
+  for (request_node = ply_list_get_first_node (client->requests_waiting_for_replies);
+       request_node; request_node = ply_list_get_next_node (client->requests_waiting_for_replies, request_node))
     {
-      ply_error ("received unexpected response from boot status daemon");
-      return;
+      request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+
+      if (request->sequence == sequence)
+        return request_node;
     }
 
-  if (!ply_read (client->socket_fd, byte, sizeof (uint8_t)))
-    goto out;
+  return NULL;
+}
+
+/* Version 1 replies don't say which request they answer.  The daemon
+ * answers requests in the order they were sent, except
+ * for the ones that wait on the user (passwords, questions and
+ * keystrokes) which get answered whenever the user gets around to it.
+ * So a reply belongs to the oldest request of the matching kind.
+ */
+static ply_list_node_t *
+ply_boot_client_find_request_for_reply (ply_boot_client_t *client,
+                                        const uint8_t     *byte)
+{
+  ply_list_node_t *request_node;
+  ply_boot_client_request_t *request;
 
   for (request_node = ply_list_get_first_node (client->requests_waiting_for_replies);
        request_node; request_node = ply_list_get_next_node (client->requests_waiting_for_replies, request_node))
     {
-      assert (request_node != NULL);
       request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
       assert (request != NULL);
 
       if (! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PASSWORD)
           || ! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUESTION)
-          || ! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_KEYSTROKE))
+          || ! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_KEYSTROKE)
+          || ! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_HANDSHAKE))
         {
           if (! memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER, sizeof (uint8_t))
               || ! memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER, sizeof (uint8_t)))
-            break;
+            return request_node;
         }
       else
         {
           if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER, sizeof (uint8_t))
               && memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER, sizeof (uint8_t)))
-            break;
+            return request_node;
         }
     }
 
+  return ply_list_get_first_node (client->requests_waiting_for_replies);
+}
+
+static void
+ply_boot_client_process_reply (ply_boot_client_t         *client,
+                               ply_boot_client_request_t *request,
+                               const uint8_t             *byte,
+                               const uint8_t             *reply,
+                               uint32_t                   size)
+{
+  bool processed_reply;
+
+  processed_reply = false;
+
   if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK, sizeof (uint8_t)) == 0)
       request->handler (request->user_data, client);
   else if (memcmp (byte, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER, sizeof (uint8_t)) == 0)
     {
       char *answer;
 
-      if (!ply_read_uint32 (client->socket_fd, &size))
-        goto out;
-      
       answer = malloc ((size+1) * sizeof(char));
-      if (size > 0)
-        {
-          if (!ply_read (client->socket_fd, answer, size))
-            goto out;
-        }
+      memcpy (answer, reply, size);
 
       answer[size] = '\0';
       ((ply_boot_client_answer_handler_t) request->handler) (request->user_data, answer, client);
@@ -307,30 +391,16 @@ ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
     {
       ply_array_t *array;
       char **answers;
-      char *answer;
-      char *p;
-      char *q;
-      uint8_t i;
-
-      array = NULL;
-      answers = NULL;
+      const char *p;
+      const char *q;
+      uint32_t i;
 
-      if (!ply_read_uint32 (client->socket_fd, &size))
+      if (size == 0)
         goto out;
 
-      assert (size > 0);
-
-      answer = malloc (size);
-
-      if (!ply_read (client->socket_fd, answer, size))
-        {
-          free (answer);
-          goto out;
-        }
-
       array = ply_array_new ();
 
-      p = answer;
+      p = (const char *) reply;
       q = p;
       for (i = 0; i < size; i++, q++)
         {
@@ -340,7 +410,6 @@ ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
               p = q + 1;
             }
         }
-      free (answer);
 
       answers = (char **) ply_array_steal_elements (array);
       ply_array_free (array);
@@ -364,11 +433,108 @@ out:
       if (request->failed_handler != NULL)
         request->failed_handler (request->user_data, client);
     }
+}
+
+/* There is no telling where the frame after a malformed one starts,
+ * so none of the outstanding replies can be trusted to arrive.  Shutting
+ * the socket down makes the hangup handler tell the disconnect handler.
+ */
+static void
+ply_boot_client_drop_connection (ply_boot_client_t *client)
+{
+  ply_error ("received malformed response from boot status daemon, disconnecting");
 
-  ply_list_remove_node (client->requests_waiting_for_replies, request_node);
+  shutdown (client->socket_fd, SHUT_RDWR);
+  client->is_connected = false;
+
+  ply_buffer_clear (client->reply_buffer);
+  ply_boot_client_cancel_requests (client);
+}
+
+static void
+ply_boot_client_process_incoming_replies (ply_boot_client_t *client)
+{
+  ply_list_node_t *request_node;
+  ply_boot_client_request_t *request;
+  const uint8_t *bytes, *type, *answer;
+  size_t size, reply_size;
+  uint32_t answer_size;
+
+  assert (client != NULL);
+
+  ply_buffer_append_from_fd (client->reply_buffer, client->socket_fd);
+
+  /* The daemon answers a batch of requests with one write, so handle
+   * every reply that has arrived rather than one per wakeup
+   */
+  while (ply_list_get_length (client->requests_waiting_for_replies) > 0)
+    {
+      bytes = (const uint8_t *) ply_buffer_get_bytes (client->reply_buffer);
+      size = ply_buffer_get_size (client->reply_buffer);
+
+      if (client->protocol_version >= 2)
+        {
+          uint32_t frame_size;
+
+          if (size < sizeof (uint32_t))
+            break;
+
+          frame_size = ply_boot_client_get_uint32 (bytes);
+          if (frame_size < sizeof (uint32_t) + 1 ||
+              frame_size > PLY_BOOT_PROTOCOL_MAX_FRAME_SIZE)
+            {
+              ply_boot_client_drop_connection (client);
+              return;
+            }
+
+          if (size - sizeof (uint32_t) < frame_size)
+            break;
+
+          reply_size = sizeof (uint32_t) + frame_size;
+          request_node =
+              ply_boot_client_find_request_with_sequence (client,
+                                                          ply_boot_client_get_uint32 (bytes + sizeof (uint32_t)));
+          type = bytes + 2 * sizeof (uint32_t);
+          answer = type + 1;
+          answer_size = frame_size - sizeof (uint32_t) - 1;
+        }
+      else
+        {
+          reply_size = ply_boot_client_get_reply_size (bytes, size);
+
+          if (reply_size == 0)
+            break;
+
+          request_node = ply_boot_client_find_request_for_reply (client, bytes);
+          type = bytes;
+          answer = bytes + 1 + sizeof (uint32_t);
+          answer_size = reply_size > 1 + sizeof (uint32_t)? reply_size - 1 - sizeof (uint32_t) : 0;
+        }
+
+      if (request_node == NULL)
+        {
+          ply_error ("received response to unknown request from boot status daemon");
+          ply_buffer_remove_bytes (client->reply_buffer, reply_size);
+          continue;
+        }
+
+      request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+      ply_list_remove_node (client->requests_waiting_for_replies, request_node);
+
+      ply_boot_client_process_reply (client, request, type, answer, answer_size);
+      ply_boot_client_request_free (request);
+
+      ply_buffer_remove_bytes (client->reply_buffer, reply_size);
+    }
 
   if (ply_list_get_length (client->requests_waiting_for_replies) == 0)
     {
+      if (ply_buffer_get_size (client->reply_buffer) > 0)
+        {
+          ply_error ("received unexpected response from boot status daemon");
+          ply_buffer_clear (client->reply_buffer);
+        }
+
       if (client->daemon_has_reply_watch != NULL)
         {
           assert (client->loop != NULL);
@@ -399,7 +565,7 @@ ply_boot_client_get_request_string (ply_boot_client_t         *client,
       return request_string;
     }
 
-  assert (strlen (request->argument) <= UCHAR_MAX);
+  assert (strlen (request->argument) < UCHAR_MAX);
 
   request_string = NULL;
   asprintf (&request_string, "%s\002%c%s", request->command, 
@@ -409,62 +575,241 @@ ply_boot_client_get_request_string (ply_boot_client_t         *client,
   return request_string;
 }
 
-static bool
-ply_boot_client_send_request (ply_boot_client_t         *client,
-                              ply_boot_client_request_t *request)
+static uint8_t *
+ply_boot_client_put_argument (uint8_t    *bytes,
+                              const char *type,
+                              const char *argument,
+                              uint32_t    size)
 {
-  char *request_string;
-  size_t request_size;
+  *bytes++ = type[0];
+  bytes = ply_boot_client_put_uint32 (bytes, size);
+  memcpy (bytes, argument, size);
+
+  return bytes + size;
+}
+
+/* Builds a version 2 frame.  Batched statuses go as one argument each
+ * and the retain flags of quit and hide-splash go as booleans.
+ */
+static char *
+ply_boot_client_get_request_frame (ply_boot_client_t         *client,
+                                   ply_boot_client_request_t *request,
+                                   size_t                    *request_size)
+{
+  uint8_t *request_frame, *bytes;
+  size_t argument_size;
+  int number_of_arguments;
+  bool is_batch;
 
   assert (client != NULL);
   assert (request != NULL);
+  assert (request_size != NULL);
+
+  argument_size = request->argument != NULL? strlen (request->argument) : 0;
+  is_batch = ! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE_BATCH);
 
-  request_string = ply_boot_client_get_request_string (client, request,
-                                                       &request_size);
-  if (!ply_write (client->socket_fd, request_string, request_size))
+  /* room for the header, the argument bytes or boolean flag, and as
+   * many argument headers as there could be arguments
+   */
+  request_frame = malloc (2 * sizeof (uint32_t) + 2 + argument_size + 1 +
+                          (is_batch? UCHAR_MAX : 1) * (1 + sizeof (uint32_t)));
+  bytes = request_frame + 2 * sizeof (uint32_t) + 2;
+  number_of_arguments = 0;
+
+  if (request->argument == NULL)
+    ;
+  else if (! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUIT)
+           || ! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_HIDE_SPLASH))
     {
-      free (request_string);
-      ply_boot_client_cancel_request (client, request);
-      return false;
+      char flag;
+
+      flag = request->argument[0] != '\0';
+      bytes = ply_boot_client_put_argument (bytes,
+                                            PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_BOOLEAN,
+                                            &flag, 1);
+      number_of_arguments++;
     }
-  free (request_string);
+  else if (is_batch)
+    {
+      const char *status, *end;
 
-  if (client->daemon_has_reply_watch == NULL)
+      status = request->argument;
+      while (*status != '\0' && number_of_arguments < UCHAR_MAX - 1)
+        {
+          end = strchrnul (status, '\n');
+
+          if (end > status)
+            {
+              bytes = ply_boot_client_put_argument (bytes,
+                                                    PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_STRING,
+                                                    status, end - status);
+              number_of_arguments++;
+            }
+
+          status = *end != '\0'? end + 1 : end;
+        }
+
+      /* the daemon splits every argument on newlines, so whatever is
+       * left past the argument count limit can go in one last argument
+       */
+      if (*status != '\0')
+        {
+          bytes = ply_boot_client_put_argument (bytes,
+                                                PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_STRING,
+                                                status, strlen (status));
+          number_of_arguments++;
+        }
+    }
+  else
     {
-      assert (ply_list_get_length (client->requests_waiting_for_replies) == 0);
-      client->daemon_has_reply_watch = 
-          ply_event_loop_watch_fd (client->loop, client->socket_fd,
-                                   PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
-                                   (ply_event_handler_t)
-                                   ply_boot_client_process_incoming_replies,
-                                   NULL, client);
+      bytes = ply_boot_client_put_argument (bytes,
+                                            PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_STRING,
+                                            request->argument, argument_size);
+      number_of_arguments++;
     }
+
+  *request_size = bytes - request_frame;
+
+  bytes = ply_boot_client_put_uint32 (request_frame,
+                                      *request_size - sizeof (uint32_t));
+  bytes = ply_boot_client_put_uint32 (bytes, request->sequence);
+  *bytes++ = request->command[0];
+  *bytes++ = number_of_arguments;
+
+  return (char *) request_frame;
+}
+
+static bool
+ply_boot_client_write_requests (int           fd,
+                                struct iovec *iov,
+                                int           count)
+{
+  while (count > 0)
+    {
+      ssize_t bytes_written;
+
+      bytes_written = writev (fd, iov, count);
+
+      if (bytes_written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+
+      while (count > 0 && (size_t) bytes_written >= iov->iov_len)
+        {
+          bytes_written -= iov->iov_len;
+          iov++;
+          count--;
+        }
+
+      if (count > 0)
+        {
+          iov->iov_base = (uint8_t *) iov->iov_base + bytes_written;
+          iov->iov_len -= bytes_written;
+        }
+    }
+
   return true;
 }
 
+/* Sends everything that is queued up with a single write, rather than
+ * one request per wakeup, so the daemon can handle a burst of requests
+ * in one go.
+ */
 static void
 ply_boot_client_process_pending_requests (ply_boot_client_t *client)
 {
+  ply_boot_client_request_t *requests[PLY_BOOT_CLIENT_MAX_REQUESTS_PER_WRITE];
+  char *request_strings[PLY_BOOT_CLIENT_MAX_REQUESTS_PER_WRITE];
+  struct iovec iov[PLY_BOOT_CLIENT_MAX_REQUESTS_PER_WRITE];
   ply_list_node_t *request_node;
-  ply_boot_client_request_t *request;
+  bool sent_requests;
+  int i, count;
 
   assert (ply_list_get_length (client->requests_to_send) != 0);
   assert (client->daemon_can_take_request_watch != NULL);
 
-  request_node = ply_list_get_first_node (client->requests_to_send);
-  assert (request_node != NULL);
+  count = 0;
+  while (count < PLY_BOOT_CLIENT_MAX_REQUESTS_PER_WRITE &&
+         !client->is_negotiating_protocol &&
+         (request_node = ply_list_get_first_node (client->requests_to_send)) != NULL)
+    {
+      ply_boot_client_request_t *request;
+      size_t request_size;
 
-  request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
-  assert (request != NULL);
+      request = (ply_boot_client_request_t *) ply_list_node_get_data (request_node);
+      assert (request != NULL);
+      ply_list_remove_node (client->requests_to_send, request_node);
+
+      /* The daemon hangs up on frames that are too big, which would
+       * take every other request on the connection down with this one
+       */
+      if (request->argument != NULL &&
+          strlen (request->argument) > ply_boot_client_get_max_argument_size (client))
+        {
+          ply_trace ("argument too long for protocol version %d",
+                     client->protocol_version);
+          ply_boot_client_cancel_request (client, request);
+          continue;
+        }
 
-  ply_list_remove_node (client->requests_to_send, request_node);
+      if (client->protocol_version < 2)
+        {
+          request_strings[count] =
+              ply_boot_client_get_request_string (client, request,
+                                                  &request_size);
+        }
+      else
+        {
+          request->sequence = client->next_sequence++;
+          request_strings[count] =
+              ply_boot_client_get_request_frame (client, request,
+                                                 &request_size);
+        }
 
-  if (ply_boot_client_send_request (client, request))
-    ply_list_append_data (client->requests_waiting_for_replies, request);
+      /* Everything after a handshake has to wait for its answer, since
+       * that decides how the rest gets framed
+       */
+      if (! strcmp (request->command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_HANDSHAKE))
+        client->is_negotiating_protocol = true;
 
-  if (ply_list_get_length (client->requests_to_send) == 0)
+      requests[count] = request;
+      iov[count].iov_base = request_strings[count];
+      iov[count].iov_len = request_size;
+      count++;
+    }
+
+  if (count == 0)
+    sent_requests = false;
+  else
+    sent_requests = ply_boot_client_write_requests (client->socket_fd, iov, count);
+
+  for (i = 0; i < count; i++)
     {
-      if (client->daemon_has_reply_watch != NULL)
+      free (request_strings[i]);
+
+      if (sent_requests)
+        ply_list_append_data (client->requests_waiting_for_replies, requests[i]);
+      else
+        ply_boot_client_cancel_request (client, requests[i]);
+    }
+
+  if (sent_requests && client->daemon_has_reply_watch == NULL)
+    {
+      client->daemon_has_reply_watch = 
+          ply_event_loop_watch_fd (client->loop, client->socket_fd,
+                                   PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                   (ply_event_handler_t)
+                                   ply_boot_client_process_incoming_replies,
+                                   NULL, client);
+    }
+
+  if (ply_list_get_length (client->requests_to_send) == 0 ||
+      client->is_negotiating_protocol)
+    {
+      if (client->daemon_can_take_request_watch != NULL)
         {
           assert (client->loop != NULL);
 
@@ -475,6 +820,23 @@ ply_boot_client_process_pending_requests (ply_boot_client_t *client)
     }
 }
 
+static void
+ply_boot_client_watch_for_request_readiness (ply_boot_client_t *client)
+{
+  if (client->daemon_can_take_request_watch != NULL ||
+      client->is_negotiating_protocol ||
+      !client->is_connected ||
+      client->socket_fd < 0)
+    return;
+
+  client->daemon_can_take_request_watch =
+      ply_event_loop_watch_fd (client->loop, client->socket_fd,
+                               PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
+                               (ply_event_handler_t)
+                               ply_boot_client_process_pending_requests,
+                               NULL, client);
+}
+
 static void
 ply_boot_client_queue_request (ply_boot_client_t                  *client,
                                const char                         *request_command,
@@ -486,20 +848,9 @@ ply_boot_client_queue_request (ply_boot_client_t                  *client,
   assert (client != NULL);
   assert (client->loop != NULL);
   assert (request_command != NULL);
-  assert (request_argument == NULL || strlen (request_argument) <= UCHAR_MAX);
   assert (handler != NULL);
 
-  if (client->daemon_can_take_request_watch == NULL &&
-      client->socket_fd >= 0)
-    {
-      assert (ply_list_get_length (client->requests_to_send) == 0);
-      client->daemon_can_take_request_watch = 
-          ply_event_loop_watch_fd (client->loop, client->socket_fd,
-                                   PLY_EVENT_LOOP_FD_STATUS_CAN_TAKE_DATA,
-                                   (ply_event_handler_t)
-                                   ply_boot_client_process_pending_requests,
-                                   NULL, client);
-    }
+  ply_boot_client_watch_for_request_readiness (client);
 
   if (!client->is_connected)
     {
@@ -512,6 +863,13 @@ ply_boot_client_queue_request (ply_boot_client_t                  *client,
     {
       ply_boot_client_request_t *request;
 
+      /* Only arguments that don't fit protocol version 1 are worth
+       * the round trip of a handshake
+       */
+      if (request_argument != NULL &&
+          strlen (request_argument) >= UCHAR_MAX)
+        ply_boot_client_negotiate_protocol (client);
+
       request = ply_boot_client_request_new (client, request_command,
                                              request_argument,
                                              handler, failed_handler, user_data);
@@ -519,6 +877,67 @@ ply_boot_client_queue_request (ply_boot_client_t                  *client,
     }
 }
 
+static void
+ply_boot_client_on_protocol_negotiated (ply_boot_client_t *client,
+                                        const char        *answer)
+{
+  if (answer != NULL)
+    client->protocol_version = CLAMP (atoi (answer), 1,
+                                      PLY_BOOT_PROTOCOL_VERSION);
+
+  ply_trace ("using boot protocol version %d", client->protocol_version);
+  client->is_negotiating_protocol = false;
+
+  if (client->is_connected &&
+      client->loop != NULL &&
+      ply_list_get_length (client->requests_to_send) > 0)
+    ply_boot_client_watch_for_request_readiness (client);
+}
+
+static void
+ply_boot_client_on_protocol_negotiation_failed (ply_boot_client_t *client)
+{
+  ply_boot_client_on_protocol_negotiated (client, NULL);
+}
+
+/* Daemons that don't know about the handshake refuse it, which leaves
+ * the client on version 1.  Only the first call sends one.
+ */
+void
+ply_boot_client_negotiate_protocol (ply_boot_client_t *client)
+{
+  char *version;
+
+  assert (client != NULL);
+
+  if (client->has_negotiated_protocol)
+    return;
+
+  client->has_negotiated_protocol = true;
+
+  asprintf (&version, "%d", PLY_BOOT_PROTOCOL_VERSION);
+  ply_boot_client_queue_request (client,
+                                 PLY_BOOT_PROTOCOL_REQUEST_TYPE_HANDSHAKE,
+                                 version,
+                                 (ply_boot_client_response_handler_t)
+                                 ply_boot_client_on_protocol_negotiated,
+                                 (ply_boot_client_response_handler_t)
+                                 ply_boot_client_on_protocol_negotiation_failed,
+                                 client);
+  free (version);
+}
+
+size_t
+ply_boot_client_get_max_argument_size (ply_boot_client_t *client)
+{
+  assert (client != NULL);
+
+  if (client->protocol_version < 2)
+    return UCHAR_MAX - 1;
+
+  return PLY_BOOT_PROTOCOL_MAX_FRAME_SIZE / 2;
+}
+
 void
 ply_boot_client_ping_daemon (ply_boot_client_t                  *client,
                              ply_boot_client_response_handler_t  handler,
@@ -544,6 +963,24 @@ ply_boot_client_update_daemon (ply_boot_client_t                  *client,
                                  status, handler, failed_handler, user_data);
 }
 
+/* new_statuses holds several statuses separated by newlines.  Daemons
+ * that predate batches refuse the request, so the failed handler
+ * should fall back to ply_boot_client_update_daemon.
+ */
+void
+ply_boot_client_batch_update_daemon (ply_boot_client_t                  *client,
+                                     const char                         *new_statuses,
+                                     ply_boot_client_response_handler_t  handler,
+                                     ply_boot_client_response_handler_t  failed_handler,
+                                     void                               *user_data)
+{
+  assert (client != NULL);
+  assert (new_statuses != NULL);
+
+  ply_boot_client_queue_request (client, PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE_BATCH,
+                                 new_statuses, handler, failed_handler, user_data);
+}
+
 void
 ply_boot_client_tell_daemon_to_change_root (ply_boot_client_t                  *client,
                                             const char                         *root_dir,
@@ -784,6 +1221,14 @@ ply_boot_client_disconnect (ply_boot_client_t *client)
   client->is_connected = false;
 }
 
+bool
+ply_boot_client_is_connected (ply_boot_client_t *client)
+{
+  assert (client != NULL);
+
+  return client->is_connected;
+}
+
 static void
 ply_boot_client_detach_from_event_loop (ply_boot_client_t *client)
 {
@@ -798,6 +1243,9 @@ static void
 ply_boot_client_on_hangup (ply_boot_client_t *client)
 {
   assert (client != NULL);
+
+  /* so failed handlers don't queue anything new on a dead socket */
+  client->is_connected = false;
   ply_boot_client_cancel_requests (client);
 
   if (client->disconnect_handler != NULL)
@@ -827,7 +1275,6 @@ ply_boot_client_attach_to_event_loop (ply_boot_client_t *client,
   ply_event_loop_watch_for_exit (loop, (ply_event_loop_exit_handler_t) 
                                  ply_boot_client_detach_from_event_loop,
                                  client); 
-
 }
 
 #ifdef PLY_BOOT_CLIENT_ENABLE_TEST
@@ -963,4 +1410,428 @@ main (int    argc,
 }
 
 #endif /* PLY_BOOT_CLIENT_ENABLE_TEST */
+#ifdef PLY_BOOT_PROTOCOL_ENABLE_TEST
+
+#include <stdio.h>
+
+#include "ply-boot-server.h"
+#include "ply-event-loop.h"
+#include "ply-boot-client.h"
+
+#define NUMBER_OF_UPDATES 20000
+#define LONG_STATUS_SIZE 1000
+
+/* what automake takes as a skipped test */
+#define TEST_SKIPPED 77
+
+typedef struct
+{
+  ply_event_loop_t *loop;
+  ply_boot_client_t *client;
+  const char *mode;
+  int updates_sent;
+  int replies;
+  int refusals;
+  double start_time;
+  size_t last_status_size;
+  bool is_pipelined;
+  bool oversized_status_was_refused;
+  ply_boot_client_t *bad_reply_client;
+  int bad_reply_fd;
+  int bad_reply_failures;
+} test_state_t;
+
+static void test_send_update (test_state_t *state);
+static void test_send_long_update (test_state_t *state);
+static void test_send_oversized_update (test_state_t *state);
+static void test_send_bad_frame (test_state_t *state);
+static void test_receive_bad_reply (test_state_t *state);
+static void test_start (test_state_t *state,
+                        bool          is_pipelined);
+
+static void
+test_on_reply (test_state_t *state)
+{
+  double elapsed;
+
+  state->replies++;
+
+  if (state->replies < NUMBER_OF_UPDATES)
+    {
+      if (!state->is_pipelined)
+        test_send_update (state);
+      return;
+    }
+
+  elapsed = ply_get_timestamp () - state->start_time;
+  printf ("%s: %d updates in %.3fs, %.0f updates/sec\n",
+          state->mode, state->replies, elapsed, state->replies / elapsed);
+
+  /* the daemon only takes requests from root
+   */
+  if (state->refusals > 0)
+    {
+      printf ("%d updates refused, not running as root? skipping\n",
+              state->refusals);
+      ply_event_loop_exit (state->loop, TEST_SKIPPED);
+      return;
+    }
+
+  /* short statuses alone shouldn't cost a handshake
+   */
+  if (state->client->has_negotiated_protocol)
+    {
+      printf ("%s: negotiated a protocol version for short statuses\n",
+              state->mode);
+      ply_event_loop_exit (state->loop, 1);
+      return;
+    }
+
+  if (state->is_pipelined)
+    test_send_long_update (state);
+  else
+    test_start (state, true);
+}
+
+static void
+test_on_long_reply (test_state_t *state)
+{
+  printf ("long status: sent %d bytes, daemon got %d bytes, "
+          "over protocol version %d\n",
+          LONG_STATUS_SIZE, (int) state->last_status_size,
+          state->client->protocol_version);
+
+  if (state->last_status_size != LONG_STATUS_SIZE)
+    {
+      ply_event_loop_exit (state->loop, 1);
+      return;
+    }
+
+  test_send_oversized_update (state);
+}
+
+/* Short statuses got through, so this means the handshake failed
+ */
+static void
+test_on_long_refusal (test_state_t *state)
+{
+  printf ("long status: refused over protocol version %d\n",
+          state->client->protocol_version);
+  ply_event_loop_exit (state->loop, 1);
+}
+
+/* Statuses used to be limited to 254 bytes by the one byte argument
+ * length of protocol version 1
+ */
+static void
+test_send_long_update (test_state_t *state)
+{
+  char status[LONG_STATUS_SIZE + 1];
+
+  memset (status, 'x', LONG_STATUS_SIZE);
+  status[LONG_STATUS_SIZE] = '\0';
+  ply_boot_client_update_daemon (state->client, status,
+                                 (ply_boot_client_response_handler_t) test_on_long_reply,
+                                 (ply_boot_client_response_handler_t) test_on_long_refusal,
+                                 state);
+}
+
+static void
+test_on_oversized_refusal (test_state_t *state)
+{
+  state->oversized_status_was_refused = true;
+}
+
+static void
+test_on_oversized_reply (test_state_t *state)
+{
+  printf ("oversized status: sent to the daemon\n");
+  ply_event_loop_exit (state->loop, 1);
+}
+
+static void
+test_on_reply_after_oversized (test_state_t *state)
+{
+  printf ("oversized status: %s, connection still up\n",
+          state->oversized_status_was_refused? "refused" : "not refused");
+
+  if (!state->oversized_status_was_refused)
+    {
+      ply_event_loop_exit (state->loop, 1);
+      return;
+    }
+
+  test_send_bad_frame (state);
+}
+
+static void
+test_on_failure_after_oversized (test_state_t *state)
+{
+  printf ("oversized status: took the connection down with it\n");
+  ply_event_loop_exit (state->loop, 1);
+}
+
+/* Anything bigger than a frame would get the connection hung up, so
+ * it has to be refused before it is sent
+ */
+static void
+test_send_oversized_update (test_state_t *state)
+{
+  size_t size;
+  char *status;
+
+  size = ply_boot_client_get_max_argument_size (state->client) + 1;
+  status = malloc (size + 1);
+  memset (status, 'x', size);
+  status[size] = '\0';
+  ply_boot_client_update_daemon (state->client, status,
+                                 (ply_boot_client_response_handler_t) test_on_oversized_reply,
+                                 (ply_boot_client_response_handler_t) test_on_oversized_refusal,
+                                 state);
+  free (status);
+
+  ply_boot_client_ping_daemon (state->client,
+                               (ply_boot_client_response_handler_t) test_on_reply_after_oversized,
+                               (ply_boot_client_response_handler_t) test_on_failure_after_oversized,
+                               state);
+}
+
+static void
+test_on_bad_frame_reply (test_state_t *state,
+                         int           fd)
+{
+  char bytes[64];
+
+  /* the answer to the handshake */
+  read (fd, bytes, sizeof (bytes));
+}
+
+static void
+test_on_bad_frame_timeout (test_state_t *state)
+{
+  printf ("bad frame: daemon didn't hang up\n");
+  ply_event_loop_exit (state->loop, 1);
+}
+
+static void
+test_on_bad_frame_hangup (test_state_t *state,
+                          int           fd)
+{
+  printf ("bad frame: daemon hung up\n");
+  close (fd);
+  ply_event_loop_stop_watching_for_timeout (state->loop,
+                                            (ply_event_loop_timeout_handler_t)
+                                            test_on_bad_frame_timeout, state);
+
+  /* the loop isn't done with the closed fd's number until this returns */
+  ply_event_loop_watch_for_timeout (state->loop, 0.0,
+                                    (ply_event_loop_timeout_handler_t)
+                                    test_receive_bad_reply, state);
+}
+
+/* A frame whose length makes no sense leaves no way to find the one
+ * after it, so the daemon has to hang up rather than guess
+ */
+static void
+test_send_bad_frame (test_state_t *state)
+{
+  const char handshake[] = PLY_BOOT_PROTOCOL_REQUEST_TYPE_HANDSHAKE "\002\0022";
+  const uint8_t bad_frame[] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 1 };
+  int fd;
+
+  fd = ply_connect_to_unix_socket (PLY_BOOT_PROTOCOL_SOCKET_PATH + 1, true);
+  if (fd < 0 ||
+      !ply_write (fd, handshake, sizeof (handshake)) ||
+      !ply_write (fd, bad_frame, sizeof (bad_frame)))
+    {
+      perror ("bad frame: could not send");
+      ply_event_loop_exit (state->loop, 1);
+      return;
+    }
+
+  ply_event_loop_watch_fd (state->loop, fd, PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                           (ply_event_handler_t) test_on_bad_frame_reply,
+                           (ply_event_handler_t) test_on_bad_frame_hangup,
+                           state);
+
+  ply_event_loop_watch_for_timeout (state->loop, 5.0,
+                                    (ply_event_loop_timeout_handler_t)
+                                    test_on_bad_frame_timeout, state);
+}
+
+static void
+test_on_bad_reply_answered (test_state_t *state)
+{
+  printf ("bad reply: request got an answer\n");
+  ply_event_loop_exit (state->loop, 1);
+}
+
+static void
+test_on_bad_reply_failure (test_state_t *state)
+{
+  state->bad_reply_failures++;
+}
+
+static void
+test_on_bad_reply_timeout (test_state_t *state)
+{
+  printf ("bad reply: client didn't disconnect\n");
+  ply_event_loop_exit (state->loop, 1);
+}
+
+static void
+test_on_bad_reply_disconnect (test_state_t      *state,
+                              ply_boot_client_t *client)
+{
+  printf ("bad reply: client disconnected, %d of 2 requests failed\n",
+          state->bad_reply_failures);
+  ply_event_loop_stop_watching_for_timeout (state->loop,
+                                            (ply_event_loop_timeout_handler_t)
+                                            test_on_bad_reply_timeout, state);
+  ply_event_loop_exit (state->loop, state->bad_reply_failures == 2? 0 : 1);
+}
+
+/* The same goes the other way: the client can't find the reply after
+ * a malformed one, so it has to give up on all of them and hang up
+ */
+static void
+test_receive_bad_reply (test_state_t *state)
+{
+  const uint8_t bad_frame[] = { 0xff, 0xff, 0xff, 0xff, 0, 0, 0, 1 };
+  ply_boot_client_t *client;
+  uint8_t request[64];
+  int fds[2];
+
+  if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+    {
+      perror ("bad reply: could not make socket pair");
+      ply_event_loop_exit (state->loop, 1);
+      return;
+    }
+
+  /* pretend a version 2 daemon is on the other end */
+  client = ply_boot_client_new ();
+  client->socket_fd = fds[0];
+  client->is_connected = true;
+  client->has_negotiated_protocol = true;
+  client->protocol_version = 2;
+  client->disconnect_handler = (ply_boot_client_disconnect_handler_t)
+                               test_on_bad_reply_disconnect;
+  client->disconnect_handler_user_data = state;
+  ply_boot_client_attach_to_event_loop (client, state->loop);
+  state->bad_reply_client = client;
+  state->bad_reply_fd = fds[1];
+
+  ply_boot_client_ping_daemon (client,
+                               (ply_boot_client_response_handler_t) test_on_bad_reply_answered,
+                               (ply_boot_client_response_handler_t) test_on_bad_reply_failure,
+                               state);
+  ply_boot_client_ping_daemon (client,
+                               (ply_boot_client_response_handler_t) test_on_bad_reply_answered,
+                               (ply_boot_client_response_handler_t) test_on_bad_reply_failure,
+                               state);
+  ply_boot_client_process_pending_requests (client);
+
+  read (fds[1], request, sizeof (request));
+  ply_write (fds[1], bad_frame, sizeof (bad_frame));
+
+  ply_event_loop_watch_for_timeout (state->loop, 5.0,
+                                    (ply_event_loop_timeout_handler_t)
+                                    test_on_bad_reply_timeout, state);
+}
+
+static void
+test_on_refusal (test_state_t *state)
+{
+  state->refusals++;
+  test_on_reply (state);
+}
+
+static void
+test_send_update (test_state_t *state)
+{
+  char status[64];
+
+  snprintf (status, sizeof (status), "service-%d.service", state->updates_sent++);
+  ply_boot_client_update_daemon (state->client, status,
+                                 (ply_boot_client_response_handler_t) test_on_reply,
+                                 (ply_boot_client_response_handler_t) test_on_refusal,
+                                 state);
+}
+
+static void
+test_start (test_state_t *state,
+            bool          is_pipelined)
+{
+  int i;
+
+  state->is_pipelined = is_pipelined;
+  state->mode = is_pipelined? "pipelined" : "one at a time";
+  state->updates_sent = 0;
+  state->replies = 0;
+  state->refusals = 0;
+  state->start_time = ply_get_timestamp ();
+
+  if (!is_pipelined)
+    {
+      test_send_update (state);
+      return;
+    }
+
+  for (i = 0; i < NUMBER_OF_UPDATES; i++)
+    test_send_update (state);
+}
+
+static void
+test_on_status (test_state_t      *state,
+                const char        *status,
+                ply_boot_server_t *server)
+{
+  state->last_status_size = strlen (status);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  test_state_t state = { 0 };
+  ply_boot_server_t *server;
+  int exit_code;
+
+  state.loop = ply_event_loop_new ();
+
+  server = ply_boot_server_new ((ply_boot_server_update_handler_t) test_on_status,
+                                NULL, NULL, NULL, NULL, NULL,
+                                NULL, NULL, NULL, NULL, NULL, NULL,
+                                NULL, NULL, NULL, NULL, NULL, &state);
+
+  if (!ply_boot_server_listen (server))
+    {
+      perror ("could not start boot status server");
+      return errno;
+    }
+  ply_boot_server_attach_to_event_loop (server, state.loop);
+
+  state.client = ply_boot_client_new ();
+  if (!ply_boot_client_connect (state.client, NULL, NULL))
+    {
+      perror ("could not connect to boot status server");
+      return errno;
+    }
+  ply_boot_client_attach_to_event_loop (state.client, state.loop);
+
+  test_start (&state, false);
+
+  exit_code = ply_event_loop_run (state.loop);
+
+  ply_boot_client_free (state.client);
+  ply_boot_client_free (state.bad_reply_client);
+  if (state.bad_reply_client != NULL)
+    close (state.bad_reply_fd);
+  ply_boot_server_free (server);
+
+  return exit_code;
+}
+
+#endif /* PLY_BOOT_PROTOCOL_ENABLE_TEST */
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -49,6 +49,8 @@ void ply_boot_client_free (ply_boot_client_t *client);
 bool ply_boot_client_connect (ply_boot_client_t                    *client,
                               ply_boot_client_disconnect_handler_t  disconnect_handler,
                               void                                 *user_data);
+void ply_boot_client_negotiate_protocol (ply_boot_client_t *client);
+size_t ply_boot_client_get_max_argument_size (ply_boot_client_t *client);
 void ply_boot_client_ping_daemon (ply_boot_client_t                  *client,
                                   ply_boot_client_response_handler_t  handler,
                                   ply_boot_client_response_handler_t  failed_handler,
@@ -58,6 +60,11 @@ void ply_boot_client_update_daemon (ply_boot_client_t                  *client,
                                     ply_boot_client_response_handler_t  handler,
                                     ply_boot_client_response_handler_t  failed_handler,
                                     void                               *user_data);
+void ply_boot_client_batch_update_daemon (ply_boot_client_t                  *client,
+                                          const char                         *new_statuses,
+                                          ply_boot_client_response_handler_t  handler,
+                                          ply_boot_client_response_handler_t  failed_handler,
+                                          void                               *user_data);
 void ply_boot_client_tell_daemon_to_change_root (ply_boot_client_t                  *client,
                                                  const char                         *chroot_dir,
                                                  ply_boot_client_response_handler_t  handler,
@@ -132,6 +139,7 @@ void ply_boot_client_ask_daemon_has_active_vt (ply_boot_client_t
                                                void                               *user_data);
 void ply_boot_client_flush (ply_boot_client_t *client);
 void ply_boot_client_disconnect (ply_boot_client_t *client);
+bool ply_boot_client_is_connected (ply_boot_client_t *client);
 void ply_boot_client_attach_to_event_loop (ply_boot_client_t *client,
                                            ply_event_loop_t  *loop);
 void ply_boot_client_tell_daemon_about_error (ply_boot_client_t                  *client,
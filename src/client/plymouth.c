@@ -33,6 +33,7 @@
 #include <sys/wait.h>
 
 #include "ply-boot-client.h"
+#include "ply-buffer.h"
 #include "ply-command-parser.h"
 #include "ply-event-loop.h"
 #include "ply-logger.h"
@@ -50,6 +51,12 @@ typedef struct
   ply_boot_client_t    *client;
   ply_command_parser_t *command_parser;
   char kernel_command_line[PLY_MAX_COMMAND_LINE_SIZE];
+
+  ply_buffer_t         *stream_buffer;
+  int                   number_of_pending_stream_requests;
+  uint32_t              stream_is_closed : 1;
+  uint32_t              daemon_has_update_batches : 1;
+  uint32_t              daemon_lacks_update_batches : 1;
 } state_t;
 
 typedef struct
@@ -76,6 +83,12 @@ typedef struct
   char    *keys;
 } key_answer_state_t;
 
+typedef struct
+{
+  state_t *state;
+  char    *statuses;
+} update_batch_state_t;
+
 static char **
 split_string (const char *command,
               const char  delimiter)
@@ -826,12 +839,247 @@ on_update_request (state_t    *state,
     }
 }
 
+static void process_stream_lines (state_t *state);
+
+static void
+on_stream_update_sent (state_t *state)
+{
+  state->number_of_pending_stream_requests--;
+
+  /* pick up any lines that were held back waiting on this reply
+   */
+  process_stream_lines (state);
+
+  if (state->stream_is_closed &&
+      state->number_of_pending_stream_requests == 0)
+    ply_event_loop_exit (state->loop, 0);
+}
+
+static void
+send_stream_update (state_t    *state,
+                    const char *status)
+{
+  state->number_of_pending_stream_requests++;
+  ply_boot_client_update_daemon (state->client, status,
+                                 (ply_boot_client_response_handler_t)
+                                 on_stream_update_sent,
+                                 (ply_boot_client_response_handler_t)
+                                 on_failure, state);
+}
+
+static void
+send_stream_updates_one_at_a_time (state_t    *state,
+                                   const char *statuses)
+{
+  char **status_list;
+  int i;
+
+  status_list = split_string (statuses, '\n');
+  for (i = 0; status_list[i] != NULL; i++)
+    send_stream_update (state, status_list[i]);
+  ply_free_string_array (status_list);
+}
+
+static void
+on_update_batch_sent (update_batch_state_t *batch_state)
+{
+  state_t *state;
+
+  state = batch_state->state;
+  free (batch_state->statuses);
+  free (batch_state);
+
+  state->daemon_has_update_batches = true;
+  on_stream_update_sent (state);
+}
+
+static void
+on_update_batch_failure (update_batch_state_t *batch_state)
+{
+  state_t *state;
+
+  state = batch_state->state;
+
+  /* Requests fail this way on a hangup too, and then there is
+   * nothing to fall back to
+   */
+  if (!ply_boot_client_is_connected (state->client))
+    {
+      free (batch_state->statuses);
+      free (batch_state);
+      on_failure (state);
+      return;
+    }
+
+  /* The daemon may be too old to know about batches,
+   * so fall back to sending the updates one at a time
+   */
+  ply_trace ("update batch refused, sending updates one at a time");
+  state->daemon_lacks_update_batches = true;
+  send_stream_updates_one_at_a_time (state, batch_state->statuses);
+
+  free (batch_state->statuses);
+  free (batch_state);
+
+  on_stream_update_sent (state);
+}
+
+static void
+send_stream_updates (state_t *state,
+                     char    *statuses)
+{
+  update_batch_state_t *batch_state;
+
+  if (state->daemon_lacks_update_batches || strchr (statuses, '\n') == NULL)
+    {
+      send_stream_updates_one_at_a_time (state, statuses);
+      free (statuses);
+      return;
+    }
+
+  batch_state = calloc (1, sizeof (update_batch_state_t));
+  batch_state->state = state;
+  batch_state->statuses = statuses;
+
+  state->number_of_pending_stream_requests++;
+  ply_boot_client_batch_update_daemon (state->client, statuses,
+                                       (ply_boot_client_response_handler_t)
+                                       on_update_batch_sent,
+                                       (ply_boot_client_response_handler_t)
+                                       on_update_batch_failure,
+                                       batch_state);
+}
+
+/* Until the daemon has answered the first request, it isn't known
+ * whether it takes batches or how long they can be, and a refused
+ * batch has to be resent before anything queued after it
+ */
+static bool
+stream_lines_are_held_back (state_t *state)
+{
+  return !state->daemon_has_update_batches &&
+         !state->daemon_lacks_update_batches &&
+         state->number_of_pending_stream_requests > 0;
+}
+
+/* Packs every complete line that has come in so far into as few
+ * requests as possible
+ */
+static void
+process_stream_lines (state_t *state)
+{
+  ply_buffer_t *batch;
+  const char *bytes, *line, *end;
+  size_t size, line_length, batch_size, max_batch_size;
+
+  if (stream_lines_are_held_back (state))
+    return;
+
+  /* older daemons only take short arguments
+   */
+  max_batch_size = ply_boot_client_get_max_argument_size (state->client);
+
+  bytes = ply_buffer_get_bytes (state->stream_buffer);
+  size = ply_buffer_get_size (state->stream_buffer);
+  batch = ply_buffer_new ();
+
+  line = bytes;
+  while ((end = memchr (line, '\n', bytes + size - line)) != NULL)
+    {
+      line_length = MIN ((size_t) (end - line), max_batch_size);
+
+      if (line_length > 0)
+        {
+          batch_size = ply_buffer_get_size (batch);
+
+          if (batch_size > 0 &&
+              batch_size + 1 + line_length > max_batch_size)
+            {
+              send_stream_updates (state, ply_buffer_steal_bytes (batch));
+
+              if (stream_lines_are_held_back (state))
+                break;
+
+              batch_size = 0;
+            }
+
+          if (batch_size > 0)
+            ply_buffer_append_bytes (batch, "\n", 1);
+          ply_buffer_append_bytes (batch, line, line_length);
+        }
+
+      line = end + 1;
+    }
+
+  if (ply_buffer_get_size (batch) > 0)
+    send_stream_updates (state, ply_buffer_steal_bytes (batch));
+  ply_buffer_free (batch);
+
+  ply_buffer_remove_bytes (state->stream_buffer, line - bytes);
+}
+
+static void
+on_stream_data (state_t *state)
+{
+  ply_buffer_append_from_fd (state->stream_buffer, STDIN_FILENO);
+  process_stream_lines (state);
+}
+
+static void
+on_stream_closed (state_t *state)
+{
+  ply_trace ("standard input closed");
+
+  /* treat whatever is left as the last line
+   */
+  ply_buffer_append_bytes (state->stream_buffer, "\n", 1);
+  process_stream_lines (state);
+
+  state->stream_is_closed = true;
+  if (state->number_of_pending_stream_requests == 0)
+    ply_event_loop_exit (state->loop, 0);
+}
+
+static void
+stream_updates (state_t *state)
+{
+  struct stat file_info;
+
+  state->stream_buffer = ply_buffer_new ();
+
+  /* a stream can go on for a while, so it's worth finding out up front
+   * whether the daemon takes longer batches
+   */
+  ply_boot_client_negotiate_protocol (state->client);
+
+  /* regular files can't be watched by the event loop,
+   * but they never block either, so just read them up front
+   */
+  if (fstat (STDIN_FILENO, &file_info) == 0 && S_ISREG (file_info.st_mode))
+    {
+      char bytes[4096];
+      ssize_t bytes_read;
+
+      while ((bytes_read = read (STDIN_FILENO, bytes, sizeof (bytes))) > 0)
+        ply_buffer_append_bytes (state->stream_buffer, bytes, bytes_read);
+
+      on_stream_closed (state);
+      return;
+    }
+
+  ply_event_loop_watch_fd (state->loop, STDIN_FILENO,
+                           PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                           (ply_event_handler_t) on_stream_data,
+                           (ply_event_handler_t) on_stream_closed,
+                           state);
+}
+
 int
 main (int    argc,
       char **argv)
 {
   state_t state = { 0 };
-  bool should_help, should_quit, should_ping, should_check_for_active_vt, should_sysinit, should_ask_for_password, should_show_splash, should_hide_splash, should_wait, should_be_verbose, report_error, should_get_plugin_path;
+  bool should_help, should_quit, should_ping, should_check_for_active_vt, should_sysinit, should_ask_for_password, should_show_splash, should_hide_splash, should_wait, should_be_verbose, report_error, should_get_plugin_path, should_stream;
   bool is_connected;
   char *status, *chroot_dir, *ignore_keystroke;
   int exit_code;
@@ -858,6 +1106,7 @@ main (int    argc,
                                   "ask-for-password", "Ask user for password", PLY_COMMAND_OPTION_TYPE_FLAG,
                                   "ignore-keystroke", "Remove sensitivity to a keystroke", PLY_COMMAND_OPTION_TYPE_STRING,
                                   "update", "Tell boot daemon an update about boot progress", PLY_COMMAND_OPTION_TYPE_STRING,
+                                  "stream", "Tell boot daemon about each line of standard input as a boot progress update", PLY_COMMAND_OPTION_TYPE_FLAG,
                                   "details", "Tell boot daemon there were errors during boot", PLY_COMMAND_OPTION_TYPE_FLAG,
                                   "wait", "Wait for boot daemon to quit", PLY_COMMAND_OPTION_TYPE_FLAG,
                                   NULL);
@@ -998,6 +1247,7 @@ main (int    argc,
                                   "ask-for-password", &should_ask_for_password,
                                   "ignore-keystroke", &ignore_keystroke,
                                   "update", &status,
+                                  "stream", &should_stream,
                                   "wait", &should_wait,
                                   "details", &report_error,
                                   NULL);
@@ -1050,6 +1300,11 @@ main (int    argc,
           ply_trace ("has active vt? failed");
           return 1;
         }
+      if (should_stream)
+        {
+          ply_trace ("can't stream updates");
+          return 1;
+        }
     }
 
   ply_boot_client_attach_to_event_loop (state.client, state.loop);
@@ -1086,6 +1341,8 @@ main (int    argc,
                                               on_success,
                                               (ply_boot_client_response_handler_t)
                                               on_failure, &state);
+  else if (should_stream)
+    stream_updates (&state);
   else if (status != NULL)
     ply_boot_client_update_daemon (state.client, status,
                                    (ply_boot_client_response_handler_t)
@@ -1139,6 +1396,7 @@ main (int    argc,
   exit_code = ply_event_loop_run (state.loop);
 
   ply_boot_client_free (state.client);
+  ply_buffer_free (state.stream_buffer);
 
   ply_event_loop_free (state.loop);
 
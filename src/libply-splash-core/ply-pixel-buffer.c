@@ -37,14 +37,48 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+typedef enum
+{
+  PLY_PIXEL_SPAN_TYPE_TRANSPARENT = 0,
+  PLY_PIXEL_SPAN_TYPE_OPAQUE,
+  PLY_PIXEL_SPAN_TYPE_TRANSLUCENT
+} ply_pixel_span_type_t;
+
+/* A run of pixels in a row that all share the same span type.
+ * Spans cover their row completely, so a span starts where the
+ * previous one in the row ends.
+ */
+typedef struct
+{
+  uint32_t end;
+  ply_pixel_span_type_t type;
+} ply_pixel_span_t;
+
+/* Rows that break up into more spans than this fraction of their
+ * width get stored as one translucent span, since walking the spans
+ * would cost more than just blending them.
+ */
+#define PLY_PIXEL_BUFFER_SPANS_PER_ROW_DIVISOR 8
+
+#define PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH 16
+
 struct _ply_pixel_buffer
 {
   uint32_t *bytes;
 
   ply_rectangle_t area;
-  ply_list_t *clip_areas;
+
+  /* Each entry is the pushed area already intersected with everything
+   * under it, so cropping only has to look at the top one.
+   */
+  ply_rectangle_t clip_areas[PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH];
+  int clip_depth;
 
   ply_region_t *updated_areas;
+
+  ply_pixel_span_t *spans;
+  unsigned long *row_spans;
+  ply_rectangle_t visible_area;
 };
 
 static inline void ply_pixel_buffer_blend_value_at_pixel (ply_pixel_buffer_t *buffer,
@@ -151,6 +185,166 @@ make_pixel_value_translucent (uint32_t pixel_value,
   return (alpha << 24) | (red << 16) | (green << 8) | blue;
 }
 
+typedef void (* ply_pixel_buffer_blend_row_handler_t) (uint32_t       *destination,
+                                                       const uint32_t *source,
+                                                       unsigned long   width,
+                                                       uint8_t         opacity);
+
+static void
+blend_argb32_row (uint32_t       *destination,
+                  const uint32_t *source,
+                  unsigned long   width,
+                  uint8_t         opacity)
+{
+  unsigned long i;
+
+  for (i = 0; i < width; i++)
+    {
+      uint32_t pixel_value;
+
+      pixel_value = source[i];
+      if ((pixel_value >> 24) == 0x00)
+        continue;
+
+      pixel_value = make_pixel_value_translucent (pixel_value, opacity);
+
+      if ((pixel_value >> 24) != 0xff)
+        pixel_value = blend_two_pixel_values (pixel_value, destination[i]);
+
+      destination[i] = pixel_value;
+    }
+}
+
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+#define PLY_PIXEL_BUFFER_HAVE_SSE2
+#include <emmintrin.h>
+
+/* Divides each 16-bit lane by 255 with rounding, using the same
+ * (x + (x >> 8) + 0x80) >> 8 approximation (and the same 16-bit
+ * wrap around) as the scalar code, so results are bit exact.
+ */
+#define DIVIDE_BY_255(value, rounding)                                        \
+    _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 ((value),                    \
+                                                  _mm_srli_epi16 ((value), 8)),\
+                                   (rounding)), 8)
+
+/* Blends four pixels at a time.  Only destination pixels that are fully
+ * opaque are handled in vector registers, since that's the common case
+ * (the background is drawn first) and the blend equation collapses to
+ * 16-bit arithmetic there.  Anything else goes through the scalar code.
+ */
+__attribute__((__target__ ("sse2")))
+static void
+blend_argb32_row_sse2 (uint32_t       *destination,
+                       const uint32_t *source,
+                       unsigned long   width,
+                       uint8_t         opacity)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i alpha_mask = _mm_set1_epi32 ((int) 0xff000000);
+  const __m128i max_value = _mm_set1_epi16 (0xff);
+  const __m128i rounding = _mm_set1_epi16 (0x80);
+  const __m128i opacity_value = _mm_set1_epi16 (opacity);
+  unsigned long i;
+
+  for (i = 0; i + 4 <= width; i += 4)
+    {
+      __m128i source_pixels, destination_pixels;
+      __m128i source_alpha, transparent_pixels;
+      __m128i low_pixels, high_pixels;
+      __m128i low_destination, high_destination;
+      __m128i low_alpha, high_alpha;
+      __m128i result;
+
+      source_pixels = _mm_loadu_si128 ((const __m128i *) (source + i));
+      source_alpha = _mm_and_si128 (source_pixels, alpha_mask);
+      transparent_pixels = _mm_cmpeq_epi32 (source_alpha, zero);
+
+      if (_mm_movemask_epi8 (transparent_pixels) == 0xffff)
+        continue;
+
+      if (opacity == 0xff &&
+          _mm_movemask_epi8 (_mm_cmpeq_epi32 (source_alpha, alpha_mask)) == 0xffff)
+        {
+          _mm_storeu_si128 ((__m128i *) (destination + i), source_pixels);
+          continue;
+        }
+
+      destination_pixels = _mm_loadu_si128 ((const __m128i *) (destination + i));
+
+      if (_mm_movemask_epi8 (_mm_cmpeq_epi32 (_mm_and_si128 (destination_pixels,
+                                                             alpha_mask),
+                                              alpha_mask)) != 0xffff)
+        {
+          blend_argb32_row (destination + i, source + i, 4, opacity);
+          continue;
+        }
+
+      low_pixels = _mm_unpacklo_epi8 (source_pixels, zero);
+      high_pixels = _mm_unpackhi_epi8 (source_pixels, zero);
+
+      if (opacity != 0xff)
+        {
+          low_pixels = _mm_mullo_epi16 (low_pixels, opacity_value);
+          low_pixels = DIVIDE_BY_255 (low_pixels, rounding);
+          high_pixels = _mm_mullo_epi16 (high_pixels, opacity_value);
+          high_pixels = DIVIDE_BY_255 (high_pixels, rounding);
+        }
+
+      low_alpha = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (low_pixels,
+                                                            _MM_SHUFFLE (3, 3, 3, 3)),
+                                       _MM_SHUFFLE (3, 3, 3, 3));
+      high_alpha = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (high_pixels,
+                                                             _MM_SHUFFLE (3, 3, 3, 3)),
+                                        _MM_SHUFFLE (3, 3, 3, 3));
+
+      low_destination = _mm_unpacklo_epi8 (destination_pixels, zero);
+      high_destination = _mm_unpackhi_epi8 (destination_pixels, zero);
+
+      low_pixels = _mm_add_epi16 (_mm_mullo_epi16 (low_pixels, max_value),
+                                  _mm_mullo_epi16 (low_destination,
+                                                   _mm_sub_epi16 (max_value,
+                                                                  low_alpha)));
+      high_pixels = _mm_add_epi16 (_mm_mullo_epi16 (high_pixels, max_value),
+                                   _mm_mullo_epi16 (high_destination,
+                                                    _mm_sub_epi16 (max_value,
+                                                                   high_alpha)));
+      low_pixels = DIVIDE_BY_255 (low_pixels, rounding);
+      high_pixels = DIVIDE_BY_255 (high_pixels, rounding);
+
+      result = _mm_or_si128 (_mm_packus_epi16 (low_pixels, high_pixels),
+                             alpha_mask);
+      result = _mm_or_si128 (_mm_and_si128 (transparent_pixels,
+                                            destination_pixels),
+                             _mm_andnot_si128 (transparent_pixels, result));
+
+      _mm_storeu_si128 ((__m128i *) (destination + i), result);
+    }
+
+  blend_argb32_row (destination + i, source + i, width - i, opacity);
+}
+#undef DIVIDE_BY_255
+#endif
+
+static ply_pixel_buffer_blend_row_handler_t
+get_blend_row_handler (void)
+{
+  static ply_pixel_buffer_blend_row_handler_t handler = NULL;
+
+  if (handler != NULL)
+    return handler;
+
+  handler = blend_argb32_row;
+
+#ifdef PLY_PIXEL_BUFFER_HAVE_SSE2
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    handler = blend_argb32_row_sse2;
+#endif
+
+  return handler;
+}
+
 static inline void
 ply_pixel_buffer_blend_value_at_pixel (ply_pixel_buffer_t *buffer,
                                        int                 x,
@@ -174,25 +368,146 @@ ply_pixel_buffer_crop_area_to_clip_area (ply_pixel_buffer_t *buffer,
                                          ply_rectangle_t    *area,
                                          ply_rectangle_t    *cropped_area)
 {
-  ply_list_node_t *node;
+  if (buffer->clip_depth == 0)
+    {
+      *cropped_area = *area;
+      return;
+    }
+
+  ply_rectangle_intersect (area,
+                           &buffer->clip_areas[MIN (buffer->clip_depth,
+                                                    PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH) - 1],
+                           cropped_area);
+}
+
+static void
+ply_pixel_buffer_discard_span_index (ply_pixel_buffer_t *buffer)
+{
+  free (buffer->spans);
+  buffer->spans = NULL;
+  free (buffer->row_spans);
+  buffer->row_spans = NULL;
+}
+
+static ply_pixel_span_type_t
+get_span_type_for_pixel_value (uint32_t pixel_value)
+{
+  switch (pixel_value >> 24)
+    {
+      case 0x00:
+        return PLY_PIXEL_SPAN_TYPE_TRANSPARENT;
+      case 0xff:
+        return PLY_PIXEL_SPAN_TYPE_OPAQUE;
+      default:
+        return PLY_PIXEL_SPAN_TYPE_TRANSLUCENT;
+    }
+}
+
+void
+ply_pixel_buffer_index_spans (ply_pixel_buffer_t *buffer)
+{
+  unsigned long row, column;
+  unsigned long number_of_spans, max_number_of_spans;
+  unsigned long visible_start, visible_end;
+  unsigned long first_visible_row, last_visible_row;
+
+  assert (buffer != NULL);
+
+  ply_pixel_buffer_discard_span_index (buffer);
 
-  *cropped_area = *area;
+  number_of_spans = 0;
+  max_number_of_spans = MAX (buffer->area.height, 1);
+  visible_start = buffer->area.width;
+  visible_end = 0;
+  first_visible_row = buffer->area.height;
+  last_visible_row = 0;
+  buffer->spans = malloc (max_number_of_spans * sizeof (ply_pixel_span_t));
+  buffer->row_spans = malloc ((buffer->area.height + 1) * sizeof (unsigned long));
 
-  node = ply_list_get_first_node (buffer->clip_areas);
-  while (node != NULL)
+  for (row = 0; row < buffer->area.height; row++)
     {
-      ply_list_node_t *next_node;
-      ply_rectangle_t *clip_rectangle;
+      uint32_t *pixels;
+      unsigned long first_span;
+
+      pixels = &buffer->bytes[row * buffer->area.width];
+      first_span = number_of_spans;
+      buffer->row_spans[row] = first_span;
+
+      column = 0;
+      while (column < buffer->area.width)
+        {
+          ply_pixel_span_type_t type;
+          unsigned long end;
+
+          type = get_span_type_for_pixel_value (pixels[column]);
+          for (end = column + 1; end < buffer->area.width; end++)
+            {
+              if (get_span_type_for_pixel_value (pixels[end]) != type)
+                break;
+            }
+
+          if (number_of_spans == max_number_of_spans)
+            {
+              max_number_of_spans *= 2;
+              buffer->spans = realloc (buffer->spans,
+                                       max_number_of_spans * sizeof (ply_pixel_span_t));
+            }
+
+          buffer->spans[number_of_spans].end = end;
+          buffer->spans[number_of_spans].type = type;
+          number_of_spans++;
 
-      clip_rectangle = ply_list_node_get_data (node);
-      next_node = ply_list_get_next_node (buffer->clip_areas, node);
+          if (type != PLY_PIXEL_SPAN_TYPE_TRANSPARENT)
+            {
+              visible_start = MIN (visible_start, column);
+              visible_end = MAX (visible_end, end);
+              first_visible_row = MIN (first_visible_row, row);
+              last_visible_row = row;
+            }
+
+          column = end;
+        }
+
+      if (number_of_spans - first_span >
+          MAX (buffer->area.width / PLY_PIXEL_BUFFER_SPANS_PER_ROW_DIVISOR, 1))
+        {
+          buffer->spans[first_span].end = buffer->area.width;
+          buffer->spans[first_span].type = PLY_PIXEL_SPAN_TYPE_TRANSLUCENT;
+          number_of_spans = first_span + 1;
+        }
+    }
 
-      ply_rectangle_intersect (cropped_area, clip_rectangle, cropped_area);
+  buffer->row_spans[buffer->area.height] = number_of_spans;
 
-      node = next_node;
+  if (visible_start < visible_end)
+    {
+      buffer->visible_area.x = visible_start;
+      buffer->visible_area.y = first_visible_row;
+      buffer->visible_area.width = visible_end - visible_start;
+      buffer->visible_area.height = last_visible_row - first_visible_row + 1;
+    }
+  else
+    {
+      buffer->visible_area.x = 0;
+      buffer->visible_area.y = 0;
+      buffer->visible_area.width = 0;
+      buffer->visible_area.height = 0;
     }
 }
 
+void
+ply_pixel_buffer_get_visible_area (ply_pixel_buffer_t *buffer,
+                                   ply_rectangle_t    *area)
+{
+  assert (buffer != NULL);
+  assert (area != NULL);
+
+  if (buffer->spans == NULL)
+    *area = buffer->area;
+  else
+    *area = buffer->visible_area;
+}
+
 static void
 ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t      *buffer,
                                              ply_rectangle_t         *fill_area,
@@ -201,6 +516,7 @@ ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t      *buffer,
   unsigned long row, column;
   ply_rectangle_t cropped_area;
 
+  ply_pixel_buffer_discard_span_index (buffer);
   ply_pixel_buffer_crop_area_to_clip_area (buffer, fill_area, &cropped_area);
 
   for (row = cropped_area.y; row < cropped_area.y + cropped_area.height; row++)
@@ -218,22 +534,29 @@ void
 ply_pixel_buffer_push_clip_area (ply_pixel_buffer_t *buffer,
                                  ply_rectangle_t    *clip_area)
 {
-  ply_rectangle_t *new_clip_area;
-
-  new_clip_area = malloc (sizeof (*new_clip_area));
+  /* Pushes past the end of the stack are still counted, so that pops
+   * stay balanced, but the deepest stored area keeps doing the clipping
+   */
+  if (buffer->clip_depth >= PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH)
+    {
+      if (buffer->clip_depth == PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH)
+        ply_trace ("clip areas nested more than %d deep, ignoring inner ones",
+                   PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH - 1);
+      buffer->clip_depth++;
+      return;
+    }
 
-  *new_clip_area = *clip_area;
-  ply_list_append_data (buffer->clip_areas, new_clip_area);
+  ply_pixel_buffer_crop_area_to_clip_area (buffer, clip_area,
+                                           &buffer->clip_areas[buffer->clip_depth]);
+  buffer->clip_depth++;
 }
 
 void
 ply_pixel_buffer_pop_clip_area (ply_pixel_buffer_t *buffer)
 {
-  ply_list_node_t *last_node;
+  assert (buffer->clip_depth > 0);
 
-  last_node = ply_list_get_last_node (buffer->clip_areas);
-  free (ply_list_node_get_data (last_node));
-  ply_list_remove_node (buffer->clip_areas, last_node);
+  buffer->clip_depth--;
 }
 
 ply_pixel_buffer_t *
@@ -249,29 +572,18 @@ ply_pixel_buffer_new (unsigned long width,
   buffer->area.width = width;
   buffer->area.height = height;
 
-  buffer->clip_areas = ply_list_new ();
   ply_pixel_buffer_push_clip_area (buffer, &buffer->area);
 
   return buffer;
 }
 
-static void
-free_clip_areas (ply_pixel_buffer_t *buffer)
-{
-  while (ply_list_get_length (buffer->clip_areas) > 0)
-    ply_pixel_buffer_pop_clip_area (buffer);
-
-  ply_list_free (buffer->clip_areas);
-  buffer->clip_areas = NULL;
-}
-
 void
 ply_pixel_buffer_free (ply_pixel_buffer_t *buffer)
 {
   if (buffer == NULL)
     return;
 
-  free_clip_areas (buffer);
+  ply_pixel_buffer_discard_span_index (buffer);
   free (buffer->bytes);
   ply_region_free (buffer->updated_areas);
   free (buffer);
@@ -353,6 +665,7 @@ ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
   if (fill_area == NULL)
     fill_area = &buffer->area;
 
+  ply_pixel_buffer_discard_span_index (buffer);
   ply_pixel_buffer_crop_area_to_clip_area (buffer, fill_area, &cropped_area);
 
   red   = (start << RED_SHIFT) & COLOR_MASK;
@@ -502,24 +815,67 @@ ply_pixel_buffer_fill_with_hex_color (ply_pixel_buffer_t *buffer,
                                                           hex_color, 1.0);
 }
 
-void
-ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buffer_t *buffer,
-                                                             ply_rectangle_t    *fill_area,
-                                                             ply_rectangle_t    *clip_area,
-                                                             unsigned long       x,
-                                                             unsigned long       y,
-                                                             uint32_t           *data,
-                                                             double              opacity)
+static void
+blend_argb32_spans (uint32_t                             *destination,
+                    const uint32_t                       *source,
+                    const ply_pixel_span_t               *span,
+                    unsigned long                         start,
+                    unsigned long                         width,
+                    uint8_t                               opacity,
+                    ply_pixel_buffer_blend_row_handler_t  blend_row)
 {
-  unsigned long row, column;
+  unsigned long column, end;
+
+  while (span->end <= start)
+    span++;
+
+  for (column = start; column < start + width; column = end, span++)
+    {
+      end = MIN (span->end, start + width);
+
+      switch (span->type)
+        {
+          case PLY_PIXEL_SPAN_TYPE_TRANSPARENT:
+            break;
+
+          case PLY_PIXEL_SPAN_TYPE_OPAQUE:
+            if (opacity == 0xff)
+              {
+                memcpy (destination + (column - start), source + column,
+                        (end - column) * sizeof (uint32_t));
+                break;
+              }
+            /* fall through */
+
+          case PLY_PIXEL_SPAN_TYPE_TRANSLUCENT:
+            blend_row (destination + (column - start), source + column,
+                       end - column, opacity);
+            break;
+        }
+    }
+}
+
+static void
+ply_pixel_buffer_fill_with_argb32_data_from_source (ply_pixel_buffer_t *buffer,
+                                                    ply_rectangle_t    *fill_area,
+                                                    ply_rectangle_t    *clip_area,
+                                                    unsigned long       x,
+                                                    unsigned long       y,
+                                                    uint32_t           *data,
+                                                    ply_pixel_buffer_t *source,
+                                                    double              opacity)
+{
+  unsigned long row;
   uint8_t opacity_as_byte;
   ply_rectangle_t cropped_area;
+  ply_pixel_buffer_blend_row_handler_t blend_row;
 
   assert (buffer != NULL);
 
   if (fill_area == NULL)
     fill_area = &buffer->area;
 
+  ply_pixel_buffer_discard_span_index (buffer);
   ply_pixel_buffer_crop_area_to_clip_area (buffer, fill_area, &cropped_area);
 
   if (clip_area)
@@ -532,28 +888,41 @@ ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buffer_t
   y += cropped_area.y - fill_area->y;
   opacity_as_byte = (uint8_t) (opacity * 255.0);
 
+  blend_row = get_blend_row_handler ();
+
   for (row = y; row < y + cropped_area.height; row++)
     {
-      for (column = x; column < x + cropped_area.width; column++)
-        {
-          uint32_t pixel_value;
-
-          pixel_value = data[fill_area->width * row + column];
-          if ((pixel_value >> 24) == 0x00)
-            continue;
-
-          pixel_value = make_pixel_value_translucent (pixel_value, opacity_as_byte);
-          ply_pixel_buffer_blend_value_at_pixel (buffer,
-                                                 cropped_area.x + (column - x),
-                                                 cropped_area.y + (row - y),
-                                                 pixel_value);
-
-        }
+      uint32_t *destination;
+
+      destination = &buffer->bytes[(cropped_area.y + (row - y)) * buffer->area.width +
+                                   cropped_area.x];
+      if (source != NULL && source->spans != NULL)
+        blend_argb32_spans (destination, &data[fill_area->width * row],
+                            &source->spans[source->row_spans[row]],
+                            x, cropped_area.width, opacity_as_byte,
+                            blend_row);
+      else
+        blend_row (destination, &data[fill_area->width * row + x],
+                   cropped_area.width, opacity_as_byte);
     }
 
   ply_region_add_rectangle (buffer->updated_areas, &cropped_area);
 }
 
+void
+ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buffer_t *buffer,
+                                                             ply_rectangle_t    *fill_area,
+                                                             ply_rectangle_t    *clip_area,
+                                                             unsigned long       x,
+                                                             unsigned long       y,
+                                                             uint32_t           *data,
+                                                             double              opacity)
+{
+  ply_pixel_buffer_fill_with_argb32_data_from_source (buffer, fill_area,
+                                                      clip_area, x, y,
+                                                      data, NULL, opacity);
+}
+
 void
 ply_pixel_buffer_fill_with_argb32_data_at_opacity (ply_pixel_buffer_t *buffer,
                                                    ply_rectangle_t    *fill_area,
@@ -595,101 +964,427 @@ ply_pixel_buffer_fill_with_argb32_data_with_clip (ply_pixel_buffer_t *buffer,
                                                                data, 1.0);
 }
 
+void
+ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canvas,
+                                                        ply_pixel_buffer_t *source,
+                                                        int                 x_offset,
+                                                        int                 y_offset,
+                                                        ply_rectangle_t    *clip_area,
+                                                        double              opacity)
+{
+  ply_rectangle_t fill_area;
+
+  assert (canvas != NULL);
+  assert (source != NULL);
+
+  fill_area.x = x_offset;
+  fill_area.y = y_offset;
+  fill_area.width = source->area.width;
+  fill_area.height = source->area.height;
+
+  ply_pixel_buffer_fill_with_argb32_data_from_source (canvas, &fill_area,
+                                                      clip_area, 0, 0,
+                                                      source->bytes, source,
+                                                      opacity);
+}
+
+void
+ply_pixel_buffer_fill_with_buffer_at_opacity (ply_pixel_buffer_t *canvas,
+                                              ply_pixel_buffer_t *source,
+                                              int                 x_offset,
+                                              int                 y_offset,
+                                              double              opacity)
+{
+  ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (canvas, source,
+                                                          x_offset, y_offset,
+                                                          NULL, opacity);
+}
+
+void
+ply_pixel_buffer_fill_with_buffer_with_clip (ply_pixel_buffer_t *canvas,
+                                             ply_pixel_buffer_t *source,
+                                             int                 x_offset,
+                                             int                 y_offset,
+                                             ply_rectangle_t    *clip_area)
+{
+  ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (canvas, source,
+                                                          x_offset, y_offset,
+                                                          clip_area, 1.0);
+}
+
+void
+ply_pixel_buffer_fill_with_buffer (ply_pixel_buffer_t *canvas,
+                                   ply_pixel_buffer_t *source,
+                                   int                 x_offset,
+                                   int                 y_offset)
+{
+  ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (canvas, source,
+                                                          x_offset, y_offset,
+                                                          NULL, 1.0);
+}
+
 uint32_t *
 ply_pixel_buffer_get_argb32_data (ply_pixel_buffer_t *buffer)
 {
   return buffer->bytes;
 }
 
-static inline uint32_t
-ply_pixel_buffer_interpolate (ply_pixel_buffer_t *buffer,
-                              double              x,
-                              double              y)
+/* Resizing is done in two passes: each source row is first resampled
+ * horizontally into a row of 16-bit channels, then output rows are
+ * built by resampling those vertically.  Both passes use per-pixel
+ * tables of fixed point weights, worked out once up front.
+ *
+ * Enlarging (and mild shrinking) uses bilinear weights on the same
+ * corner-aligned grid as ply_pixel_buffer_interpolate.  Shrinking by
+ * a factor of two or more averages every covered source pixel (a box
+ * filter) instead, so thin details don't just drop out.
+ */
+#define PLY_PIXEL_BUFFER_FILTER_SHIFT 14
+#define PLY_PIXEL_BUFFER_FILTER_ONE (1 << PLY_PIXEL_BUFFER_FILTER_SHIFT)
+
+/* Bits of fraction dropped from horizontal results, so they fit
+ * in 16 bits with 8 bits of fraction left over.
+ */
+#define PLY_PIXEL_BUFFER_FILTER_ROW_SHIFT (PLY_PIXEL_BUFFER_FILTER_SHIFT - 8)
+
+typedef struct
 {
-  int ix;
-  int iy;
-  int width;
-  int height;
-  
-  int i;
-  
-  int offset_x;
-  int offset_y;
-  uint32_t pixels[2][2];
-  uint32_t reply = 0;
-  uint32_t *bytes;
-  
-  width = buffer->area.width;
-  height = buffer->area.height;
+  unsigned long  taps;
+  unsigned long *first;
+  unsigned long *count;
+  uint32_t      *weights;
+} ply_pixel_buffer_filter_t;
 
-  
-  bytes = ply_pixel_buffer_get_argb32_data (buffer);
-  
-  for (offset_y = 0; offset_y < 2; offset_y++)
-  for (offset_x = 0; offset_x < 2; offset_x++)
+static void
+ply_pixel_buffer_filter_init_bilinear (ply_pixel_buffer_filter_t *filter,
+                                       unsigned long              source_length,
+                                       unsigned long              length)
+{
+  unsigned long i;
+
+  filter->taps = 2;
+  filter->first = calloc (length, sizeof (unsigned long));
+  filter->count = calloc (length, sizeof (unsigned long));
+  filter->weights = calloc (length * filter->taps, sizeof (uint32_t));
+
+  for (i = 0; i < length; i++)
     {
-      ix = x + offset_x;
-      iy = y + offset_y;
-      
-      if (ix < 0 || ix >= width || iy < 0 || iy >= height)
-        pixels[offset_y][offset_x] = 0x00000000;
+      uint64_t position;
+      uint32_t weight;
+
+      /* 16.16 fixed point source position */
+      position = ((uint64_t) i * (source_length - 1) << 16) / MAX (length - 1, 1);
+      weight = (position & 0xffff) >> (16 - PLY_PIXEL_BUFFER_FILTER_SHIFT);
+
+      filter->first[i] = position >> 16;
+
+      if (weight == 0 || filter->first[i] + 1 >= source_length)
+        {
+          filter->count[i] = 1;
+          filter->weights[i * filter->taps] = PLY_PIXEL_BUFFER_FILTER_ONE;
+        }
       else
-        pixels[offset_y][offset_x] = bytes[ix + iy * width];
-    }
-  if (!pixels[0][0] && !pixels[0][1] && !pixels[1][0] && !pixels[1][1]) return 0;
-  
-  ix = x;
-  iy = y;
-  x -= ix;
-  y -= iy;
-  for (i = 0; i < 4; i++)
-    {
-      uint32_t value = 0;
-      uint32_t mask = 0xFF << (i * 8);
-      value += ((pixels[0][0]) & mask) * (1-x) * (1-y);
-      value += ((pixels[0][1]) & mask) * x * (1-y);
-      value += ((pixels[1][0]) & mask) * (1-x) * y;
-      value += ((pixels[1][1]) & mask) * x * y;
-      reply |= value & mask;
+        {
+          filter->count[i] = 2;
+          filter->weights[i * filter->taps] = PLY_PIXEL_BUFFER_FILTER_ONE - weight;
+          filter->weights[i * filter->taps + 1] = weight;
+        }
     }
-  return reply;
 }
 
-ply_pixel_buffer_t *
-ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
-                         long                width,
-                         long                height)
+static void
+ply_pixel_buffer_filter_init_box (ply_pixel_buffer_filter_t *filter,
+                                  unsigned long              source_length,
+                                  unsigned long              length)
 {
-  ply_pixel_buffer_t *buffer;
-  int x, y;
-  double old_x, old_y;
-  int old_width, old_height;
-  float scale_x, scale_y;
-  uint32_t *bytes;
-  
-  buffer = ply_pixel_buffer_new (width, height);
+  unsigned long i;
 
-  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+  filter->taps = source_length / length + 2;
+  filter->first = calloc (length, sizeof (unsigned long));
+  filter->count = calloc (length, sizeof (unsigned long));
+  filter->weights = calloc (length * filter->taps, sizeof (uint32_t));
 
-  old_width = old_buffer->area.width;
-  old_height = old_buffer->area.height;
+  /* Positions are measured in 1/length of a source pixel, so
+   * output pixel i covers [i * source_length, (i + 1) * source_length)
+   * and source pixel j covers [j * length, (j + 1) * length).
+   */
+  for (i = 0; i < length; i++)
+    {
+      unsigned long start, end, j, k;
+      uint32_t *weights, total;
 
-  scale_x = ((double) old_width - 1) / MAX (width - 1, 1);
-  scale_y = ((double) old_height - 1) / MAX (height - 1, 1);
+      start = i * source_length;
+      end = start + source_length;
 
-  for (y = 0; y < height; y++)
-    {
-      old_y = y * scale_y;
-      for (x=0; x < width; x++)
+      filter->first[i] = start / length;
+      filter->count[i] = (end - 1) / length - filter->first[i] + 1;
+      weights = &filter->weights[i * filter->taps];
+
+      total = 0;
+      for (k = 0; k < filter->count[i]; k++)
         {
-          old_x = x * scale_x;
-          bytes[x + y * width] =
-                    ply_pixel_buffer_interpolate (old_buffer, old_x, old_y);
+          unsigned long overlap;
+
+          j = filter->first[i] + k;
+          overlap = MIN (end, (j + 1) * length) - MAX (start, j * length);
+          weights[k] = ((uint64_t) overlap << PLY_PIXEL_BUFFER_FILTER_SHIFT) / source_length;
+          total += weights[k];
+        }
+
+      /* hand any rounding error to the middle of the box */
+      weights[filter->count[i] / 2] += PLY_PIXEL_BUFFER_FILTER_ONE - total;
+    }
+}
+
+static void
+ply_pixel_buffer_filter_init (ply_pixel_buffer_filter_t *filter,
+                              unsigned long              source_length,
+                              unsigned long              length)
+{
+  if (source_length >= 2 * length)
+    ply_pixel_buffer_filter_init_box (filter, source_length, length);
+  else
+    ply_pixel_buffer_filter_init_bilinear (filter, source_length, length);
+}
+
+static void
+ply_pixel_buffer_filter_destroy (ply_pixel_buffer_filter_t *filter)
+{
+  free (filter->first);
+  free (filter->count);
+  free (filter->weights);
+}
+
+static void
+resample_row_horizontally (const uint32_t            *source,
+                           ply_pixel_buffer_filter_t *filter,
+                           unsigned long              width,
+                           uint16_t                  *destination)
+{
+  unsigned long x, k;
+
+  for (x = 0; x < width; x++)
+    {
+      const uint32_t *pixels, *weights;
+      uint32_t alpha, red, green, blue;
+
+      pixels = &source[filter->first[x]];
+      weights = &filter->weights[x * filter->taps];
+      alpha = red = green = blue = 0;
+
+      for (k = 0; k < filter->count[x]; k++)
+        {
+          alpha += (pixels[k] >> 24) * weights[k];
+          red += ((pixels[k] >> 16) & 0xff) * weights[k];
+          green += ((pixels[k] >> 8) & 0xff) * weights[k];
+          blue += (pixels[k] & 0xff) * weights[k];
+        }
+
+#define ROUND_ROW_VALUE(value) \
+  (((value) + (1 << (PLY_PIXEL_BUFFER_FILTER_ROW_SHIFT - 1))) >> PLY_PIXEL_BUFFER_FILTER_ROW_SHIFT)
+      destination[4 * x + 0] = ROUND_ROW_VALUE (alpha);
+      destination[4 * x + 1] = ROUND_ROW_VALUE (red);
+      destination[4 * x + 2] = ROUND_ROW_VALUE (green);
+      destination[4 * x + 3] = ROUND_ROW_VALUE (blue);
+#undef ROUND_ROW_VALUE
+    }
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
+                         long                width,
+                         long                height)
+{
+  ply_pixel_buffer_t *buffer;
+  ply_pixel_buffer_filter_t horizontal_filter, vertical_filter;
+  unsigned long old_width, old_height;
+  unsigned long x, y, k;
+  uint16_t **rows;
+  long *row_numbers;
+  uint32_t *bytes;
+
+  buffer = ply_pixel_buffer_new (width, height);
+
+  old_width = old_buffer->area.width;
+  old_height = old_buffer->area.height;
+
+  if (old_width == 0 || old_height == 0 || width <= 0 || height <= 0)
+    return buffer;
+
+  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+
+  ply_pixel_buffer_filter_init (&horizontal_filter, old_width, width);
+  ply_pixel_buffer_filter_init (&vertical_filter, old_height, height);
+
+  /* Horizontally resampled source rows are kept in a small ring,
+   * indexed by source row modulo its size, since the rows each
+   * output row needs only ever move downward.
+   */
+  rows = calloc (vertical_filter.taps, sizeof (uint16_t *));
+  row_numbers = calloc (vertical_filter.taps, sizeof (long));
+  for (k = 0; k < vertical_filter.taps; k++)
+    {
+      rows[k] = malloc (4 * width * sizeof (uint16_t));
+      row_numbers[k] = -1;
+    }
+
+  for (y = 0; y < (unsigned long) height; y++)
+    {
+      const uint32_t *weights;
+      uint16_t *source_rows[vertical_filter.taps];
+      uint32_t *destination;
+
+      for (k = 0; k < vertical_filter.count[y]; k++)
+        {
+          unsigned long source_row, slot;
+
+          source_row = vertical_filter.first[y] + k;
+          slot = source_row % vertical_filter.taps;
+
+          if (row_numbers[slot] != (long) source_row)
+            {
+              resample_row_horizontally (&old_buffer->bytes[source_row * old_width],
+                                         &horizontal_filter, width, rows[slot]);
+              row_numbers[slot] = source_row;
+            }
+          source_rows[k] = rows[slot];
+        }
+
+      weights = &vertical_filter.weights[y * vertical_filter.taps];
+      destination = &bytes[y * width];
+
+      for (x = 0; x < 4 * (unsigned long) width; x += 4)
+        {
+          uint32_t alpha, red, green, blue;
+
+          alpha = red = green = blue = 0;
+          for (k = 0; k < vertical_filter.count[y]; k++)
+            {
+              alpha += source_rows[k][x + 0] * weights[k];
+              red += source_rows[k][x + 1] * weights[k];
+              green += source_rows[k][x + 2] * weights[k];
+              blue += source_rows[k][x + 3] * weights[k];
+            }
+
+#define ROUND_PIXEL_VALUE(value) \
+  MIN (((value) + (1 << (PLY_PIXEL_BUFFER_FILTER_SHIFT + 7))) >> (PLY_PIXEL_BUFFER_FILTER_SHIFT + 8), 0xff)
+          destination[x / 4] = (ROUND_PIXEL_VALUE (alpha) << 24)
+                               | (ROUND_PIXEL_VALUE (red) << 16)
+                               | (ROUND_PIXEL_VALUE (green) << 8)
+                               | ROUND_PIXEL_VALUE (blue);
+#undef ROUND_PIXEL_VALUE
         }
     }
+
+  for (k = 0; k < vertical_filter.taps; k++)
+    free (rows[k]);
+  free (rows);
+  free (row_numbers);
+
+  ply_pixel_buffer_filter_destroy (&horizontal_filter);
+  ply_pixel_buffer_filter_destroy (&vertical_filter);
+
   return buffer;
 }
 
+static inline uint32_t
+get_pixel_value_or_zero (ply_pixel_buffer_t *buffer,
+                         int                 x,
+                         int                 y)
+{
+  if (x < 0 || y < 0 ||
+      x >= (int) buffer->area.width || y >= (int) buffer->area.height)
+    return 0;
+
+  return buffer->bytes[y * buffer->area.width + x];
+}
+
+/* Mixes two pixel values by weight / 256, handling red and blue
+ * in one multiply and alpha and green in another.
+ */
+__attribute__((__pure__))
+static inline uint32_t
+mix_two_pixel_values (uint32_t pixel_value_1,
+                      uint32_t pixel_value_2,
+                      uint32_t weight)
+{
+  uint32_t red_blue, alpha_green;
+
+  red_blue = (pixel_value_1 & 0x00ff00ff) * (256 - weight) +
+             (pixel_value_2 & 0x00ff00ff) * weight;
+  alpha_green = ((pixel_value_1 >> 8) & 0x00ff00ff) * (256 - weight) +
+                ((pixel_value_2 >> 8) & 0x00ff00ff) * weight;
+
+  return ((red_blue >> 8) & 0x00ff00ff) | (alpha_green & 0xff00ff00);
+}
+
+/* x and y are 16.16 fixed point.  Pixels off the edge of the buffer
+ * count as transparent.
+ */
+static inline uint32_t
+ply_pixel_buffer_interpolate_fixed (ply_pixel_buffer_t *buffer,
+                                    int32_t             x,
+                                    int32_t             y)
+{
+  int ix, iy;
+  uint32_t top, bottom;
+
+  ix = x >> 16;
+  iy = y >> 16;
+
+  top = mix_two_pixel_values (get_pixel_value_or_zero (buffer, ix, iy),
+                              get_pixel_value_or_zero (buffer, ix + 1, iy),
+                              (x >> 8) & 0xff);
+  bottom = mix_two_pixel_values (get_pixel_value_or_zero (buffer, ix, iy + 1),
+                                 get_pixel_value_or_zero (buffer, ix + 1, iy + 1),
+                                 (x >> 8) & 0xff);
+
+  return mix_two_pixel_values (top, bottom, (y >> 8) & 0xff);
+}
+
+/* Coordinates get rounded to 16.16 fixed point before they are
+ * sampled, so anything that rounds onto the edge is on it
+ */
+#define PLY_PIXEL_BUFFER_ROTATE_EDGE_SLOP (0.5 / 65536.0)
+
+/* Narrows [first, last] down to the x values for which
+ * 0 <= origin + x * step <= limit, after rounding to fixed point.
+ * Returns false if none are left.
+ */
+static bool
+clip_span_to_range (double  origin,
+                    double  step,
+                    double  limit,
+                    double *first,
+                    double *last)
+{
+  double lower, upper;
+  double start, end;
+
+  lower = -PLY_PIXEL_BUFFER_ROTATE_EDGE_SLOP;
+  upper = limit + PLY_PIXEL_BUFFER_ROTATE_EDGE_SLOP;
+
+  if (fabs (step) < 1e-9)
+    return origin >= lower && origin <= upper;
+
+  start = (lower - origin) / step;
+  end = (upper - origin) / step;
+
+  if (step < 0)
+    {
+      double swap;
+
+      swap = start;
+      start = end;
+      end = swap;
+    }
+
+  *first = MAX (*first, start);
+  *last = MIN (*last, end);
+
+  return *first <= *last;
+}
+
 ply_pixel_buffer_t *
 ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
                          long                center_x,
@@ -698,10 +1393,13 @@ ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
 {
   ply_pixel_buffer_t *buffer;
   int x, y;
-  double old_x, old_y;
   int width;
   int height;
   uint32_t *bytes;
+  int32_t fixed_step_x, fixed_step_y;
+  unsigned long number_of_spans;
+  int visible_start, visible_end;
+  int first_visible_row, last_visible_row;
 
   width = old_buffer->area.width;
   height = old_buffer->area.height;
@@ -717,7 +1415,434 @@ ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
   double start_y = center_y + d * sin (theta);
   double step_x = cos (-theta_offset);
   double step_y = sin (-theta_offset);
+
+  /* Round rather than truncate, so that right angles map every pixel
+   * exactly onto another one
+   */
+  fixed_step_x = (int32_t) lround (step_x * 65536.0);
+  fixed_step_y = (int32_t) lround (step_y * 65536.0);
+
+  /* Every row has at most one run of pixels that map inside the old
+   * buffer, so it gets at most three spans: transparent, translucent,
+   * transparent.
+   */
+  buffer->spans = malloc (3 * MAX (height, 1) * sizeof (ply_pixel_span_t));
+  buffer->row_spans = malloc ((height + 1) * sizeof (unsigned long));
+  number_of_spans = 0;
+
+  visible_start = width;
+  visible_end = 0;
+  first_visible_row = height;
+  last_visible_row = 0;
+
+  for (y = 0; y < height; y++)
+    {
+      double first, last;
+      int span_start, span_end;
+
+      buffer->row_spans[y] = number_of_spans;
+
+      /* Work out which part of the row lands inside the old buffer,
+       * rather than testing every pixel
+       */
+      first = 0;
+      last = width - 1;
+      if (clip_span_to_range (start_x, step_x, width, &first, &last) &&
+          clip_span_to_range (start_y, step_y, height, &first, &last))
+        {
+          span_start = (int) ceil (first);
+          span_end = (int) floor (last) + 1;
+        }
+      else
+        {
+          span_start = span_end = 0;
+        }
+
+      if (span_start < span_end)
+        {
+          int32_t old_x, old_y;
+          uint32_t *row;
+
+          old_x = (int32_t) lround ((start_x + span_start * step_x) * 65536.0);
+          old_y = (int32_t) lround ((start_y + span_start * step_y) * 65536.0);
+          row = &bytes[y * width];
+
+          for (x = span_start; x < span_end; x++)
+            {
+              row[x] = ply_pixel_buffer_interpolate_fixed (old_buffer,
+                                                           old_x, old_y);
+              old_x += fixed_step_x;
+              old_y += fixed_step_y;
+            }
+
+          if (span_start > 0)
+            {
+              buffer->spans[number_of_spans].end = span_start;
+              buffer->spans[number_of_spans].type = PLY_PIXEL_SPAN_TYPE_TRANSPARENT;
+              number_of_spans++;
+            }
+
+          buffer->spans[number_of_spans].end = span_end;
+          buffer->spans[number_of_spans].type = PLY_PIXEL_SPAN_TYPE_TRANSLUCENT;
+          number_of_spans++;
+
+          visible_start = MIN (visible_start, span_start);
+          visible_end = MAX (visible_end, span_end);
+          first_visible_row = MIN (first_visible_row, y);
+          last_visible_row = y;
+        }
+
+      if (span_end < width)
+        {
+          buffer->spans[number_of_spans].end = width;
+          buffer->spans[number_of_spans].type = PLY_PIXEL_SPAN_TYPE_TRANSPARENT;
+          number_of_spans++;
+        }
+
+      start_y += step_x;
+      start_x -= step_y;
+    }
+
+  buffer->row_spans[height] = number_of_spans;
+
+  if (visible_start < visible_end)
+    {
+      buffer->visible_area.x = visible_start;
+      buffer->visible_area.y = first_visible_row;
+      buffer->visible_area.width = visible_end - visible_start;
+      buffer->visible_area.height = last_visible_row - first_visible_row + 1;
+    }
+
+  return buffer;
+}
+
+#ifdef PLY_PIXEL_BUFFER_ENABLE_TEST
+static uint32_t
+get_random_pixel_value (void)
+{
+  uint8_t alpha, red, green, blue;
+
+  switch (random () % 4)
+    {
+      case 0:
+        alpha = 0x00;
+        break;
+      case 1:
+        alpha = 0xff;
+        break;
+      default:
+        alpha = random () % 256;
+        break;
+    }
+
+  /* pixel buffers hold premultiplied data */
+  red = alpha? random () % (alpha + 1) : 0;
+  green = alpha? random () % (alpha + 1) : 0;
+  blue = alpha? random () % (alpha + 1) : 0;
+
+  return (alpha << 24) | (red << 16) | (green << 8) | blue;
+}
+
+static int
+test_blend_row_handler (const char                           *name,
+                        ply_pixel_buffer_blend_row_handler_t  handler)
+{
+  static const uint8_t opacities[] = { 0x00, 0x01, 0x80, 0xfe, 0xff };
+  uint32_t source[67], destination[67];
+  uint32_t expected[67], got[67];
+  unsigned long width, i, o;
+  int iteration;
+
+  for (iteration = 0; iteration < 1000; iteration++)
+    {
+      for (o = 0; o < sizeof (opacities) / sizeof (opacities[0]); o++)
+        {
+          width = random () % 68;
+
+          for (i = 0; i < width; i++)
+            {
+              source[i] = get_random_pixel_value ();
+              destination[i] = get_random_pixel_value ();
+
+              if (iteration % 2)
+                destination[i] |= 0xff000000;
+            }
+
+          memcpy (expected, destination, width * sizeof (uint32_t));
+          memcpy (got, destination, width * sizeof (uint32_t));
+
+          blend_argb32_row (expected, source, width, opacities[o]);
+          handler (got, source, width, opacities[o]);
+
+          for (i = 0; i < width; i++)
+            {
+              if (expected[i] != got[i])
+                {
+                  printf ("%s: source %08x over %08x at opacity %02x "
+                          "gave %08x, expected %08x\n",
+                          name, source[i], destination[i], opacities[o],
+                          got[i], expected[i]);
+                  return 1;
+                }
+            }
+        }
+    }
+
+  printf ("%s: blend results match\n", name);
+  return 0;
+}
+
+static int
+test_span_index (void)
+{
+  static const double opacities[] = { 0.0, 0.5, 1.0 };
+  ply_pixel_buffer_t *source, *expected, *got;
+  ply_rectangle_t fill_area;
+  uint32_t *bytes;
+  unsigned long i, o;
+
+  source = ply_pixel_buffer_new (53, 41);
+  bytes = ply_pixel_buffer_get_argb32_data (source);
+
+  /* mostly long runs, like typical theme artwork */
+  for (i = 0; i < 53 * 41; i++)
+    {
+      if (i % 17 == 0)
+        bytes[i] = get_random_pixel_value ();
+      else
+        bytes[i] = bytes[i - 1];
+    }
+  ply_pixel_buffer_index_spans (source);
+
+  for (o = 0; o < sizeof (opacities) / sizeof (opacities[0]); o++)
+    {
+      fill_area.x = 7;
+      fill_area.y = -5;
+      fill_area.width = 53;
+      fill_area.height = 41;
+
+      expected = ply_pixel_buffer_new (64, 48);
+      got = ply_pixel_buffer_new (64, 48);
+      ply_pixel_buffer_fill_with_hex_color (expected, NULL, 0x336699);
+      ply_pixel_buffer_fill_with_hex_color (got, NULL, 0x336699);
+
+      ply_pixel_buffer_fill_with_argb32_data_at_opacity (expected, &fill_area,
+                                                         0, 0,
+                                                         ply_pixel_buffer_get_argb32_data (source),
+                                                         opacities[o]);
+      ply_pixel_buffer_fill_with_buffer_at_opacity (got, source,
+                                                    fill_area.x, fill_area.y,
+                                                    opacities[o]);
+
+      if (memcmp (ply_pixel_buffer_get_argb32_data (expected),
+                  ply_pixel_buffer_get_argb32_data (got),
+                  64 * 48 * sizeof (uint32_t)) != 0)
+        {
+          printf ("spans: blit at opacity %f differs from unindexed blit\n",
+                  opacities[o]);
+          return 1;
+        }
+
+      ply_pixel_buffer_free (expected);
+      ply_pixel_buffer_free (got);
+    }
+
+  ply_pixel_buffer_free (source);
+
+  printf ("spans: blit results match\n");
+  return 0;
+}
+
+static inline uint32_t
+ply_pixel_buffer_interpolate (ply_pixel_buffer_t *buffer,
+                              double              x,
+                              double              y)
+{
+  int ix;
+  int iy;
+  int width;
+  int height;
+  
+  int i;
+  
+  int offset_x;
+  int offset_y;
+  uint32_t pixels[2][2];
+  uint32_t reply = 0;
+  uint32_t *bytes;
+  
+  width = buffer->area.width;
+  height = buffer->area.height;
+
   
+  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+  
+  for (offset_y = 0; offset_y < 2; offset_y++)
+  for (offset_x = 0; offset_x < 2; offset_x++)
+    {
+      ix = x + offset_x;
+      iy = y + offset_y;
+      
+      if (ix < 0 || ix >= width || iy < 0 || iy >= height)
+        pixels[offset_y][offset_x] = 0x00000000;
+      else
+        pixels[offset_y][offset_x] = bytes[ix + iy * width];
+    }
+  if (!pixels[0][0] && !pixels[0][1] && !pixels[1][0] && !pixels[1][1]) return 0;
+  
+  ix = x;
+  iy = y;
+  x -= ix;
+  y -= iy;
+  for (i = 0; i < 4; i++)
+    {
+      uint32_t value = 0;
+      uint32_t mask = 0xFF << (i * 8);
+      value += ((pixels[0][0]) & mask) * (1-x) * (1-y);
+      value += ((pixels[0][1]) & mask) * x * (1-y);
+      value += ((pixels[1][0]) & mask) * (1-x) * y;
+      value += ((pixels[1][1]) & mask) * x * y;
+      reply |= value & mask;
+    }
+  return reply;
+}
+
+/* The per-pixel bilinear resize that ply_pixel_buffer_resize replaced,
+ * kept around to compare results and speed against.
+ */
+static ply_pixel_buffer_t *
+resize_with_interpolation (ply_pixel_buffer_t *old_buffer,
+                           long                width,
+                           long                height)
+{
+  ply_pixel_buffer_t *buffer;
+  int x, y;
+  double old_x, old_y;
+  float scale_x, scale_y;
+  uint32_t *bytes;
+
+  buffer = ply_pixel_buffer_new (width, height);
+  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+
+  scale_x = ((double) old_buffer->area.width - 1) / MAX (width - 1, 1);
+  scale_y = ((double) old_buffer->area.height - 1) / MAX (height - 1, 1);
+
+  for (y = 0; y < height; y++)
+    {
+      old_y = y * scale_y;
+      for (x = 0; x < width; x++)
+        {
+          old_x = x * scale_x;
+          bytes[x + y * width] = ply_pixel_buffer_interpolate (old_buffer,
+                                                               old_x, old_y);
+        }
+    }
+  return buffer;
+}
+
+static int
+get_largest_channel_difference (uint32_t pixel_value_1,
+                                uint32_t pixel_value_2)
+{
+  int i, difference, largest_difference;
+
+  largest_difference = 0;
+  for (i = 0; i < 32; i += 8)
+    {
+      difference = abs ((int) ((pixel_value_1 >> i) & 0xff) -
+                        (int) ((pixel_value_2 >> i) & 0xff));
+      largest_difference = MAX (largest_difference, difference);
+    }
+
+  return largest_difference;
+}
+
+static int
+test_resize (long source_width,
+             long source_height,
+             long width,
+             long height)
+{
+  ply_pixel_buffer_t *source, *expected, *got;
+  uint32_t *bytes, *expected_bytes, *got_bytes;
+  double start_time, interpolate_time, resize_time;
+  long i;
+  int difference, largest_difference;
+
+  source = ply_pixel_buffer_new (source_width, source_height);
+  bytes = ply_pixel_buffer_get_argb32_data (source);
+  for (i = 0; i < source_width * source_height; i++)
+    bytes[i] = get_random_pixel_value ();
+
+  start_time = ply_get_timestamp ();
+  expected = resize_with_interpolation (source, width, height);
+  interpolate_time = ply_get_timestamp () - start_time;
+
+  start_time = ply_get_timestamp ();
+  got = ply_pixel_buffer_resize (source, width, height);
+  resize_time = ply_get_timestamp () - start_time;
+
+  expected_bytes = ply_pixel_buffer_get_argb32_data (expected);
+  got_bytes = ply_pixel_buffer_get_argb32_data (got);
+
+  largest_difference = 0;
+  for (i = 0; i < width * height; i++)
+    {
+      difference = get_largest_channel_difference (expected_bytes[i],
+                                                   got_bytes[i]);
+      largest_difference = MAX (largest_difference, difference);
+    }
+
+  printf ("resize %ldx%ld to %ldx%ld: interpolate %.2fms, "
+          "resize %.2fms, largest difference %d\n",
+          source_width, source_height, width, height,
+          interpolate_time * 1000.0, resize_time * 1000.0,
+          largest_difference);
+
+  ply_pixel_buffer_free (source);
+  ply_pixel_buffer_free (expected);
+  ply_pixel_buffer_free (got);
+
+  /* Only enlargements use the same filter as the old code; when
+   * shrinking a lot the box filter is supposed to give different
+   * results.  The old code truncates each of its four products
+   * instead of rounding, so it can come out a few steps lower.
+   */
+  if (width >= source_width && height >= source_height &&
+      largest_difference > 4)
+    return 1;
+
+  return 0;
+}
+
+/* The per-pixel rotation that ply_pixel_buffer_rotate replaced */
+static ply_pixel_buffer_t *
+rotate_with_interpolation (ply_pixel_buffer_t *old_buffer,
+                           long                center_x,
+                           long                center_y,
+                           double              theta_offset)
+{
+  ply_pixel_buffer_t *buffer;
+  int x, y;
+  double old_x, old_y;
+  int width;
+  int height;
+  uint32_t *bytes;
+
+  width = old_buffer->area.width;
+  height = old_buffer->area.height;
+
+  buffer = ply_pixel_buffer_new (width, height);
+  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+
+  double d = sqrt ((center_x * center_x +
+                    center_y * center_y));
+  double theta = atan2 (-center_y, -center_x) - theta_offset;
+  double start_x = center_x + d * cos (theta);
+  double start_y = center_y + d * sin (theta);
+  double step_x = cos (-theta_offset);
+  double step_y = sin (-theta_offset);
+
   for (y = 0; y < height; y++)
     {
       old_y = start_y;
@@ -738,5 +1863,300 @@ ply_pixel_buffer_rotate (ply_pixel_buffer_t *old_buffer,
   return buffer;
 }
 
+static int
+test_rotate (long   width,
+             long   height,
+             double theta_offset)
+{
+  ply_pixel_buffer_t *source, *expected, *got;
+  ply_rectangle_t visible_area;
+  uint32_t *bytes, *expected_bytes, *got_bytes;
+  double start_time, interpolate_time, rotate_time;
+  long x, y, number_of_differences;
+  int errors;
+
+  errors = 0;
+  source = ply_pixel_buffer_new (width, height);
+  bytes = ply_pixel_buffer_get_argb32_data (source);
+  for (x = 0; x < width * height; x++)
+    bytes[x] = 0xff000000 | (x * 0x010203);
+
+  start_time = ply_get_timestamp ();
+  expected = rotate_with_interpolation (source, width / 2, height / 2,
+                                        theta_offset);
+  interpolate_time = ply_get_timestamp () - start_time;
+
+  start_time = ply_get_timestamp ();
+  got = ply_pixel_buffer_rotate (source, width / 2, height / 2, theta_offset);
+  rotate_time = ply_get_timestamp () - start_time;
+
+  expected_bytes = ply_pixel_buffer_get_argb32_data (expected);
+  got_bytes = ply_pixel_buffer_get_argb32_data (got);
+  ply_pixel_buffer_get_visible_area (got, &visible_area);
+
+  /* Pixels right on the edge of the rotated image can land on either
+   * side of it depending on rounding, so only count a difference
+   * when there are more than a handful.
+   */
+  number_of_differences = 0;
+  for (y = 0; y < height; y++)
+    {
+      for (x = 0; x < width; x++)
+        {
+          if (get_largest_channel_difference (expected_bytes[y * width + x],
+                                              got_bytes[y * width + x]) > 4)
+            number_of_differences++;
+
+          if (got_bytes[y * width + x] != 0 &&
+              (x < visible_area.x ||
+               x >= visible_area.x + (long) visible_area.width ||
+               y < visible_area.y ||
+               y >= visible_area.y + (long) visible_area.height))
+            {
+              printf ("rotate: pixel %ld,%ld is outside of visible area\n",
+                      x, y);
+              errors = 1;
+            }
+        }
+    }
+
+  printf ("rotate %ldx%ld by %.2f: interpolate %.2fms, rotate %.2fms, "
+          "%ld edge differences, visible area %ldx%ld+%ld+%ld\n",
+          width, height, theta_offset,
+          interpolate_time * 1000.0, rotate_time * 1000.0,
+          number_of_differences,
+          visible_area.width, visible_area.height,
+          visible_area.x, visible_area.y);
+
+  if (number_of_differences > 2 * (width + height))
+    errors = 1;
+
+  ply_pixel_buffer_free (source);
+  ply_pixel_buffer_free (expected);
+  ply_pixel_buffer_free (got);
+
+  return errors;
+}
+
+/* Right angles map every pixel exactly onto another one, so they
+ * have to come out without any differences at all
+ */
+static int
+test_rotate_exactly (long width,
+                     long height,
+                     int  quarter_turns)
+{
+  ply_pixel_buffer_t *source, *got;
+  ply_rectangle_t visible_area;
+  uint32_t *bytes, *got_bytes, expected;
+  long x, y, old_x, old_y, number_of_differences;
+  int errors;
+
+  errors = 0;
+  source = ply_pixel_buffer_new (width, height);
+  bytes = ply_pixel_buffer_get_argb32_data (source);
+  for (x = 0; x < width * height; x++)
+    bytes[x] = 0xff000000 | (x * 0x010203);
+
+  double theta_offset = quarter_turns * M_PI / 2;
+  double d = sqrt ((width / 2) * (width / 2) + (height / 2) * (height / 2));
+  double theta = atan2 (-(height / 2), -(width / 2)) - theta_offset;
+  double start_x = width / 2 + d * cos (theta);
+  double start_y = height / 2 + d * sin (theta);
+  double step_x = cos (-theta_offset);
+  double step_y = sin (-theta_offset);
+
+  got = ply_pixel_buffer_rotate (source, width / 2, height / 2, theta_offset);
+  got_bytes = ply_pixel_buffer_get_argb32_data (got);
+  ply_pixel_buffer_get_visible_area (got, &visible_area);
+
+  number_of_differences = 0;
+  for (y = 0; y < height; y++)
+    {
+      for (x = 0; x < width; x++)
+        {
+          old_x = lround (start_x - y * step_y + x * step_x);
+          old_y = lround (start_y + y * step_x + x * step_y);
+
+          if (old_x < 0 || old_x >= width || old_y < 0 || old_y >= height)
+            expected = 0;
+          else
+            expected = bytes[old_y * width + old_x];
+
+          if (got_bytes[y * width + x] != expected)
+            number_of_differences++;
+
+          if (expected != 0 &&
+              (x < visible_area.x ||
+               x >= visible_area.x + (long) visible_area.width ||
+               y < visible_area.y ||
+               y >= visible_area.y + (long) visible_area.height))
+            {
+              printf ("rotate: pixel %ld,%ld is outside of visible area\n",
+                      x, y);
+              errors = 1;
+            }
+        }
+    }
+
+  printf ("rotate %ldx%ld by %d degrees: %ld differences, "
+          "visible area %ldx%ld+%ld+%ld\n",
+          width, height, quarter_turns * 90, number_of_differences,
+          visible_area.width, visible_area.height,
+          visible_area.x, visible_area.y);
+
+  if (number_of_differences > 0)
+    errors = 1;
+
+  ply_pixel_buffer_free (source);
+  ply_pixel_buffer_free (got);
+
+  return errors;
+}
+
+/* Does what ply_pixel_display_draw_area does for each area: clip to
+ * it, let the splash fill a background and some sprites, and unclip.
+ */
+static int
+test_clip_stack (void)
+{
+  ply_pixel_buffer_t *buffer, *sprite;
+  ply_rectangle_t outer_clip, inner_clip, fill_area, expected;
+  double start_time, elapsed;
+  int i, j, number_of_draws;
+  uint32_t *bytes;
+
+  buffer = ply_pixel_buffer_new (1024, 768);
+  sprite = ply_pixel_buffer_new (8, 8);
+  ply_pixel_buffer_fill_with_hex_color (sprite, NULL, 0x80ff8040);
+
+  /* nested clips should crop to their intersection */
+  outer_clip.x = 10;
+  outer_clip.y = 20;
+  outer_clip.width = 100;
+  outer_clip.height = 50;
+  inner_clip.x = 60;
+  inner_clip.y = 0;
+  inner_clip.width = 100;
+  inner_clip.height = 40;
+  ply_pixel_buffer_push_clip_area (buffer, &outer_clip);
+  ply_pixel_buffer_push_clip_area (buffer, &inner_clip);
+  ply_pixel_buffer_fill_with_hex_color (buffer, NULL, 0xffffff);
+  ply_pixel_buffer_pop_clip_area (buffer);
+  ply_pixel_buffer_pop_clip_area (buffer);
+
+  expected.x = 60;
+  expected.y = 20;
+  expected.width = 50;
+  expected.height = 20;
+  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+  for (i = 0; i < 768; i++)
+    {
+      for (j = 0; j < 1024; j++)
+        {
+          bool is_inside;
+
+          is_inside = j >= expected.x && j < expected.x + (long) expected.width &&
+                      i >= expected.y && i < expected.y + (long) expected.height;
+
+          if ((bytes[i * 1024 + j] != 0) != is_inside)
+            {
+              printf ("clip: pixel %d,%d is wrong\n", j, i);
+              return 1;
+            }
+        }
+    }
+
+  /* clips nested deeper than the stack holds stop narrowing, and
+   * popping them all leaves the whole buffer drawable again
+   */
+  ply_pixel_buffer_free (buffer);
+  buffer = ply_pixel_buffer_new (1024, 768);
+  for (i = 1; i <= PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH + 4; i++)
+    {
+      fill_area.x = i;
+      fill_area.y = i;
+      fill_area.width = 1024 - 2 * i;
+      fill_area.height = 768 - 2 * i;
+      ply_pixel_buffer_push_clip_area (buffer, &fill_area);
+    }
+  ply_pixel_buffer_fill_with_hex_color (buffer, NULL, 0xffffff);
+  bytes = ply_pixel_buffer_get_argb32_data (buffer);
+  i = PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH - 1;
+  if (bytes[i * 1024 + i] == 0 || bytes[(i - 1) * 1024 + i - 1] != 0)
+    {
+      printf ("clip: overflowing clip areas clip to the wrong area\n");
+      return 1;
+    }
+  for (i = 1; i <= PLY_PIXEL_BUFFER_MAX_CLIP_DEPTH + 4; i++)
+    ply_pixel_buffer_pop_clip_area (buffer);
+  ply_pixel_buffer_fill_with_hex_color (buffer, NULL, 0xffffff);
+  if (bytes[0] == 0)
+    {
+      printf ("clip: popping overflowing clip areas didn't unwind them\n");
+      return 1;
+    }
+
+  number_of_draws = 0;
+  start_time = ply_get_timestamp ();
+  for (i = 0; i < 20000; i++)
+    {
+      fill_area.x = random () % 1000;
+      fill_area.y = random () % 740;
+      fill_area.width = 24;
+      fill_area.height = 24;
+      ply_pixel_buffer_push_clip_area (buffer, &fill_area);
+      ply_pixel_buffer_fill_with_hex_color (buffer, NULL, 0x000000);
+      for (j = 0; j < 8; j++)
+        ply_pixel_buffer_fill_with_buffer (buffer, sprite,
+                                           fill_area.x - 4 + j * 4,
+                                           fill_area.y - 4 + j * 4);
+      ply_pixel_buffer_pop_clip_area (buffer);
+      number_of_draws++;
+    }
+  elapsed = ply_get_timestamp () - start_time;
+
+  printf ("clip: %.0f draws/s\n", number_of_draws / elapsed);
+
+  ply_pixel_buffer_free (sprite);
+  ply_pixel_buffer_free (buffer);
+  return 0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  int errors;
+
+  errors = 0;
+  srandom (1);
+
+  errors |= test_span_index ();
+  errors |= test_resize (1, 1, 7, 5);
+  errors |= test_resize (37, 23, 101, 67);
+  errors |= test_resize (640, 400, 1920, 1200);
+  errors |= test_resize (1920, 1200, 1280, 800);
+  errors |= test_resize (1920, 1200, 160, 100);
+  errors |= test_rotate (64, 64, 0.0);
+  errors |= test_rotate (101, 37, 0.3);
+  errors |= test_rotate (400, 400, M_PI / 4);
+  errors |= test_rotate (400, 400, 2.5);
+  errors |= test_rotate_exactly (64, 64, 0);
+  errors |= test_rotate_exactly (64, 64, 1);
+  errors |= test_rotate_exactly (64, 64, 2);
+  errors |= test_rotate_exactly (64, 64, 3);
+  errors |= test_rotate_exactly (101, 37, 2);
+  errors |= test_clip_stack ();
+
+#ifdef PLY_PIXEL_BUFFER_HAVE_SSE2
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("sse2"))
+    errors |= test_blend_row_handler ("sse2", blend_argb32_row_sse2);
+#endif
+
+  return errors;
+}
+#endif /* PLY_PIXEL_BUFFER_ENABLE_TEST */
 
 /* vim: set ts=4 sw=4 et ai ci cino={.5s,^-2,+.5s,t0,g0,e-2,n-2,p2s,(0,=.5s,:.5s */
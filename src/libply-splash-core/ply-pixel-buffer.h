@@ -91,6 +91,41 @@ void ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (ply_pixel_buff
                                                                   uint32_t           *data,
                                                                   double              opacity);
 
+void ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canvas,
+                                                             ply_pixel_buffer_t *source,
+                                                             int                 x_offset,
+                                                             int                 y_offset,
+                                                             ply_rectangle_t    *clip_area,
+                                                             double              opacity);
+void ply_pixel_buffer_fill_with_buffer_at_opacity (ply_pixel_buffer_t *canvas,
+                                                   ply_pixel_buffer_t *source,
+                                                   int                 x_offset,
+                                                   int                 y_offset,
+                                                   double              opacity);
+void ply_pixel_buffer_fill_with_buffer_with_clip (ply_pixel_buffer_t *canvas,
+                                                  ply_pixel_buffer_t *source,
+                                                  int                 x_offset,
+                                                  int                 y_offset,
+                                                  ply_rectangle_t    *clip_area);
+void ply_pixel_buffer_fill_with_buffer (ply_pixel_buffer_t *canvas,
+                                        ply_pixel_buffer_t *source,
+                                        int                 x_offset,
+                                        int                 y_offset);
+
+/* Records which parts of each row are opaque, transparent or
+ * translucent, so ply_pixel_buffer_fill_with_buffer can copy or
+ * skip them without looking at every pixel.  The index is dropped
+ * whenever the buffer is drawn to, but not when its data is changed
+ * directly through ply_pixel_buffer_get_argb32_data.
+ */
+void ply_pixel_buffer_index_spans (ply_pixel_buffer_t *buffer);
+
+/* Gets the part of the buffer that isn't fully transparent, if known
+ * from the span index, or the whole buffer otherwise.
+ */
+void ply_pixel_buffer_get_visible_area (ply_pixel_buffer_t *buffer,
+                                        ply_rectangle_t    *area);
+
 void ply_pixel_buffer_push_clip_area (ply_pixel_buffer_t *buffer,
                                       ply_rectangle_t    *clip_area);
 void ply_pixel_buffer_pop_clip_area (ply_pixel_buffer_t *buffer);
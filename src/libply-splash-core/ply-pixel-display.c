@@ -39,6 +39,7 @@
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-pixel-buffer.h"
+#include "ply-region.h"
 #include "ply-renderer.h"
 #include "ply-utils.h"
 
@@ -58,6 +59,11 @@ struct _ply_pixel_display
 
   int pause_count;
 
+  /* Areas asked to be drawn while the last frame was still on its
+   * way to the screen; they get drawn together once it's there.
+   */
+  ply_region_t *pending_areas;
+  uint32_t is_waiting_for_frame : 1;
 };
 
 ply_pixel_display_t *
@@ -73,6 +79,7 @@ ply_pixel_display_new (ply_renderer_t      *renderer,
   display->loop = ply_event_loop_get_default ();
   display->renderer = renderer;
   display->head = head;
+  display->pending_areas = ply_region_new ();
 
   pixel_buffer = ply_renderer_get_buffer_for_head (renderer, head);
   ply_pixel_buffer_get_size (pixel_buffer, &size);
@@ -104,13 +111,25 @@ ply_pixel_display_get_bits_per_pixel (ply_pixel_display_t *display)
   return display->bits_per_pixel;
 }
 
+static void
+on_frame_done (ply_pixel_display_t *display,
+               ply_renderer_head_t *head);
+
 static void
 ply_pixel_display_flush (ply_pixel_display_t *display)
 {
   if (display->pause_count > 0)
     return;
 
+  if (display->is_waiting_for_frame)
+    return;
+
   ply_renderer_flush_head (display->renderer, display->head);
+
+  if (ply_renderer_watch_for_frame_done (display->renderer, display->head,
+                                         (ply_renderer_frame_done_handler_t)
+                                         on_frame_done, display))
+    display->is_waiting_for_frame = true;
 }
 
 void
@@ -131,14 +150,13 @@ ply_pixel_display_unpause_updates (ply_pixel_display_t *display)
   ply_pixel_display_flush (display);
 }
 
-void
-ply_pixel_display_draw_area (ply_pixel_display_t *display,
-                             int                  x,
-                             int                  y,
-                             int                  width,
-                             int                  height)
+static void
+ply_pixel_display_draw_area_now (ply_pixel_display_t *display,
+                                 int                  x,
+                                 int                  y,
+                                 int                  width,
+                                 int                  height)
 {
-
   ply_pixel_buffer_t *pixel_buffer;
 
   pixel_buffer = ply_renderer_get_buffer_for_head (display->renderer,
@@ -158,7 +176,62 @@ ply_pixel_display_draw_area (ply_pixel_display_t *display,
                              x, y, width, height, display);
       ply_pixel_buffer_pop_clip_area (pixel_buffer);
     }
+}
+
+static void
+on_frame_done (ply_pixel_display_t *display,
+               ply_renderer_head_t *head)
+{
+  ply_list_t *areas;
+  ply_list_node_t *node;
+
+  display->is_waiting_for_frame = false;
+
+  if (ply_region_is_empty (display->pending_areas))
+    return;
+
+  areas = ply_region_get_sorted_rectangle_list (display->pending_areas);
 
+  node = ply_list_get_first_node (areas);
+  while (node != NULL)
+    {
+      ply_list_node_t *next_node;
+      ply_rectangle_t *area;
+
+      area = (ply_rectangle_t *) ply_list_node_get_data (node);
+      next_node = ply_list_get_next_node (areas, node);
+
+      ply_pixel_display_draw_area_now (display,
+                                       area->x, area->y,
+                                       area->width, area->height);
+
+      node = next_node;
+    }
+  ply_region_clear (display->pending_areas);
+
+  ply_pixel_display_flush (display);
+}
+
+void
+ply_pixel_display_draw_area (ply_pixel_display_t *display,
+                             int                  x,
+                             int                  y,
+                             int                  width,
+                             int                  height)
+{
+  if (display->is_waiting_for_frame)
+    {
+      ply_rectangle_t area;
+
+      area.x = x;
+      area.y = y;
+      area.width = width;
+      area.height = height;
+      ply_region_add_rectangle (display->pending_areas, &area);
+      return;
+    }
+
+  ply_pixel_display_draw_area_now (display, x, y, width, height);
   ply_pixel_display_flush (display);
 }
 
@@ -168,6 +241,11 @@ ply_pixel_display_free (ply_pixel_display_t *display)
   if (display == NULL)
     return;
 
+  if (display->is_waiting_for_frame)
+    ply_renderer_stop_watching_for_frame_done (display->renderer,
+                                               display->head);
+
+  ply_region_free (display->pending_areas);
   free (display);
 }
 
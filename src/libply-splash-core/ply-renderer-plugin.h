@@ -68,6 +68,13 @@ typedef struct
 
   void                 (* close_input_source) (ply_renderer_backend_t *backend,
                                                ply_renderer_input_source_t *input_source);
+
+  bool (* watch_for_frame_done) (ply_renderer_backend_t            *backend,
+                                 ply_renderer_head_t               *head,
+                                 ply_renderer_frame_done_handler_t  handler,
+                                 void                              *user_data);
+  void (* stop_watching_for_frame_done) (ply_renderer_backend_t *backend,
+                                         ply_renderer_head_t    *head);
 } ply_renderer_plugin_interface_t;
 
 #endif /* PLY_RENDERER_PLUGIN_H */
@@ -38,6 +38,8 @@ typedef struct _ply_renderer_input_source ply_renderer_input_source_t;
 typedef void (* ply_renderer_input_source_handler_t) (void                        *user_data,
                                                       ply_buffer_t                *key_buffer,
                                                       ply_renderer_input_source_t *input_source);
+typedef void (* ply_renderer_frame_done_handler_t) (void                *user_data,
+                                                    ply_renderer_head_t *head);
 
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_renderer_t *ply_renderer_new (const char    * device_name,
@@ -56,6 +58,16 @@ unsigned int ply_renderer_get_bits_per_pixel_for_head (ply_renderer_t      *rend
 void ply_renderer_flush_head (ply_renderer_t      *renderer,
                               ply_renderer_head_t *head);
 
+/* Returns false if no frame is on its way to the screen for the head,
+ * in which case the handler is not called.
+ */
+bool ply_renderer_watch_for_frame_done (ply_renderer_t                    *renderer,
+                                        ply_renderer_head_t               *head,
+                                        ply_renderer_frame_done_handler_t  handler,
+                                        void                              *user_data);
+void ply_renderer_stop_watching_for_frame_done (ply_renderer_t      *renderer,
+                                                ply_renderer_head_t *head);
+
 ply_renderer_input_source_t *ply_renderer_get_input_source (ply_renderer_t *renderer);
 bool ply_renderer_open_input_source (ply_renderer_t              *renderer,
                                      ply_renderer_input_source_t *input_source);
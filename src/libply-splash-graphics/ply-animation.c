@@ -366,7 +366,6 @@ ply_animation_draw_area (ply_animation_t    *animation,
                          unsigned long       height)
 {
   ply_image_t * const * frames;
-  uint32_t *frame_data;
   int number_of_frames;
   int frame_index;
   
@@ -377,11 +376,11 @@ ply_animation_draw_area (ply_animation_t    *animation,
   frame_index = MIN(animation->frame_number, number_of_frames - 1);
 
   frames = (ply_image_t * const *) ply_array_get_elements (animation->frames);
-  frame_data = ply_image_get_data (frames[frame_index]);
 
-  ply_pixel_buffer_fill_with_argb32_data (buffer,
-                                          &animation->frame_area, 0, 0,
-                                          frame_data);
+  ply_pixel_buffer_fill_with_buffer (buffer,
+                                     ply_image_get_buffer (frames[frame_index]),
+                                     animation->frame_area.x,
+                                     animation->frame_area.y);
 }
 
 long
@@ -184,6 +184,7 @@ ply_image_load (ply_image_t *image)
     rows[row] = (png_byte*) &bytes[row * width];
 
   png_read_image (png, rows);
+  ply_pixel_buffer_index_spans (image->buffer);
 
   free (rows);
   png_read_end (png, info);
@@ -201,6 +202,14 @@ ply_image_get_data (ply_image_t *image)
   return ply_pixel_buffer_get_argb32_data (image->buffer);
 }
 
+ply_pixel_buffer_t *
+ply_image_get_buffer (ply_image_t *image)
+{
+  assert (image != NULL);
+
+  return image->buffer;
+}
+
 long
 ply_image_get_width (ply_image_t *image)
 {
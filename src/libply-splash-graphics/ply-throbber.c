@@ -366,17 +366,16 @@ ply_throbber_draw_area (ply_throbber_t     *throbber,
                         unsigned long       height)
 {
   ply_image_t * const * frames;
-  uint32_t *frame_data;
 
   if (throbber->is_stopped)
     return;
 
   frames = (ply_image_t * const *) ply_array_get_elements (throbber->frames);
-  frame_data = ply_image_get_data (frames[throbber->frame_number]);
 
-  ply_pixel_buffer_fill_with_argb32_data (buffer,
-                                          &throbber->frame_area, 0, 0,
-                                          frame_data);
+  ply_pixel_buffer_fill_with_buffer (buffer,
+                                     ply_image_get_buffer (frames[throbber->frame_number]),
+                                     throbber->frame_area.x,
+                                     throbber->frame_area.y);
 }
 
 long
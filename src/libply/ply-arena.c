@@ -0,0 +1,284 @@
+/* ply-arena.c - frame scoped memory arena
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-utils.h"
+
+#define PLY_ARENA_ALIGNMENT (2 * sizeof (void *))
+#define PLY_ARENA_ALIGN(size) (((size) + PLY_ARENA_ALIGNMENT - 1) & \
+                               ~(PLY_ARENA_ALIGNMENT - 1))
+
+typedef struct _ply_arena_block ply_arena_block_t;
+
+struct _ply_arena_block
+{
+  ply_arena_block_t *next_block;
+  size_t size;
+  size_t used;
+};
+
+#define PLY_ARENA_BLOCK_HEADER_SIZE PLY_ARENA_ALIGN (sizeof (ply_arena_block_t))
+
+/* Allocations are carved off the end of the current block, and nothing
+ * is given back until the arena is reset.  When a frame runs out of
+ * room more blocks get chained on, and the next reset folds them into
+ * one block big enough for the whole frame, so once frames settle down
+ * the arena stops calling malloc.
+ */
+struct _ply_arena
+{
+  ply_arena_block_t *blocks;
+  size_t total_used;
+};
+
+static ply_arena_block_t *
+ply_arena_block_new (size_t size)
+{
+  ply_arena_block_t *block;
+
+  block = malloc (PLY_ARENA_BLOCK_HEADER_SIZE + size);
+  block->next_block = NULL;
+  block->size = size;
+  block->used = 0;
+
+  return block;
+}
+
+static void
+ply_arena_free_blocks (ply_arena_block_t *block)
+{
+  while (block != NULL)
+    {
+      ply_arena_block_t *next_block;
+
+      next_block = block->next_block;
+      free (block);
+      block = next_block;
+    }
+}
+
+ply_arena_t *
+ply_arena_new (size_t size)
+{
+  ply_arena_t *arena;
+
+  arena = calloc (1, sizeof (ply_arena_t));
+  arena->blocks = ply_arena_block_new (MAX (size, 256));
+
+  return arena;
+}
+
+void
+ply_arena_free (ply_arena_t *arena)
+{
+  if (arena == NULL)
+    return;
+
+  ply_arena_free_blocks (arena->blocks);
+  free (arena);
+}
+
+/* Returns zeroed memory that stays valid until the next reset */
+void *
+ply_arena_allocate (ply_arena_t *arena,
+                    size_t       size)
+{
+  ply_arena_block_t *block;
+  void *memory;
+
+  assert (arena != NULL);
+
+  size = PLY_ARENA_ALIGN (size);
+
+  block = arena->blocks;
+  if (block->size - block->used < size)
+    {
+      block = ply_arena_block_new (MAX (2 * block->size, size));
+      block->next_block = arena->blocks;
+      arena->blocks = block;
+    }
+
+  memory = (char *) block + PLY_ARENA_BLOCK_HEADER_SIZE + block->used;
+  block->used += size;
+  arena->total_used += size;
+
+  memset (memory, 0, size);
+
+  return memory;
+}
+
+void
+ply_arena_reset (ply_arena_t *arena)
+{
+  assert (arena != NULL);
+
+  if (arena->blocks->next_block != NULL)
+    {
+      size_t size;
+
+      size = arena->blocks->size;
+      while (size < arena->total_used)
+        size *= 2;
+
+      ply_arena_free_blocks (arena->blocks);
+      arena->blocks = ply_arena_block_new (size);
+    }
+
+  arena->blocks->used = 0;
+  arena->total_used = 0;
+}
+#ifdef PLY_ARENA_ENABLE_TEST
+#include <stdio.h>
+
+#include "ply-list.h"
+#include "ply-region.h"
+
+#define NUMBER_OF_FRAMES 100
+#define NUMBER_OF_WARM_UP_FRAMES 5
+#define RECTANGLES_PER_FRAME 200
+
+/* Count calls into the allocator by standing in front of glibc's */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t number_of_elements, size_t size);
+extern void *__libc_realloc (void *memory, size_t size);
+
+static int number_of_allocations;
+
+void *
+malloc (size_t size)
+{
+  number_of_allocations++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t number_of_elements,
+        size_t size)
+{
+  number_of_allocations++;
+  return __libc_calloc (number_of_elements, size);
+}
+
+void *
+realloc (void   *memory,
+         size_t  size)
+{
+  number_of_allocations++;
+  return __libc_realloc (memory, size);
+}
+
+static void
+add_frame_rectangles (ply_region_t *region,
+                      int           frame)
+{
+  int i;
+
+  for (i = 0; i < RECTANGLES_PER_FRAME; i++)
+    {
+      ply_rectangle_t rectangle;
+
+      /* sprites drifting across the screen */
+      rectangle.x = (i * 37 + frame * 3) % 1000;
+      rectangle.y = (i * 53 + frame * 2) % 700;
+      rectangle.width = 16 + i % 48;
+      rectangle.height = 16 + (i * 7) % 48;
+      ply_region_add_rectangle (region, &rectangle);
+    }
+}
+
+static int
+count_rectangles (ply_list_t *list)
+{
+  ply_list_node_t *node;
+  int count;
+
+  count = 0;
+  for (node = ply_list_get_first_node (list);
+       node != NULL;
+       node = ply_list_get_next_node (list, node))
+    count++;
+
+  return count;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  ply_arena_t *frame_arena;
+  ply_region_t *updated_areas;
+  int frame, steady_state_allocations;
+
+  frame_arena = ply_arena_new (1024);
+  updated_areas = ply_region_new ();
+
+  steady_state_allocations = 0;
+  for (frame = 0; frame < NUMBER_OF_FRAMES; frame++)
+    {
+      ply_region_t *refresh_region;
+      ply_list_t *queue;
+      int count;
+
+      number_of_allocations = 0;
+
+      /* a region and list that only last the frame */
+      ply_arena_reset (frame_arena);
+      refresh_region = ply_region_new_with_arena (frame_arena);
+      queue = ply_list_new_with_arena (frame_arena);
+      add_frame_rectangles (refresh_region, frame);
+      count = count_rectangles (ply_region_get_sorted_rectangle_list (refresh_region));
+      ply_list_append_data (queue, refresh_region);
+      ply_list_remove_all_nodes (queue);
+      ply_list_append_data (queue, refresh_region);
+      ply_list_free (queue);
+      ply_region_free (refresh_region);
+
+      /* and one that's kept around and cleared every frame */
+      add_frame_rectangles (updated_areas, frame);
+      count += count_rectangles (ply_region_get_sorted_rectangle_list (updated_areas));
+      ply_region_clear (updated_areas);
+
+      if (count == 0)
+        {
+          printf ("frame %d has no rectangles\n", frame);
+          return 1;
+        }
+
+      if (frame >= NUMBER_OF_WARM_UP_FRAMES)
+        steady_state_allocations += number_of_allocations;
+    }
+
+  printf ("%d allocations over %d steady state frames\n",
+          steady_state_allocations,
+          NUMBER_OF_FRAMES - NUMBER_OF_WARM_UP_FRAMES);
+
+  ply_region_free (updated_areas);
+  ply_arena_free (frame_arena);
+
+  return steady_state_allocations != 0;
+}
+#endif /* PLY_ARENA_ENABLE_TEST */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,36 @@
+/* ply-arena.h - frame scoped memory arena
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_ARENA_H
+#define PLY_ARENA_H
+
+#include <stddef.h>
+
+typedef struct _ply_arena ply_arena_t;
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+ply_arena_t *ply_arena_new (size_t size);
+void ply_arena_free (ply_arena_t *arena);
+void *ply_arena_allocate (ply_arena_t *arena,
+                          size_t       size);
+void ply_arena_reset (ply_arena_t *arena);
+#endif
+
+#endif /* PLY_ARENA_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
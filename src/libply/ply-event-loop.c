@@ -25,6 +25,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <signal.h>
 #include <stdlib.h>
@@ -35,8 +36,10 @@
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/termios.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+#include "ply-hashtable.h"
 #include "ply-logger.h"
 #include "ply-list.h"
 #include "ply-utils.h"
@@ -46,7 +49,15 @@
 #endif
 
 #ifndef PLY_EVENT_LOOP_NO_TIMED_WAKEUP
-#define PLY_EVENT_LOOP_NO_TIMED_WAKEUP 0.0
+#define PLY_EVENT_LOOP_NO_TIMED_WAKEUP 0
+#endif
+
+/* When a timeout wakes the loop, others due within this many
+ * nanoseconds run along with it rather than waking the loop again.
+ * Only those can fire early, and by no more than this.
+ */
+#ifndef PLY_EVENT_LOOP_TIMER_SLACK
+#define PLY_EVENT_LOOP_TIMER_SLACK 1000000ULL
 #endif
 
 typedef struct
@@ -54,13 +65,16 @@ typedef struct
   int fd;
   ply_list_t *destinations;
   ply_list_t *fd_watches;
+  ply_list_node_t *node;
   uint32_t is_getting_polled : 1;
   uint32_t is_disconnected : 1;
+  uint32_t is_freed : 1;
 } ply_event_source_t;
 
 typedef struct
 {
   ply_event_source_t *source;
+  ply_list_node_t *node;
 
   ply_event_loop_fd_status_t status;
   ply_event_handler_t status_met_handler;
@@ -71,6 +85,7 @@ typedef struct
 struct _ply_fd_watch
 {
   ply_event_destination_t *destination;
+  ply_list_node_t *node;
 };
 
 typedef struct
@@ -96,32 +111,72 @@ typedef struct
   void                          *user_data;
 } ply_event_loop_exit_closure_t;
 
-typedef struct
+typedef struct _ply_event_loop_timeout_watch ply_event_loop_timeout_watch_t;
+
+struct _ply_event_loop_timeout_watch
 {
-  double timeout;
+  uint64_t timeout;
+  unsigned long sequence_number;
+  unsigned long heap_index;
+
   ply_event_loop_timeout_handler_t  handler;
   void                             *user_data;
-} ply_event_loop_timeout_watch_t;
+
+  /* other watches with the same handler and user data */
+  ply_event_loop_timeout_watch_t   *next_watch;
+};
 
 struct _ply_event_loop
 {
   int epoll_fd;
   int exit_code;
-  double wakeup_time;
+
+  /* absolute CLOCK_MONOTONIC deadlines in nanoseconds; the timer fd is
+   * only reprogrammed when the wanted wakeup changes
+   */
+  int timer_fd;
+  uint64_t wakeup_time;
+  uint64_t armed_wakeup_time;
 
   ply_list_t *sources;
   ply_list_t *exit_closures;
-  ply_list_t *timeout_watches;
+
+  /* sources indexed by fd, so they can be found without a search */
+  ply_event_source_t **sources_by_fd;
+  int sources_by_fd_size;
+
+  /* Timeout watches are kept in a binary min-heap ordered by deadline,
+   * then by the order they were added in.  They're also indexed by
+   * handler and user data, so they can be removed without a search.
+   */
+  ply_event_loop_timeout_watch_t **timeout_heap;
+  unsigned long number_of_timeout_watches;
+  unsigned long timeout_heap_size;
+  unsigned long next_timeout_sequence_number;
+  ply_hashtable_t *timeout_watches;
 
   ply_signal_dispatcher_t *signal_dispatcher;
 
+  /* Ready events are handled in batches.  Sources freed while a batch
+   * is being handled may still have events later in it, so freeing
+   * them waits until the batch is done.
+   */
+  struct epoll_event *events;
+  int batch_size;
+  ply_list_t *freed_sources;
+
+  ply_event_loop_statistics_t statistics;
+
   uint32_t should_exit : 1;
+  uint32_t is_dispatching : 1;
 };
 
 static void ply_event_loop_remove_source (ply_event_loop_t    *loop,
                                           ply_event_source_t *source);
-static ply_list_node_t *ply_event_loop_find_source_node (ply_event_loop_t *loop,
-                                                         int               fd);
+static void ply_event_loop_free_source (ply_event_loop_t   *loop,
+                                        ply_event_source_t *source);
+static ply_event_source_t *ply_event_loop_find_source (ply_event_loop_t *loop,
+                                                       int               fd);
 
 static ply_list_node_t *
 ply_signal_dispatcher_find_source_node (ply_signal_dispatcher_t *dispatcher,
@@ -407,12 +462,13 @@ ply_event_loop_add_destination_for_source (ply_event_loop_t        *loop,
   destination_node = ply_list_append_data (source->destinations, destination);
   assert (destination_node != NULL);
   assert (destination->source == source);
+  destination->node = destination_node;
 
   ply_event_loop_update_source_event_mask (loop, source);
 
   watch = ply_fd_watch_new (destination);
 
-  ply_list_append_data (source->fd_watches, watch);
+  watch->node = ply_list_append_data (source->fd_watches, watch);
 
   return watch;
 }
@@ -448,11 +504,267 @@ ply_event_loop_remove_destination_by_fd_watch (ply_event_loop_t *loop,
   source = destination->source;
   assert (source != NULL);
 
-  ply_list_remove_data (source->destinations, destination);
-  assert (ply_list_find_node (source->destinations, destination) == NULL);
+  assert (destination->node != NULL);
+  ply_list_remove_node (source->destinations, destination->node);
+  destination->node = NULL;
   ply_event_loop_update_source_event_mask (loop, source);
 }
 
+static unsigned int
+ply_event_loop_timeout_watch_hash (void *element)
+{
+  ply_event_loop_timeout_watch_t *watch = element;
+
+  return ply_hashtable_direct_hash ((void *) ((uintptr_t) watch->handler
+                                              ^ (uintptr_t) watch->user_data));
+}
+
+static int
+ply_event_loop_timeout_watch_compare (void *elementa,
+                                      void *elementb)
+{
+  ply_event_loop_timeout_watch_t *watch_a = elementa;
+  ply_event_loop_timeout_watch_t *watch_b = elementb;
+
+  if (watch_a->handler != watch_b->handler)
+    return 1;
+
+  return watch_a->user_data != watch_b->user_data;
+}
+
+static bool
+ply_event_loop_timeout_watch_comes_before (ply_event_loop_timeout_watch_t *watch_a,
+                                           ply_event_loop_timeout_watch_t *watch_b)
+{
+  if (watch_a->timeout != watch_b->timeout)
+    return watch_a->timeout < watch_b->timeout;
+
+  return watch_a->sequence_number < watch_b->sequence_number;
+}
+
+static void
+ply_event_loop_place_timeout_watch (ply_event_loop_t               *loop,
+                                    ply_event_loop_timeout_watch_t *watch,
+                                    unsigned long                   heap_index)
+{
+  loop->timeout_heap[heap_index] = watch;
+  watch->heap_index = heap_index;
+}
+
+static void
+ply_event_loop_sift_timeout_watch_up (ply_event_loop_t *loop,
+                                      unsigned long     heap_index)
+{
+  ply_event_loop_timeout_watch_t *watch;
+
+  watch = loop->timeout_heap[heap_index];
+  while (heap_index > 0)
+    {
+      unsigned long parent_index;
+
+      parent_index = (heap_index - 1) / 2;
+      if (!ply_event_loop_timeout_watch_comes_before (watch,
+                                                      loop->timeout_heap[parent_index]))
+        break;
+
+      ply_event_loop_place_timeout_watch (loop, loop->timeout_heap[parent_index],
+                                          heap_index);
+      heap_index = parent_index;
+    }
+  ply_event_loop_place_timeout_watch (loop, watch, heap_index);
+}
+
+static void
+ply_event_loop_sift_timeout_watch_down (ply_event_loop_t *loop,
+                                        unsigned long     heap_index)
+{
+  ply_event_loop_timeout_watch_t *watch;
+
+  watch = loop->timeout_heap[heap_index];
+  while (true)
+    {
+      unsigned long child_index;
+
+      child_index = 2 * heap_index + 1;
+      if (child_index >= loop->number_of_timeout_watches)
+        break;
+
+      if (child_index + 1 < loop->number_of_timeout_watches &&
+          ply_event_loop_timeout_watch_comes_before (loop->timeout_heap[child_index + 1],
+                                                     loop->timeout_heap[child_index]))
+        child_index++;
+
+      if (!ply_event_loop_timeout_watch_comes_before (loop->timeout_heap[child_index],
+                                                      watch))
+        break;
+
+      ply_event_loop_place_timeout_watch (loop, loop->timeout_heap[child_index],
+                                          heap_index);
+      heap_index = child_index;
+    }
+  ply_event_loop_place_timeout_watch (loop, watch, heap_index);
+}
+
+static void
+ply_event_loop_update_wakeup_time (ply_event_loop_t *loop)
+{
+  if (loop->number_of_timeout_watches == 0)
+    loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+  else
+    loop->wakeup_time = loop->timeout_heap[0]->timeout;
+}
+
+static void
+ply_event_loop_arm_timer (ply_event_loop_t *loop)
+{
+  struct itimerspec timer_value = { { 0L, 0L }, { 0L, 0L } };
+
+  if (loop->timer_fd < 0)
+    return;
+
+  if (loop->wakeup_time == loop->armed_wakeup_time)
+    return;
+
+  /* an all zero value disarms the timer */
+  if (loop->wakeup_time != PLY_EVENT_LOOP_NO_TIMED_WAKEUP)
+    {
+      timer_value.it_value.tv_sec = loop->wakeup_time / PLY_NANOSECONDS_PER_SECOND;
+      timer_value.it_value.tv_nsec = loop->wakeup_time % PLY_NANOSECONDS_PER_SECOND;
+    }
+
+  if (timerfd_settime (loop->timer_fd, TFD_TIMER_ABSTIME, &timer_value, NULL) < 0)
+    {
+      ply_trace ("could not arm timer: %m");
+      return;
+    }
+
+  loop->armed_wakeup_time = loop->wakeup_time;
+}
+
+static int
+ply_event_loop_get_poll_timeout (ply_event_loop_t *loop)
+{
+  uint64_t now;
+
+  if (loop->wakeup_time == PLY_EVENT_LOOP_NO_TIMED_WAKEUP)
+    return -1;
+
+  if (loop->timer_fd >= 0)
+    return -1;
+
+  /* Without a timer fd, round up so the wakeup never comes early */
+  now = ply_get_monotonic_nanoseconds ();
+
+  if (loop->wakeup_time <= now)
+    return 0;
+
+  return (int) MIN ((loop->wakeup_time - now + 999999) / 1000000, INT_MAX);
+}
+
+static void
+ply_event_loop_clear_timer (ply_event_loop_t *loop)
+{
+  uint64_t number_of_expirations;
+
+  if (read (loop->timer_fd, &number_of_expirations,
+            sizeof (number_of_expirations)) < 0 && errno != EAGAIN)
+    ply_trace ("could not read timer: %m");
+
+  /* the timer is one-shot, so it's disarmed now */
+  loop->armed_wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+}
+
+static void
+ply_event_loop_add_timeout_watch (ply_event_loop_t               *loop,
+                                  ply_event_loop_timeout_watch_t *watch)
+{
+  ply_event_loop_timeout_watch_t *first_watch;
+
+  if (loop->number_of_timeout_watches == loop->timeout_heap_size)
+    {
+      loop->timeout_heap_size = MAX (2 * loop->timeout_heap_size, 16);
+      loop->timeout_heap = realloc (loop->timeout_heap,
+                                    loop->timeout_heap_size *
+                                    sizeof (ply_event_loop_timeout_watch_t *));
+    }
+
+  watch->sequence_number = loop->next_timeout_sequence_number++;
+  ply_event_loop_place_timeout_watch (loop, watch,
+                                      loop->number_of_timeout_watches++);
+  ply_event_loop_sift_timeout_watch_up (loop, watch->heap_index);
+
+  first_watch = ply_hashtable_lookup (loop->timeout_watches, watch);
+  if (first_watch != NULL)
+    {
+      watch->next_watch = first_watch->next_watch;
+      first_watch->next_watch = watch;
+    }
+  else
+    {
+      watch->next_watch = NULL;
+      ply_hashtable_insert (loop->timeout_watches, watch, watch);
+    }
+
+  ply_event_loop_update_wakeup_time (loop);
+}
+
+static void
+ply_event_loop_remove_timeout_watch_from_heap (ply_event_loop_t               *loop,
+                                               ply_event_loop_timeout_watch_t *watch)
+{
+  unsigned long heap_index;
+  ply_event_loop_timeout_watch_t *last_watch;
+
+  heap_index = watch->heap_index;
+  assert (loop->timeout_heap[heap_index] == watch);
+
+  last_watch = loop->timeout_heap[--loop->number_of_timeout_watches];
+  if (last_watch != watch)
+    {
+      ply_event_loop_place_timeout_watch (loop, last_watch, heap_index);
+
+      if (heap_index > 0 &&
+          ply_event_loop_timeout_watch_comes_before (last_watch,
+                                                     loop->timeout_heap[(heap_index - 1) / 2]))
+        ply_event_loop_sift_timeout_watch_up (loop, heap_index);
+      else
+        ply_event_loop_sift_timeout_watch_down (loop, heap_index);
+    }
+
+  ply_event_loop_update_wakeup_time (loop);
+}
+
+static void
+ply_event_loop_remove_timeout_watch (ply_event_loop_t               *loop,
+                                     ply_event_loop_timeout_watch_t *watch)
+{
+  ply_event_loop_timeout_watch_t *first_watch;
+
+  ply_event_loop_remove_timeout_watch_from_heap (loop, watch);
+
+  first_watch = ply_hashtable_lookup (loop->timeout_watches, watch);
+  assert (first_watch != NULL);
+
+  if (first_watch == watch)
+    {
+      ply_hashtable_remove (loop->timeout_watches, watch);
+
+      if (watch->next_watch != NULL)
+        ply_hashtable_insert (loop->timeout_watches,
+                              watch->next_watch, watch->next_watch);
+    }
+  else
+    {
+      ply_event_loop_timeout_watch_t *previous_watch;
+
+      previous_watch = first_watch;
+      while (previous_watch->next_watch != watch)
+        previous_watch = previous_watch->next_watch;
+
+      previous_watch->next_watch = watch->next_watch;
+    }
+}
+
 ply_event_loop_t *
 ply_event_loop_new (void)
 {
@@ -462,15 +774,41 @@ ply_event_loop_new (void)
 
   loop->epoll_fd = epoll_create (PLY_EVENT_LOOP_NUM_EVENT_HANDLERS);
   loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+  loop->armed_wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
 
   assert (loop->epoll_fd >= 0);
 
+  loop->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+  if (loop->timer_fd >= 0)
+    {
+      struct epoll_event event = { 0 };
+
+      /* sources are never NULL, so that marks the timer */
+      event.events = EPOLLIN;
+      event.data.ptr = NULL;
+
+      if (epoll_ctl (loop->epoll_fd, EPOLL_CTL_ADD, loop->timer_fd, &event) < 0)
+        {
+          close (loop->timer_fd);
+          loop->timer_fd = -1;
+        }
+    }
+
+  if (loop->timer_fd < 0)
+    ply_trace ("could not create timer, falling back to poll timeouts: %m");
+
   loop->should_exit = false;
   loop->exit_code = 0;
 
   loop->sources = ply_list_new ();
   loop->exit_closures = ply_list_new ();
-  loop->timeout_watches = ply_list_new ();
+  loop->freed_sources = ply_list_new ();
+
+  loop->batch_size = PLY_EVENT_LOOP_NUM_EVENT_HANDLERS;
+  loop->events = calloc (loop->batch_size, sizeof (struct epoll_event));
+  loop->timeout_watches = ply_hashtable_new (ply_event_loop_timeout_watch_hash,
+                                             ply_event_loop_timeout_watch_compare);
 
   loop->signal_dispatcher = ply_signal_dispatcher_new ();
 
@@ -549,38 +887,54 @@ ply_event_loop_free (ply_event_loop_t *loop)
     return;
 
   assert (ply_list_get_length (loop->sources) == 0);
-  assert (ply_list_get_length (loop->timeout_watches) == 0);
+  assert (loop->number_of_timeout_watches == 0);
 
   ply_signal_dispatcher_free (loop->signal_dispatcher);
   ply_event_loop_free_exit_closures (loop);
 
   ply_list_free (loop->sources);
-  ply_list_free (loop->timeout_watches);
-
+  ply_list_free (loop->freed_sources);
+  free (loop->sources_by_fd);
+  free (loop->events);
+  ply_hashtable_free (loop->timeout_watches);
+  free (loop->timeout_heap);
+
+  if (loop->timer_fd >= 0)
+    close (loop->timer_fd);
   close (loop->epoll_fd);
   free (loop);
 }
 
-static ply_list_node_t *
-ply_event_loop_find_source_node (ply_event_loop_t *loop,
-                                 int               fd)
+static ply_event_source_t *
+ply_event_loop_find_source (ply_event_loop_t *loop,
+                            int               fd)
 {
-  ply_list_node_t *node;
-
-  node = ply_list_get_first_node (loop->sources);
-  while (node != NULL)
-    {
-      ply_event_source_t *source;
-
-      source = (ply_event_source_t *) ply_list_node_get_data (node);
+  if (fd >= loop->sources_by_fd_size)
+    return NULL;
 
-      if (source->fd == fd)
-        break;
+  return loop->sources_by_fd[fd];
+}
 
-      node = ply_list_get_next_node (loop->sources, node);
+static void
+ply_event_loop_index_source (ply_event_loop_t   *loop,
+                             ply_event_source_t *source)
+{
+  if (source->fd >= loop->sources_by_fd_size)
+    {
+      int old_size;
+
+      old_size = loop->sources_by_fd_size;
+      loop->sources_by_fd_size = MAX (2 * old_size, source->fd + 1);
+      loop->sources_by_fd_size = MAX (loop->sources_by_fd_size, 64);
+      loop->sources_by_fd = realloc (loop->sources_by_fd,
+                                     loop->sources_by_fd_size *
+                                     sizeof (ply_event_source_t *));
+      memset (loop->sources_by_fd + old_size, 0,
+              (loop->sources_by_fd_size - old_size) *
+              sizeof (ply_event_source_t *));
     }
 
-  return node;
+  loop->sources_by_fd[source->fd] = source;
 }
 
 static void
@@ -590,7 +944,7 @@ ply_event_loop_add_source (ply_event_loop_t    *loop,
   struct epoll_event event = { 0 };
   int status;
 
-  assert (ply_event_loop_find_source_node (loop, source->fd) == NULL);
+  assert (ply_event_loop_find_source (loop, source->fd) == NULL);
   assert (source->is_getting_polled == false);
 
   event.events = EPOLLERR | EPOLLHUP;
@@ -601,7 +955,8 @@ ply_event_loop_add_source (ply_event_loop_t    *loop,
 
   source->is_getting_polled = true;
 
-  ply_list_append_data (loop->sources, source);
+  source->node = ply_list_append_data (loop->sources, source);
+  ply_event_loop_index_source (loop, source);
 }
 
 static void
@@ -614,6 +969,7 @@ ply_event_loop_remove_source_node (ply_event_loop_t *loop,
   source = (ply_event_source_t *) ply_list_node_get_data (source_node);
 
   assert (source != NULL);
+  assert (source->node == source_node);
 
   if (source->is_getting_polled)
     {
@@ -621,21 +977,56 @@ ply_event_loop_remove_source_node (ply_event_loop_t *loop,
       source->is_getting_polled = false;
     }
 
+  assert (loop->sources_by_fd[source->fd] == source);
+  loop->sources_by_fd[source->fd] = NULL;
+
   ply_list_remove_node (loop->sources, source_node);
+  source->node = NULL;
 }
 
 static void
 ply_event_loop_remove_source (ply_event_loop_t   *loop,
                               ply_event_source_t *source)
 {
-  ply_list_node_t *source_node;
   assert (ply_list_get_length (source->destinations) == 0);
+  assert (source->node != NULL);
 
-  source_node = ply_list_find_node (loop->sources, source);
+  ply_event_loop_remove_source_node (loop, source->node);
+}
 
-  assert (source_node != NULL);
+static void
+ply_event_loop_free_source (ply_event_loop_t   *loop,
+                            ply_event_source_t *source)
+{
+  if (!loop->is_dispatching)
+    {
+      ply_event_source_free (source);
+      return;
+    }
 
-  ply_event_loop_remove_source_node (loop, source_node);
+  source->is_freed = true;
+  ply_list_append_data (loop->freed_sources, source);
+}
+
+static void
+ply_event_loop_free_freed_sources (ply_event_loop_t *loop)
+{
+  ply_list_node_t *node;
+
+  node = ply_list_get_first_node (loop->freed_sources);
+  while (node != NULL)
+    {
+      ply_list_node_t *next_node;
+      ply_event_source_t *source;
+
+      source = (ply_event_source_t *) ply_list_node_get_data (node);
+      next_node = ply_list_get_next_node (loop->freed_sources, node);
+
+      ply_event_source_free (source);
+      ply_list_remove_node (loop->freed_sources, node);
+
+      node = next_node;
+    }
 }
 
 static void
@@ -670,21 +1061,16 @@ static ply_event_source_t *
 ply_event_loop_get_source_from_fd (ply_event_loop_t *loop,
                                    int               fd)
 {
-  ply_list_node_t *source_node;
   ply_event_source_t *source;
 
-  source_node = ply_event_loop_find_source_node (loop, fd);
+  source = ply_event_loop_find_source (loop, fd);
 
-  if (source_node == NULL)
+  if (source == NULL)
     {
       source = ply_event_source_new (fd);
       ply_event_loop_add_source (loop, source);
-
-      source_node = ply_list_get_last_node (loop->sources);
-      assert (source_node != NULL);
     }
 
-  source = (ply_event_source_t *) ply_list_node_get_data (source_node);
   assert (source->fd == fd);
 
   return source;
@@ -748,7 +1134,7 @@ ply_event_loop_stop_watching_fd (ply_event_loop_t *loop,
   if (source->is_disconnected)
     {
       ply_trace ("source for fd %d is already disconnected", source->fd);
-      ply_list_remove_data (source->fd_watches, watch);
+      ply_list_remove_node (source->fd_watches, watch->node);
       ply_fd_watch_free (watch);
       return;
     }
@@ -756,7 +1142,7 @@ ply_event_loop_stop_watching_fd (ply_event_loop_t *loop,
   ply_trace ("removing destination for fd %d", source->fd);
   ply_event_loop_remove_destination_by_fd_watch (loop, watch);
 
-  ply_list_remove_data (source->fd_watches, watch);
+  ply_list_remove_node (source->fd_watches, watch->node);
   ply_fd_watch_free (watch);
   ply_event_destination_free (destination);
 
@@ -765,7 +1151,7 @@ ply_event_loop_stop_watching_fd (ply_event_loop_t *loop,
       ply_trace ("no more destinations remaing for fd %d, removing source", source->fd);
       ply_event_loop_remove_source (loop, source);
       ply_trace ("freeing source for fd %d", source->fd);
-      ply_event_source_free (source);
+      ply_event_loop_free_source (loop, source);
     }
 }
 
@@ -883,29 +1269,36 @@ ply_event_loop_stop_watching_for_exit (ply_event_loop_t *loop,
     }
 }
 
+static void
+ply_event_loop_watch_for_timeout_at (ply_event_loop_t                 *loop,
+                                     uint64_t                          timeout,
+                                     ply_event_loop_timeout_handler_t  timeout_handler,
+                                     void                             *user_data)
+{
+  ply_event_loop_timeout_watch_t *timeout_watch;
+
+  timeout_watch = calloc (1, sizeof (ply_event_loop_timeout_watch_t));
+  timeout_watch->timeout = timeout;
+  timeout_watch->handler = timeout_handler;
+  timeout_watch->user_data = user_data;
+
+  ply_event_loop_add_timeout_watch (loop, timeout_watch);
+}
+
 void
 ply_event_loop_watch_for_timeout (ply_event_loop_t    *loop,
                                   double               seconds,
                                   ply_event_loop_timeout_handler_t timeout_handler,
                                   void                *user_data)
 {
-  ply_event_loop_timeout_watch_t *timeout_watch;
-
   assert (loop != NULL);
   assert (timeout_handler != NULL);
-  assert (seconds > 0.0);
-
-  timeout_watch = calloc (1, sizeof (ply_event_loop_timeout_watch_t));
-  timeout_watch->timeout = ply_get_timestamp () + seconds;
-  timeout_watch->handler = timeout_handler;
-  timeout_watch->user_data = user_data;
-
-  if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-    loop->wakeup_time = timeout_watch->timeout;
-  else
-    loop->wakeup_time = MIN (loop->wakeup_time, timeout_watch->timeout);
+  assert (seconds >= 0.0);
 
-  ply_list_append_data (loop->timeout_watches, timeout_watch);
+  ply_event_loop_watch_for_timeout_at (loop,
+                                       ply_get_monotonic_nanoseconds () +
+                                       (uint64_t) (seconds * PLY_NANOSECONDS_PER_SECOND),
+                                       timeout_handler, user_data);
 }
 
 void
@@ -913,45 +1306,34 @@ ply_event_loop_stop_watching_for_timeout (ply_event_loop_t *loop,
                                           ply_event_loop_timeout_handler_t timeout_handler,
                                           void             *user_data)
 {
-  ply_list_node_t *node;
-  bool timeout_removed;
+  ply_event_loop_timeout_watch_t key;
+  ply_event_loop_timeout_watch_t *timeout_watch;
 
-  loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
+  key.handler = timeout_handler;
+  key.user_data = user_data;
 
-  timeout_removed = false;
-  node = ply_list_get_first_node (loop->timeout_watches);
-  while (node != NULL)
+  timeout_watch = ply_hashtable_remove (loop->timeout_watches, &key);
+
+  if (timeout_watch == NULL)
     {
-      ply_list_node_t *next_node;
-      ply_event_loop_timeout_watch_t *timeout_watch;
+      ply_trace ("no matching timeout found for removal");
+      return;
+    }
 
-      timeout_watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-      next_node = ply_list_get_next_node (loop->timeout_watches, node);
+  if (timeout_watch->next_watch != NULL)
+    ply_trace ("multiple matching timeouts found for removal");
 
-      if (timeout_watch->handler == timeout_handler &&
-          timeout_watch->user_data == user_data)
-        {
-          ply_list_remove_node (loop->timeout_watches, node);
-          free (timeout_watch);
+  while (timeout_watch != NULL)
+    {
+      ply_event_loop_timeout_watch_t *next_watch;
 
-          if (timeout_removed)
-            ply_trace ("multiple matching timeouts found for removal");
+      next_watch = timeout_watch->next_watch;
 
-          timeout_removed = true;
-        }
-      else
-        {
-          if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-            loop->wakeup_time = timeout_watch->timeout;
-          else
-            loop->wakeup_time = MIN (loop->wakeup_time, timeout_watch->timeout);
-        }
+      ply_event_loop_remove_timeout_watch_from_heap (loop, timeout_watch);
+      free (timeout_watch);
 
-      node = next_node;
+      timeout_watch = next_watch;
     }
-
-  if (!timeout_removed)
-    ply_trace ("no matching timeout found for removal");
 }
 
 static ply_event_loop_fd_status_t
@@ -1090,28 +1472,18 @@ ply_event_loop_free_watches_for_source (ply_event_loop_t   *loop,
 static void
 ply_event_loop_free_timeout_watches (ply_event_loop_t *loop)
 {
-  ply_list_node_t *node;
-  double now;
+  unsigned long i;
 
   assert (loop != NULL);
 
-  now = ply_get_timestamp ();
-  node = ply_list_get_first_node (loop->timeout_watches);
-  while (node != NULL)
-    {
-      ply_list_node_t *next_node;
-      ply_event_loop_timeout_watch_t *watch;
-
-      watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-      next_node = ply_list_get_next_node (loop->timeout_watches, node);
+  for (i = 0; i < loop->number_of_timeout_watches; i++)
+    free (loop->timeout_heap[i]);
+  loop->number_of_timeout_watches = 0;
 
-      free (watch);
-      ply_list_remove_node (loop->timeout_watches, node);
-
-      node = next_node;
-    }
+  ply_hashtable_free (loop->timeout_watches);
+  loop->timeout_watches = ply_hashtable_new (ply_event_loop_timeout_watch_hash,
+                                             ply_event_loop_timeout_watch_compare);
 
-  assert (ply_list_get_length (loop->timeout_watches) == 0);
   loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
 }
 
@@ -1171,82 +1543,162 @@ ply_event_loop_disconnect_source (ply_event_loop_t           *loop,
   ply_trace ("done removing source with fd %d from event loop", source->fd);
 
   ply_trace ("freeing source with fd %d", source->fd);
-  ply_event_source_free (source);
+  ply_event_loop_free_source (loop, source);
+}
+
+static void
+ply_event_loop_record_handler_time (ply_event_loop_t *loop,
+                                    uint64_t          start_time)
+{
+  uint64_t microseconds;
+  int bucket;
+
+  microseconds = (ply_get_monotonic_nanoseconds () - start_time) / 1000;
+
+  bucket = 0;
+  while (microseconds > 0 &&
+         bucket < PLY_EVENT_LOOP_NUMBER_OF_HANDLER_TIME_BUCKETS - 1)
+    {
+      microseconds >>= 1;
+      bucket++;
+    }
+
+  loop->statistics.handler_time_histogram[bucket]++;
 }
 
 static void
 ply_event_loop_handle_timeouts (ply_event_loop_t *loop)
 {
-  ply_list_node_t *node;
-  double now;
+  uint64_t now, handler_start_time;
+  unsigned long next_sequence_number;
 
   assert (loop != NULL);
 
-  now = ply_get_timestamp ();
-  node = ply_list_get_first_node (loop->timeout_watches);
-  loop->wakeup_time = PLY_EVENT_LOOP_NO_TIMED_WAKEUP;
-  while (node != NULL)
+  now = ply_get_monotonic_nanoseconds ();
+  if (loop->number_of_timeout_watches == 0 ||
+      loop->timeout_heap[0]->timeout > now)
+    return;
+
+  /* Handlers may add or remove watches, so look at the top of the heap
+   * afresh each time.  Watches they add wait for the next wakeup, even
+   * with no delay, and come after every watch that is already due.
+   */
+  next_sequence_number = loop->next_timeout_sequence_number;
+  while (loop->number_of_timeout_watches > 0 &&
+         loop->timeout_heap[0]->timeout <= now + PLY_EVENT_LOOP_TIMER_SLACK &&
+         loop->timeout_heap[0]->sequence_number < next_sequence_number)
     {
-      ply_list_node_t *next_node;
       ply_event_loop_timeout_watch_t *watch;
 
-      watch = (ply_event_loop_timeout_watch_t *) ply_list_node_get_data (node);
-      next_node = ply_list_get_next_node (loop->timeout_watches, node);
+      watch = loop->timeout_heap[0];
+      assert (watch->handler != NULL);
+
+      ply_event_loop_remove_timeout_watch (loop, watch);
+
+      handler_start_time = ply_get_monotonic_nanoseconds ();
+      watch->handler (watch->user_data, loop);
+      ply_event_loop_record_handler_time (loop, handler_start_time);
+      loop->statistics.number_of_timeouts++;
+
+      free (watch);
+    }
+}
+
+static void
+ply_event_loop_handle_events (ply_event_loop_t   *loop,
+                              struct epoll_event *events,
+                              int                 number_of_events)
+{
+  int i;
+  bool was_dispatching;
 
-      if (watch->timeout <= now)
+  was_dispatching = loop->is_dispatching;
+  loop->is_dispatching = true;
+  for (i = 0; i < number_of_events; i++)
+    {
+      ply_event_source_t *source;
+      ply_event_loop_fd_status_t status;
+      bool is_disconnected;
+      uint64_t handler_start_time;
+
+      if (events[i].data.ptr == NULL)
         {
-          assert (watch->handler != NULL);
+          ply_event_loop_clear_timer (loop);
+          continue;
+        }
 
-          ply_list_remove_node (loop->timeout_watches, node);
+      source = (ply_event_source_t *) (events[i].data.ptr);
 
-          watch->handler (watch->user_data, loop);
-          free (watch);
+      /* an earlier handler in this batch stopped watching it */
+      if (source->is_freed)
+        continue;
 
-          /* start over in case the handler invalidated the list
-           */
-          next_node = ply_list_get_first_node (loop->timeout_watches);
+      status = ply_event_loop_get_fd_status_from_poll_mask (events[i].events);
+
+      is_disconnected = false;
+      if ((events[i].events & EPOLLHUP) || (events[i].events & EPOLLERR))
+        {
+          int bytes_ready;
+
+          bytes_ready = 0;
+          if (ioctl (source->fd, FIONREAD, &bytes_ready) < 0)
+            bytes_ready = 0;
+
+          if (bytes_ready <= 0)
+            is_disconnected = true;
         }
-      else
+
+      handler_start_time = ply_get_monotonic_nanoseconds ();
+      if (is_disconnected)
         {
-          if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-            loop->wakeup_time = watch->timeout;
-          else
-            loop->wakeup_time = MIN (loop->wakeup_time, watch->timeout);
+          ply_event_loop_disconnect_source (loop, source);
         }
+      else if (ply_event_loop_source_has_met_status (source, status))
+        ply_event_loop_handle_met_status_for_source (loop, source, status);
+      ply_event_loop_record_handler_time (loop, handler_start_time);
 
-      node = next_node;
+      if (loop->should_exit)
+        break;
     }
+  loop->is_dispatching = was_dispatching;
 
+  if (!loop->is_dispatching)
+    ply_event_loop_free_freed_sources (loop);
 }
 
 void
 ply_event_loop_process_pending_events (ply_event_loop_t *loop)
 {
-  int number_of_received_events, i;
-  struct epoll_event *events = NULL;
+  int number_of_received_events;
+  unsigned long number_of_handled_events;
+  struct epoll_event *events;
+  bool was_dispatching;
 
   assert (loop != NULL);
 
-  events =
-        alloca (PLY_EVENT_LOOP_NUM_EVENT_HANDLERS * sizeof (struct epoll_event));
+  /* handlers may run the loop themselves (to flush a client, say), and
+   * mustn't clobber the batch they're called from
+   */
+  if (loop->is_dispatching)
+    events = alloca (loop->batch_size * sizeof (struct epoll_event));
+  else
+    events = loop->events;
 
-  memset (events, -1,
-          PLY_EVENT_LOOP_NUM_EVENT_HANDLERS * sizeof (struct epoll_event));
+  /* Timeout handlers run before the batch is handled and may stop
+   * watching fds in it, so sources stay around until it's done with
+   */
+  was_dispatching = loop->is_dispatching;
+  loop->is_dispatching = true;
 
   do
    {
      int timeout;
 
-     if (fabs (loop->wakeup_time - PLY_EVENT_LOOP_NO_TIMED_WAKEUP) <= 0)
-       timeout = -1;
-     else
-       {
-         timeout = (int) ((loop->wakeup_time - ply_get_timestamp ()) * 1000);
-         timeout = MAX (timeout, 0);
-       }
+     ply_event_loop_arm_timer (loop);
+     timeout = ply_event_loop_get_poll_timeout (loop);
 
      number_of_received_events = epoll_wait (loop->epoll_fd, events,
-                                             sizeof (events), timeout);
+                                             loop->batch_size, timeout);
 
      ply_event_loop_handle_timeouts (loop);
 
@@ -1255,44 +1707,69 @@ ply_event_loop_process_pending_events (ply_event_loop_t *loop)
          if (errno != EINTR && errno != EAGAIN)
            {
              ply_event_loop_exit (loop, 255);
-             return;
+             break;
            }
        }
     }
   while ((number_of_received_events < 0) && ((errno == EINTR) || (errno == EAGAIN)));
 
-  for (i = 0; i < number_of_received_events; i++)
+  loop->statistics.number_of_wakeups++;
+
+  /* A full batch means more events may be ready, so keep going until
+   * they're drained rather than waiting for another wakeup.
+   */
+  number_of_handled_events = 0;
+  while (number_of_received_events > 0)
     {
-      ply_event_source_t *source;
-      ply_event_loop_fd_status_t status;
-      bool is_disconnected;
+      ply_event_loop_handle_events (loop, events, number_of_received_events);
+      number_of_handled_events += number_of_received_events;
 
-      source = (ply_event_source_t *) (events[i].data.ptr);
-      status = ply_event_loop_get_fd_status_from_poll_mask (events[i].events);
+      if (loop->should_exit || number_of_received_events < loop->batch_size)
+        break;
 
-      is_disconnected = false;
-      if ((events[i].events & EPOLLHUP) || (events[i].events & EPOLLERR))
-        {
-          int bytes_ready;
+      number_of_received_events = epoll_wait (loop->epoll_fd, events,
+                                              loop->batch_size, 0);
+    }
 
-          bytes_ready = 0;
-          if (ioctl (source->fd, FIONREAD, &bytes_ready) < 0)
-            bytes_ready = 0;
+  loop->is_dispatching = was_dispatching;
 
-          if (bytes_ready <= 0)
-            is_disconnected = true;
-        }
+  if (!loop->is_dispatching)
+    ply_event_loop_free_freed_sources (loop);
 
-      if (is_disconnected)
-        {
-          ply_event_loop_disconnect_source (loop, source);
-        }
-      else if (ply_event_loop_source_has_met_status (source, status))
-        ply_event_loop_handle_met_status_for_source (loop, source, status);
+  loop->statistics.number_of_events += number_of_handled_events;
+  loop->statistics.max_events_per_wakeup =
+      MAX (loop->statistics.max_events_per_wakeup, number_of_handled_events);
+}
 
-      if (loop->should_exit)
-        break;
-    }
+void
+ply_event_loop_set_batch_size (ply_event_loop_t *loop,
+                               int               batch_size)
+{
+  assert (loop != NULL);
+  assert (batch_size > 0);
+  assert (!loop->is_dispatching);
+
+  loop->batch_size = batch_size;
+  loop->events = realloc (loop->events,
+                          batch_size * sizeof (struct epoll_event));
+}
+
+void
+ply_event_loop_get_statistics (ply_event_loop_t            *loop,
+                               ply_event_loop_statistics_t *statistics)
+{
+  assert (loop != NULL);
+  assert (statistics != NULL);
+
+  *statistics = loop->statistics;
+}
+
+void
+ply_event_loop_reset_statistics (ply_event_loop_t *loop)
+{
+  assert (loop != NULL);
+
+  memset (&loop->statistics, 0, sizeof (loop->statistics));
 }
 
 void
@@ -1404,4 +1881,329 @@ main (int    argc,
   return exit_code;
 }
 #endif /* PLY_EVENT_LOOP_ENABLE_TEST */
+
+#ifdef PLY_EVENT_LOOP_ENABLE_TIMEOUT_TEST
+
+#define NUMBER_OF_TIMEOUTS 20000
+
+typedef struct
+{
+  int id;
+  uint64_t timeout;
+  bool is_cancelled;
+} test_timeout_t;
+
+static test_timeout_t timeouts[NUMBER_OF_TIMEOUTS];
+static int fired_ids[NUMBER_OF_TIMEOUTS];
+static int number_of_fired_timeouts;
+
+static void
+on_test_timeout (test_timeout_t   *timeout,
+                 ply_event_loop_t *loop)
+{
+  fired_ids[number_of_fired_timeouts++] = timeout->id;
+}
+
+static void
+on_exit_timeout (uint64_t         *fire_time,
+                 ply_event_loop_t *loop)
+{
+  *fire_time = ply_get_monotonic_nanoseconds ();
+  ply_event_loop_exit (loop, 0);
+}
+
+static double
+get_elapsed_microseconds (double start_time)
+{
+  return (ply_get_timestamp () - start_time) * 1000000.0;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  ply_event_loop_t *loop;
+  double start_time;
+  uint64_t now;
+  int i, expected_count;
+
+  loop = ply_event_loop_new ();
+  now = ply_get_monotonic_nanoseconds ();
+
+  /* Deadlines are already past and come in runs of equal values, so
+   * everything fires on the first wakeup, and ties show whether the
+   * order they were added in is kept.
+   */
+  start_time = ply_get_timestamp ();
+  for (i = 0; i < NUMBER_OF_TIMEOUTS; i++)
+    {
+      timeouts[i].id = i;
+      timeouts[i].timeout = now - PLY_NANOSECONDS_PER_SECOND +
+                            (rand () % 500) * 1000000ULL;
+      ply_event_loop_watch_for_timeout_at (loop, timeouts[i].timeout,
+                                           (ply_event_loop_timeout_handler_t)
+                                           on_test_timeout, &timeouts[i]);
+    }
+  printf ("scheduled %d timeouts in %.0fus\n", NUMBER_OF_TIMEOUTS,
+          get_elapsed_microseconds (start_time));
+
+  start_time = ply_get_timestamp ();
+  expected_count = NUMBER_OF_TIMEOUTS;
+  for (i = 0; i < NUMBER_OF_TIMEOUTS; i += 3)
+    {
+      timeouts[i].is_cancelled = true;
+      ply_event_loop_stop_watching_for_timeout (loop,
+                                                (ply_event_loop_timeout_handler_t)
+                                                on_test_timeout, &timeouts[i]);
+      expected_count--;
+    }
+  printf ("cancelled %d timeouts in %.0fus\n",
+          NUMBER_OF_TIMEOUTS - expected_count,
+          get_elapsed_microseconds (start_time));
+
+  start_time = ply_get_timestamp ();
+  ply_event_loop_process_pending_events (loop);
+  printf ("fired %d timeouts in %.0fus\n", number_of_fired_timeouts,
+          get_elapsed_microseconds (start_time));
+
+  if (number_of_fired_timeouts != expected_count)
+    {
+      printf ("expected %d timeouts to fire\n", expected_count);
+      return 1;
+    }
+
+  for (i = 0; i < number_of_fired_timeouts; i++)
+    {
+      test_timeout_t *timeout;
+
+      timeout = &timeouts[fired_ids[i]];
+
+      if (timeout->is_cancelled)
+        {
+          printf ("cancelled timeout %d fired\n", timeout->id);
+          return 1;
+        }
+
+      if (i > 0)
+        {
+          test_timeout_t *previous_timeout;
+
+          previous_timeout = &timeouts[fired_ids[i - 1]];
+
+          if (previous_timeout->timeout > timeout->timeout ||
+              (previous_timeout->timeout == timeout->timeout &&
+               previous_timeout->id > timeout->id))
+            {
+              printf ("timeout %d fired before timeout %d\n",
+                      previous_timeout->id, timeout->id);
+              return 1;
+            }
+        }
+    }
+
+  /* a real wait should never wake up early, and a timeout due just
+   * after it should share its wakeup
+   */
+  {
+    ply_event_loop_statistics_t statistics;
+    uint64_t deadline, fire_time;
+
+    number_of_fired_timeouts = 0;
+    deadline = ply_get_monotonic_nanoseconds () + 10000000ULL;
+    ply_event_loop_watch_for_timeout_at (loop, deadline,
+                                         (ply_event_loop_timeout_handler_t)
+                                         on_test_timeout, &timeouts[0]);
+    ply_event_loop_watch_for_timeout_at (loop,
+                                         deadline + PLY_EVENT_LOOP_TIMER_SLACK / 2,
+                                         (ply_event_loop_timeout_handler_t)
+                                         on_exit_timeout, &fire_time);
+    ply_event_loop_reset_statistics (loop);
+    ply_event_loop_run (loop);
+    ply_event_loop_get_statistics (loop, &statistics);
+
+    printf ("10ms timeout fired %.0fus late, after %lu wakeups\n",
+            ((double) fire_time - deadline) / 1000.0,
+            (unsigned long) statistics.number_of_wakeups);
+
+    if (fire_time < deadline || number_of_fired_timeouts != 1)
+      {
+        printf ("timeout fired early\n");
+        return 1;
+      }
+
+    if (statistics.number_of_wakeups != 1)
+      {
+        printf ("timeout due within the slack needed its own wakeup\n");
+        return 1;
+      }
+  }
+
+  ply_event_loop_free (loop);
+
+  return 0;
+}
+#endif /* PLY_EVENT_LOOP_ENABLE_TIMEOUT_TEST */
+
+#ifdef PLY_EVENT_LOOP_ENABLE_SOURCES_TEST
+
+#include <sys/socket.h>
+
+#define NUMBER_OF_ROUNDS 16
+#define NUMBER_OF_CONNECTIONS_PER_ROUND 256
+
+static int number_of_bytes_read;
+static int number_of_disconnections;
+
+static void
+on_data (void *user_data,
+         int   fd)
+{
+  char byte;
+
+  if (read (fd, &byte, 1) == 1)
+    number_of_bytes_read++;
+}
+
+static void
+on_unexpected_data (void *user_data,
+                    int   fd)
+{
+  printf ("data sent to a removed watch\n");
+  exit (1);
+}
+
+static void
+on_disconnected (void *user_data,
+                 int   fd)
+{
+  number_of_disconnections++;
+  close (fd);
+}
+
+static void
+on_stop_watching_timeout (ply_fd_watch_t   *watch,
+                          ply_event_loop_t *loop)
+{
+  ply_event_loop_stop_watching_fd (loop, watch);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  ply_event_loop_t *loop;
+  ply_event_loop_statistics_t statistics;
+  double start_time;
+  int round, i;
+
+  loop = ply_event_loop_new ();
+
+  /* small batches, so each wakeup has to drain several of them */
+  ply_event_loop_set_batch_size (loop, 8);
+
+  /* Connections come and go in rounds, so fds get reused and the fd
+   * index has to stay right as sources are added and removed.
+   */
+  start_time = ply_get_timestamp ();
+  for (round = 0; round < NUMBER_OF_ROUNDS; round++)
+    {
+      int peer_fds[NUMBER_OF_CONNECTIONS_PER_ROUND];
+      int expected_count;
+
+      for (i = 0; i < NUMBER_OF_CONNECTIONS_PER_ROUND; i++)
+        {
+          int fds[2];
+          ply_fd_watch_t *watch;
+
+          if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+            {
+              perror ("socketpair");
+              return 1;
+            }
+
+          watch = ply_event_loop_watch_fd (loop, fds[0],
+                                           PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                           on_unexpected_data, NULL, NULL);
+          ply_event_loop_watch_fd (loop, fds[0],
+                                   PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                   on_data, on_disconnected, NULL);
+          ply_event_loop_stop_watching_fd (loop, watch);
+
+          peer_fds[i] = fds[1];
+        }
+
+      for (i = 0; i < NUMBER_OF_CONNECTIONS_PER_ROUND; i++)
+        {
+          if (i % 2 == 0)
+            write (peer_fds[i], "x", 1);
+          close (peer_fds[i]);
+        }
+
+      expected_count = (round + 1) * NUMBER_OF_CONNECTIONS_PER_ROUND;
+      while (number_of_disconnections < expected_count)
+        ply_event_loop_process_pending_events (loop);
+
+      if (number_of_disconnections != expected_count ||
+          number_of_bytes_read != expected_count / 2)
+        {
+          printf ("round %d: %d disconnections and %d bytes read\n", round,
+                  number_of_disconnections, number_of_bytes_read);
+          return 1;
+        }
+    }
+
+  printf ("connected and disconnected %d sockets in %.0fus\n",
+          NUMBER_OF_ROUNDS * NUMBER_OF_CONNECTIONS_PER_ROUND,
+          (ply_get_timestamp () - start_time) * 1000000.0);
+
+  ply_event_loop_get_statistics (loop, &statistics);
+  printf ("%lu events over %lu wakeups, at most %lu per wakeup\n",
+          statistics.number_of_events, statistics.number_of_wakeups,
+          statistics.max_events_per_wakeup);
+  printf ("handler times:");
+  for (i = 0; i < PLY_EVENT_LOOP_NUMBER_OF_HANDLER_TIME_BUCKETS; i++)
+    printf (" %lu", statistics.handler_time_histogram[i]);
+  printf ("\n");
+
+  if (statistics.max_events_per_wakeup <= 8)
+    {
+      printf ("ready events weren't drained in one wakeup\n");
+      return 1;
+    }
+
+  /* Timeouts run before the fd events from the same wakeup, so a
+   * timeout that stops watching an fd with data waiting must not leave
+   * the batch pointing at a freed source
+   */
+  for (i = 0; i < NUMBER_OF_CONNECTIONS_PER_ROUND; i++)
+    {
+      int fds[2];
+      ply_fd_watch_t *watch;
+
+      if (socketpair (AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+        {
+          perror ("socketpair");
+          return 1;
+        }
+
+      watch = ply_event_loop_watch_fd (loop, fds[0],
+                                       PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                                       on_unexpected_data, NULL, NULL);
+      write (fds[1], "x", 1);
+      ply_event_loop_watch_for_timeout (loop, 0.0,
+                                        (ply_event_loop_timeout_handler_t)
+                                        on_stop_watching_timeout, watch);
+      ply_event_loop_process_pending_events (loop);
+
+      close (fds[0]);
+      close (fds[1]);
+    }
+
+  ply_event_loop_exit (loop, 0);
+  ply_event_loop_run (loop);
+  ply_event_loop_free (loop);
+
+  return 0;
+}
+#endif /* PLY_EVENT_LOOP_ENABLE_SOURCES_TEST */
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -45,6 +45,21 @@ typedef void (* ply_event_loop_exit_handler_t) (void *user_data,
 typedef void (* ply_event_loop_timeout_handler_t) (void             *user_data,
                                                    ply_event_loop_t *loop);
 
+#define PLY_EVENT_LOOP_NUMBER_OF_HANDLER_TIME_BUCKETS 16
+
+/* handler_time_histogram[0] counts handlers that took under 1us,
+ * handler_time_histogram[i] ones that took [2^(i-1), 2^i) us, and the
+ * last bucket everything slower.
+ */
+typedef struct
+{
+  unsigned long number_of_wakeups;
+  unsigned long number_of_events;
+  unsigned long max_events_per_wakeup;
+  unsigned long number_of_timeouts;
+  unsigned long handler_time_histogram[PLY_EVENT_LOOP_NUMBER_OF_HANDLER_TIME_BUCKETS];
+} ply_event_loop_statistics_t;
+
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_event_loop_t *ply_event_loop_new (void);
 void ply_event_loop_free (ply_event_loop_t *loop);
@@ -84,6 +99,12 @@ void ply_event_loop_exit (ply_event_loop_t *loop,
                           int               exit_code);
 void
 ply_event_loop_process_pending_events (ply_event_loop_t *loop);
+
+void ply_event_loop_set_batch_size (ply_event_loop_t *loop,
+                                    int               batch_size);
+void ply_event_loop_get_statistics (ply_event_loop_t            *loop,
+                                    ply_event_loop_statistics_t *statistics);
+void ply_event_loop_reset_statistics (ply_event_loop_t *loop);
 #endif
 
 #endif
@@ -22,7 +22,6 @@
 #include "config.h"
 #include "ply-hashtable.h"
 #include "ply-utils.h"
-#include "ply-bitarray.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -33,20 +32,44 @@
 
 #define MASKGEN(x) {x |= x >> 16; x |= x >> 8; x |= x >> 4; x |= x >> 2;  x |= x >> 1;}
 
+/* Every slot has a control byte.  Live slots hold seven bits of the
+ * hash so most mismatches are rejected without touching the node.
+ */
+#define PLY_HASHTABLE_SLOT_EMPTY     0x80
+#define PLY_HASHTABLE_SLOT_DELETED   0xfe
+#define PLY_HASHTABLE_SLOT_IS_LIVE(c) (((c) & 0x80) == 0)
+
+/* How many slots of the old table each insert moves over while the
+ * table is being resized.
+ */
+#define PLY_HASHTABLE_MIGRATION_STEP 16
+
 struct _ply_hashtable_node
 {
-  void   *data;
-  void   *key;
+  unsigned int  hash;
+  void         *data;
+  void         *key;
 };
 
-struct _ply_hashtable
+struct _ply_hashtable_table
 {
+  uint8_t                      *controls;
   struct _ply_hashtable_node   *nodes;
   unsigned int                  total_node_count;   /* must be a 2^X */
-  ply_bitarray_t               *dirty_node_bitmap;
   unsigned int                  dirty_node_count;   /* live + dead nodes */
-  ply_bitarray_t               *live_node_bitmap;
   unsigned int                  live_node_count;
+};
+
+struct _ply_hashtable
+{
+  struct _ply_hashtable_table   table;
+
+  /* When the table is resized the old one is kept around and drained
+   * a few slots at a time rather than rehashed all at once.
+   */
+  struct _ply_hashtable_table   old_table;
+  unsigned int                  migrated_node_count;
+
   ply_hashtable_compare_func_t *compare_func;
   ply_hashtable_hash_func_t    *hash_func;
 };
@@ -67,12 +90,12 @@ ply_hashtable_direct_compare (void *elementa,
 unsigned int
 ply_hashtable_string_hash (void *element)
 {
-  char* strptr;
-  unsigned int hash = 0;
+  unsigned char* strptr;
+  unsigned int hash = 2166136261U;    /* FNV-1a */
   for (strptr = element; *strptr; strptr++)
     {
       hash ^= *strptr;
-      hash ^= hash << 1;
+      hash *= 16777619U;
     }
   return hash;
 }
@@ -84,6 +107,177 @@ ply_hashtable_string_compare (void *elementa,
   return strcmp (elementa, elementb);
 }
 
+static inline unsigned int
+ply_hashtable_get_hash (ply_hashtable_t *hashtable,
+                        void            *key)
+{
+  unsigned int hash;
+
+  /* The hash functions (especially the direct one on pointers) leave
+   * the low bits poorly distributed, so mix them before masking.
+   */
+  hash = hashtable->hash_func (key) * 0x9e3779b1U;
+  hash ^= hash >> 15;
+
+  return hash;
+}
+
+static inline uint8_t
+ply_hashtable_get_control (unsigned int hash)
+{
+  return (hash >> 25) & 0x7f;
+}
+
+static inline bool
+ply_hashtable_keys_match (ply_hashtable_t *hashtable,
+                          void            *keya,
+                          void            *keyb)
+{
+  if (hashtable->compare_func == ply_hashtable_direct_compare)
+    return keya == keyb;
+
+  return hashtable->compare_func (keya, keyb) == 0;
+}
+
+static void
+ply_hashtable_table_init (struct _ply_hashtable_table *table,
+                          unsigned int                 size)
+{
+  table->total_node_count = size;
+  table->dirty_node_count = 0;
+  table->live_node_count = 0;
+
+  if (size == 0)
+    {
+      table->controls = NULL;
+      table->nodes = NULL;
+      return;
+    }
+
+  table->controls = malloc (size);
+  memset (table->controls, PLY_HASHTABLE_SLOT_EMPTY, size);
+  table->nodes = malloc (size * sizeof (struct _ply_hashtable_node));
+}
+
+static void
+ply_hashtable_table_destroy (struct _ply_hashtable_table *table)
+{
+  free (table->controls);
+  free (table->nodes);
+  ply_hashtable_table_init (table, 0);
+}
+
+static void
+ply_hashtable_table_insert (struct _ply_hashtable_table *table,
+                            unsigned int                 hash,
+                            void                        *key,
+                            void                        *data)
+{
+  unsigned int hash_index;
+  unsigned int mask;
+
+  /* Dead slots are not reused; they go away on the next resize.  With
+   * several entries for one key, lookups don't promise which one they
+   * find: the new table is searched before the old one while a resize
+   * is under way, and entries move over in slot order, not age order.
+   */
+  mask = table->total_node_count - 1;
+  hash_index = hash & mask;
+  while (table->controls[hash_index] != PLY_HASHTABLE_SLOT_EMPTY)
+    hash_index = (hash_index + 1) & mask;
+
+  table->controls[hash_index] = ply_hashtable_get_control (hash);
+  table->nodes[hash_index].hash = hash;
+  table->nodes[hash_index].key = key;
+  table->nodes[hash_index].data = data;
+
+  table->live_node_count++;
+  table->dirty_node_count++;
+}
+
+static int
+ply_hashtable_table_lookup_index (ply_hashtable_t             *hashtable,
+                                  struct _ply_hashtable_table *table,
+                                  unsigned int                 hash,
+                                  void                        *key)
+{
+  unsigned int hash_index;
+  unsigned int mask;
+  uint8_t control;
+
+  if (table->live_node_count == 0)
+    return -1;
+
+  control = ply_hashtable_get_control (hash);
+  mask = table->total_node_count - 1;
+  hash_index = hash & mask;
+  while (table->controls[hash_index] != PLY_HASHTABLE_SLOT_EMPTY)
+    {
+      if (table->controls[hash_index] == control &&
+          table->nodes[hash_index].hash == hash &&
+          ply_hashtable_keys_match (hashtable,
+                                    table->nodes[hash_index].key, key))
+        return hash_index;
+      hash_index = (hash_index + 1) & mask;
+    }
+  return -1;
+}
+
+static void
+ply_hashtable_table_remove_index (struct _ply_hashtable_table *table,
+                                  unsigned int                 hash_index)
+{
+  unsigned int next_index;
+
+  /* If nothing probes past this slot it can go straight back to empty
+   */
+  next_index = (hash_index + 1) & (table->total_node_count - 1);
+  if (table->controls[next_index] == PLY_HASHTABLE_SLOT_EMPTY)
+    {
+      table->controls[hash_index] = PLY_HASHTABLE_SLOT_EMPTY;
+      table->dirty_node_count--;
+    }
+  else
+    table->controls[hash_index] = PLY_HASHTABLE_SLOT_DELETED;
+
+  table->live_node_count--;
+}
+
+static void
+ply_hashtable_migrate (ply_hashtable_t *hashtable,
+                       unsigned int     node_count)
+{
+  struct _ply_hashtable_table *old_table;
+
+  old_table = &hashtable->old_table;
+  if (old_table->total_node_count == 0)
+    return;
+
+  while (node_count > 0 && old_table->live_node_count > 0)
+    {
+      unsigned int i;
+
+      i = hashtable->migrated_node_count++;
+      node_count--;
+
+      if (!PLY_HASHTABLE_SLOT_IS_LIVE (old_table->controls[i]))
+        continue;
+
+      ply_hashtable_table_insert (&hashtable->table,
+                                  old_table->nodes[i].hash,
+                                  old_table->nodes[i].key,
+                                  old_table->nodes[i].data);
+      old_table->controls[i] = PLY_HASHTABLE_SLOT_DELETED;
+      old_table->live_node_count--;
+    }
+
+  if (old_table->live_node_count == 0)
+    {
+      ply_hashtable_table_destroy (old_table);
+      hashtable->migrated_node_count = 0;
+    }
+}
+
 ply_hashtable_t *
 ply_hashtable_new (ply_hashtable_hash_func_t    *hash_func,
                    ply_hashtable_compare_func_t *compare_func)
@@ -91,12 +285,9 @@ ply_hashtable_new (ply_hashtable_hash_func_t    *hash_func,
   ply_hashtable_t *hashtable;
 
   hashtable = malloc (sizeof (ply_hashtable_t));
-  hashtable->total_node_count = 0;
-  hashtable->dirty_node_count = 0;
-  hashtable->live_node_count = 0;
-  hashtable->nodes = NULL;
-  hashtable->dirty_node_bitmap = NULL;
-  hashtable->live_node_bitmap = NULL;
+  ply_hashtable_table_init (&hashtable->table, 0);
+  ply_hashtable_table_init (&hashtable->old_table, 0);
+  hashtable->migrated_node_count = 0;
   hashtable->compare_func = compare_func;
   hashtable->hash_func = hash_func;
 
@@ -116,84 +307,35 @@ void
 ply_hashtable_free (ply_hashtable_t *hashtable)
 {
   if (hashtable == NULL) return;
-  ply_bitarray_free (hashtable->dirty_node_bitmap);
-  ply_bitarray_free (hashtable->live_node_bitmap);
-  free(hashtable->nodes);
+  ply_hashtable_table_destroy (&hashtable->table);
+  ply_hashtable_table_destroy (&hashtable->old_table);
   free(hashtable);
 }
 
-
-static void
-ply_hashtable_insert_internal (ply_hashtable_t *hashtable,
-                               void            *key,
-                               void            *data)
-{
-  unsigned int hash_index;
-  int step = 0;
-  
-#ifdef PLY_HASHTABLE_ENABLE_TEST
-    /* Make sure the counts are synchronised with bitmap */
-  assert (ply_bitarray_count (hashtable->dirty_node_bitmap, hashtable->total_node_count) ==
-          (int) hashtable->dirty_node_count);
-  assert (ply_bitarray_count (hashtable->live_node_bitmap, hashtable->total_node_count) ==
-          (int) hashtable->live_node_count);
-#endif /* PLY_HASHTABLE_ENABLE_TEST */
-
-  hash_index = hashtable->hash_func (key);
-  hash_index &= hashtable->total_node_count - 1;
-
-  while (ply_bitarray_lookup (hashtable->dirty_node_bitmap, hash_index))
-    {
-      step++;
-      hash_index += step;
-      hash_index &= hashtable->total_node_count - 1;
-    }
-  ply_bitarray_set (hashtable->dirty_node_bitmap, hash_index);
-  ply_bitarray_set (hashtable->live_node_bitmap, hash_index);
-  hashtable->nodes[hash_index].key = key;
-  hashtable->nodes[hash_index].data = data;
-
-  hashtable->live_node_count++;
-  hashtable->dirty_node_count++;
-}
-
-
 void
 ply_hashtable_resize (ply_hashtable_t *hashtable)
 {
-  unsigned int newsize, oldsize;
-  unsigned int i;
-  struct _ply_hashtable_node *oldnodes;
-  ply_bitarray_t *old_live_node_bitmap;
+  unsigned int newsize;
 
-  newsize = (hashtable->live_node_count + 1) * 4; /* make table 4x to 8x the number of live elements (at least 8) */
+  /* Only one table can be draining at a time */
+  ply_hashtable_migrate (hashtable, hashtable->old_table.total_node_count);
+
+  newsize = (hashtable->table.live_node_count + 1) * 4; /* make table 4x to 8x the number of live elements (at least 8) */
   MASKGEN (newsize);
   newsize++;
-  oldsize = hashtable->total_node_count;
-  oldnodes = hashtable->nodes;
-
-  hashtable->total_node_count = newsize;
-  hashtable->nodes = malloc (newsize * sizeof (struct _ply_hashtable_node));
-  ply_bitarray_free (hashtable->dirty_node_bitmap);
-  hashtable->dirty_node_bitmap = ply_bitarray_new(newsize);
-  old_live_node_bitmap = hashtable->live_node_bitmap;
-  hashtable->live_node_bitmap = ply_bitarray_new(newsize);
-  hashtable->dirty_node_count = 0;
-  hashtable->live_node_count = 0;
-
-  for (i=0; i<oldsize; i++)
-    {
-      if (ply_bitarray_lookup (old_live_node_bitmap, i))
-        ply_hashtable_insert_internal (hashtable, oldnodes[i].key, oldnodes[i].data);
-    } 
-  ply_bitarray_free (old_live_node_bitmap);
-  free (oldnodes);
+
+  hashtable->old_table = hashtable->table;
+  hashtable->migrated_node_count = 0;
+  ply_hashtable_table_init (&hashtable->table, newsize);
+
+  if (hashtable->old_table.live_node_count == 0)
+    ply_hashtable_table_destroy (&hashtable->old_table);
 }
 
 static inline void
 ply_hashtable_resize_check (ply_hashtable_t *hashtable)
 {
-  if (hashtable->total_node_count < (hashtable->dirty_node_count * 2))
+  if (hashtable->table.total_node_count < ((hashtable->table.dirty_node_count + 1) * 2))
     ply_hashtable_resize (hashtable);   /* hash tables work best below 50% occupancy */
 }
 
@@ -202,55 +344,66 @@ ply_hashtable_insert (ply_hashtable_t *hashtable,
                       void            *key,
                       void            *data)
 {
+  unsigned int hash;
+
+  hash = ply_hashtable_get_hash (hashtable, key);
+
+  ply_hashtable_resize_check (hashtable);
+  ply_hashtable_migrate (hashtable, PLY_HASHTABLE_MIGRATION_STEP);
   ply_hashtable_resize_check (hashtable);
-  ply_hashtable_insert_internal (hashtable, key, data);
+
+  ply_hashtable_table_insert (&hashtable->table, hash, key, data);
 }
 
-static int
-ply_hashtable_lookup_index (ply_hashtable_t *hashtable,
-                            void            *key)
+static struct _ply_hashtable_node *
+ply_hashtable_lookup_node (ply_hashtable_t              *hashtable,
+                           void                         *key,
+                           struct _ply_hashtable_table **table)
 {
-  unsigned int hash_index;
-  int step = 0;
+  unsigned int hash;
+  int index;
+
+  hash = ply_hashtable_get_hash (hashtable, key);
 
-  hash_index = hashtable->hash_func (key);
-  while (1)
+  *table = &hashtable->table;
+  index = ply_hashtable_table_lookup_index (hashtable, *table, hash, key);
+  if (index < 0)
     {
-      hash_index &= hashtable->total_node_count - 1;
-      if (!ply_bitarray_lookup (hashtable->dirty_node_bitmap, hash_index))
-        break;
-      if (ply_bitarray_lookup (hashtable->live_node_bitmap, hash_index))
-        if (!hashtable->compare_func (hashtable->nodes[hash_index].key, key))
-          return hash_index;
-      hash_index += step;
-      step++;
+      *table = &hashtable->old_table;
+      index = ply_hashtable_table_lookup_index (hashtable, *table, hash, key);
+      if (index < 0)
+        return NULL;
     }
-  return -1;
+
+  return &(*table)->nodes[index];
 }
 
 void *
 ply_hashtable_remove (ply_hashtable_t *hashtable,
                       void            *key)
 {
-  int index;
-  index = ply_hashtable_lookup_index (hashtable, key);
-  if (index < 0)
+  struct _ply_hashtable_table *table;
+  struct _ply_hashtable_node *node;
+
+  node = ply_hashtable_lookup_node (hashtable, key, &table);
+  if (node == NULL)
     return NULL;
-    
-  ply_bitarray_clear (hashtable->live_node_bitmap, index);
-  hashtable->live_node_count--;
-  return hashtable->nodes[index].data;
+
+  ply_hashtable_table_remove_index (table, node - table->nodes);
+  return node->data;
 }
 
 void *
 ply_hashtable_lookup (ply_hashtable_t *hashtable,
                       void            *key)
 {
-  int index;
-  index = ply_hashtable_lookup_index (hashtable, key);
-  if (index < 0)
+  struct _ply_hashtable_table *table;
+  struct _ply_hashtable_node *node;
+
+  node = ply_hashtable_lookup_node (hashtable, key, &table);
+  if (node == NULL)
     return NULL;
-  return hashtable->nodes[index].data;
+  return node->data;
 }
 
 int
@@ -259,31 +412,45 @@ ply_hashtable_lookup_full (ply_hashtable_t *hashtable,
                            void           **reply_key,
                            void           **reply_data)
 {
-  int index;
-  index = ply_hashtable_lookup_index (hashtable, key);
-  if (index < 0)
+  struct _ply_hashtable_table *table;
+  struct _ply_hashtable_node *node;
+
+  node = ply_hashtable_lookup_node (hashtable, key, &table);
+  if (node == NULL)
     return false;
-  *reply_key = hashtable->nodes[index].key;
-  *reply_data = hashtable->nodes[index].data;
+  *reply_key = node->key;
+  *reply_data = node->data;
   return true;
 }
 
+static void
+ply_hashtable_table_foreach (struct _ply_hashtable_table  *table,
+                             ply_hashtable_foreach_func_t  func,
+                             void                         *user_data)
+{
+  unsigned int i;
+  for (i = 0; i < table->total_node_count; i++)
+    {
+      if (PLY_HASHTABLE_SLOT_IS_LIVE (table->controls[i]))
+        func(table->nodes[i].key, table->nodes[i].data, user_data);
+    }
+}
+
 void
 ply_hashtable_foreach (ply_hashtable_t              *hashtable,
 					   ply_hashtable_foreach_func_t  func,
 					   void                         *user_data)
 {
-  unsigned int i;
-  for (i = 0; i < hashtable->total_node_count; i++)
-    {
-      if (ply_bitarray_lookup (hashtable->live_node_bitmap, i))
-        func(hashtable->nodes[i].key, hashtable->nodes[i].data, user_data);
-    }
+  ply_hashtable_table_foreach (&hashtable->old_table, func, user_data);
+  ply_hashtable_table_foreach (&hashtable->table, func, user_data);
 }
 
 
 #ifdef PLY_HASHTABLE_ENABLE_TEST
 #include <stdio.h>
+#include <time.h>
+
+#define TEST_KEY_COUNT 100000
 
 static void
 foreach_func (void *key,
@@ -293,6 +460,107 @@ foreach_func (void *key,
   printf ("foreach key:%s data:%s\n", (char*) key, (char*) data);
 }
 
+static void
+count_func (void *key,
+            void *data,
+            void *user_data)
+{
+  (*(int *) user_data)++;
+}
+
+static double
+get_time (void)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1000000000.0;
+}
+
+/* Inserts and removes lots of keys, checking lookups across the
+ * resizes, and reports how long inserts and lookups take.
+ */
+static int
+test_many_keys (void)
+{
+  ply_hashtable_t *hashtable;
+  char **keys;
+  double start, insert_time, lookup_time, slowest_insert;
+  int i, count, errors;
+
+  errors = 0;
+  keys = malloc (TEST_KEY_COUNT * sizeof (char *));
+  for (i = 0; i < TEST_KEY_COUNT; i++)
+    {
+      keys[i] = malloc (16);
+      snprintf (keys[i], 16, "key%d", i);
+    }
+
+  hashtable = ply_hashtable_new (ply_hashtable_string_hash, ply_hashtable_string_compare);
+
+  slowest_insert = 0.0;
+  start = get_time ();
+  for (i = 0; i < TEST_KEY_COUNT; i++)
+    {
+      double insert_start, this_insert;
+
+      insert_start = get_time ();
+      ply_hashtable_insert (hashtable, keys[i], keys[i]);
+      this_insert = get_time () - insert_start;
+      if (this_insert > slowest_insert)
+        slowest_insert = this_insert;
+    }
+  insert_time = get_time () - start;
+
+  start = get_time ();
+  for (i = 0; i < TEST_KEY_COUNT; i++)
+    {
+      if (ply_hashtable_lookup (hashtable, keys[i]) != keys[i])
+        errors = 1;
+    }
+  lookup_time = get_time () - start;
+
+  if (ply_hashtable_lookup (hashtable, "not-a-key") != NULL)
+    errors = 1;
+
+  for (i = 0; i < TEST_KEY_COUNT; i += 2)
+    {
+      if (ply_hashtable_remove (hashtable, keys[i]) != keys[i])
+        errors = 1;
+    }
+  for (i = 0; i < TEST_KEY_COUNT; i++)
+    {
+      if (ply_hashtable_lookup (hashtable, keys[i]) != (i % 2? keys[i] : NULL))
+        errors = 1;
+    }
+  for (i = 0; i < TEST_KEY_COUNT; i += 2)
+    ply_hashtable_insert (hashtable, keys[i], keys[i]);
+
+  count = 0;
+  ply_hashtable_foreach (hashtable, count_func, &count);
+  if (count != TEST_KEY_COUNT)
+    errors = 1;
+  for (i = 0; i < TEST_KEY_COUNT; i++)
+    {
+      if (ply_hashtable_lookup (hashtable, keys[i]) != keys[i])
+        errors = 1;
+    }
+
+  ply_hashtable_free (hashtable);
+  for (i = 0; i < TEST_KEY_COUNT; i++)
+    free (keys[i]);
+  free (keys);
+
+  printf ("%d keys: insert %.0fns, lookup %.0fns, slowest insert %.0fus\n",
+          TEST_KEY_COUNT,
+          insert_time * 1000000000.0 / TEST_KEY_COUNT,
+          lookup_time * 1000000000.0 / TEST_KEY_COUNT,
+          slowest_insert * 1000000.0);
+  if (errors)
+    printf ("many keys test failed\n");
+
+  return errors;
+}
 
 int
 main (int    argc,
@@ -328,6 +596,8 @@ main (int    argc,
     }
   ply_hashtable_foreach (hashtable, foreach_func, NULL);
   ply_hashtable_free(hashtable);
+  if (test_many_keys ())
+    return 1;
   printf ("hashtable test end\n");
   return 0;
 }
@@ -29,12 +29,20 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "ply-arena.h"
+
 struct _ply_list
 {
   ply_list_node_t *first_node;
   ply_list_node_t *last_node;
 
   int number_of_nodes;
+
+  /* Lists made with an arena live in it, nodes included, until it's
+   * reset.  Removed nodes are kept for reuse instead of being freed.
+   */
+  ply_arena_t *arena;
+  ply_list_node_t *free_nodes;
 };
 
 struct _ply_list_node
@@ -58,32 +66,69 @@ ply_list_new (void)
   return list;
 }
 
+ply_list_t *
+ply_list_new_with_arena (ply_arena_t *arena)
+{
+  ply_list_t *list;
+
+  assert (arena != NULL);
+
+  list = ply_arena_allocate (arena, sizeof (ply_list_t));
+  list->arena = arena;
+
+  return list;
+}
+
 void
 ply_list_free (ply_list_t *list)
 {
+  if (list == NULL)
+    return;
+
   ply_list_remove_all_nodes (list);
-  free (list);
+
+  if (list->arena == NULL)
+    free (list);
 }
 
 static ply_list_node_t *
-ply_list_node_new (void *data)
+ply_list_node_new (ply_list_t *list,
+                   void       *data)
 {
   ply_list_node_t *node;
 
-  node = calloc (1, sizeof (ply_list_node_t));
+  if (list->free_nodes != NULL)
+    {
+      node = list->free_nodes;
+      list->free_nodes = node->next;
+      node->next = NULL;
+    }
+  else if (list->arena != NULL)
+    node = ply_arena_allocate (list->arena, sizeof (ply_list_node_t));
+  else
+    node = calloc (1, sizeof (ply_list_node_t));
+
   node->data = data;
 
   return node;
 }
 
 static void
-ply_list_node_free (ply_list_node_t *node)
+ply_list_node_free (ply_list_t      *list,
+                    ply_list_node_t *node)
 {
   if (node == NULL)
     return;
 
   assert ((node->previous == NULL) && (node->next == NULL));
 
+  if (list->arena != NULL)
+    {
+      node->next = list->free_nodes;
+      list->free_nodes = node;
+      return;
+    }
+
   free (node);
 }
 
@@ -157,7 +202,7 @@ ply_list_insert_data (ply_list_t      *list,
 {
   ply_list_node_t *node;
 
-  node = ply_list_node_new (data);
+  node = ply_list_node_new (list, data);
 
   ply_list_insert_node (list, node_before, node);
 
@@ -223,7 +268,13 @@ ply_list_unlink_node (ply_list_t      *list,
   node->next = NULL;
 
   list->number_of_nodes--;
+
+  /* This walks the whole list, which would make every removal O(n),
+   * so only the list's own test checks it
+   */
+#ifdef PLY_LIST_ENABLE_TEST
   assert (ply_list_find_node (list, node->data) != node);
+#endif
 }
 
 void
@@ -231,7 +282,7 @@ ply_list_remove_node (ply_list_t      *list,
                       ply_list_node_t *node)
 {
   ply_list_unlink_node (list, node);
-  ply_list_node_free (node);
+  ply_list_node_free (list, node);
 }
 
 void
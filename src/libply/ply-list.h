@@ -22,12 +22,15 @@
 #ifndef PLY_LIST_H
 #define PLY_LIST_H
 
+#include "ply-arena.h"
+
 typedef struct _ply_list_node ply_list_node_t;
 typedef struct _ply_list ply_list_t;
 typedef int (ply_list_compare_func_t) (void *elementa, void *elementb);
 
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_list_t *ply_list_new (void);
+ply_list_t *ply_list_new_with_arena (ply_arena_t *arena);
 void ply_list_free (ply_list_t *list);
 int ply_list_get_length (ply_list_t *list);
 ply_list_node_t *ply_list_find_node (ply_list_t *list,
@@ -33,6 +33,7 @@
 #include <unistd.h>
 
 
+#include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-progress.h"
@@ -46,6 +47,12 @@
 #define DEFAULT_BOOT_DURATION 60.0
 #endif
 
+typedef struct 
+{
+  double time;
+  char* string;
+  uint32_t disabled : 1;
+} ply_progress_message_t;
 
 struct _ply_progress
 {
@@ -58,16 +65,13 @@ struct _ply_progress
   double next_message_percentage;
   ply_list_t *current_message_list;
   ply_list_t *previous_message_list;
+  ply_hashtable_t *current_messages;
+  ply_hashtable_t *previous_messages;
+  ply_progress_message_t **previous_messages_by_time;
+  int number_of_previous_messages;
   uint32_t paused : 1;
 };
 
-typedef struct 
-{
-  double time;
-  char* string;
-  uint32_t disabled : 1;
-} ply_progress_message_t;
-
 ply_progress_t*
 ply_progress_new (void)
 {
@@ -83,6 +87,10 @@ ply_progress_new (void)
   progress->next_message_percentage=0.25;
   progress->current_message_list = ply_list_new ();
   progress->previous_message_list = ply_list_new ();
+  progress->current_messages = ply_hashtable_new (ply_hashtable_string_hash,
+                                                  ply_hashtable_string_compare);
+  progress->previous_messages = ply_hashtable_new (ply_hashtable_string_hash,
+                                                   ply_hashtable_string_compare);
   progress->paused = false;
   return progress;
 }
@@ -100,9 +108,11 @@ ply_progress_free (ply_progress_t* progress)
       next_node = ply_list_get_next_node (progress->current_message_list, node);
 
       free (message->string);
+      free (message);
       node = next_node;
     }
   ply_list_free (progress->current_message_list);
+  ply_hashtable_free (progress->current_messages);
 
   node = ply_list_get_first_node (progress->previous_message_list);
 
@@ -113,45 +123,77 @@ ply_progress_free (ply_progress_t* progress)
       next_node = ply_list_get_next_node (progress->previous_message_list, node);
 
       free (message->string);
+      free (message);
       node = next_node;
     }
   ply_list_free (progress->previous_message_list);
+  ply_hashtable_free (progress->previous_messages);
+  free (progress->previous_messages_by_time);
   free(progress);
   return;
 }
 
 
+/* Finds the earliest message from the last boot that came after time,
+ * by bisecting the messages sorted by time
+ */
 static ply_progress_message_t*
-ply_progress_message_search (ply_list_t *message_list, const char* string)
+ply_progress_message_search_next (ply_progress_t *progress, double time)
 {
-  ply_list_node_t *node;
-  node = ply_list_get_first_node (message_list);
+  int low, high;
 
-  while (node)
+  low = 0;
+  high = progress->number_of_previous_messages;
+  while (low < high)
     {
-      ply_progress_message_t *message = ply_list_node_get_data (node);
-      if (strcmp(string, message->string)==0)
-          return message;
-      node = ply_list_get_next_node (message_list, node);
+      int middle = low + (high - low) / 2;
+
+      if (progress->previous_messages_by_time[middle]->time > time)
+        high = middle;
+      else
+        low = middle + 1;
     }
-  return NULL;
+
+  if (low == progress->number_of_previous_messages)
+    return NULL;
+
+  return progress->previous_messages_by_time[low];
 }
 
+static int
+ply_progress_message_compare_times (const void *a, const void *b)
+{
+  const ply_progress_message_t *message_a = *(ply_progress_message_t * const *) a;
+  const ply_progress_message_t *message_b = *(ply_progress_message_t * const *) b;
 
-static ply_progress_message_t*
-ply_progress_message_search_next (ply_list_t *message_list, double time)
+  if (message_a->time < message_b->time)
+    return -1;
+  if (message_a->time > message_b->time)
+    return 1;
+  return 0;
+}
+
+static void
+ply_progress_sort_previous_messages (ply_progress_t *progress)
 {
   ply_list_node_t *node;
-  node = ply_list_get_first_node (message_list);
-  ply_progress_message_t *best=NULL;
-  while (node)
-    {
-      ply_progress_message_t *message = ply_list_node_get_data (node);
-      if (message->time > time && (!best || message->time < best->time))
-          best = message;
-      node = ply_list_get_next_node (message_list, node);
-    }
-  return best;
+  int i;
+
+  progress->number_of_previous_messages = ply_list_get_length (progress->previous_message_list);
+  progress->previous_messages_by_time = realloc (progress->previous_messages_by_time,
+                                                 progress->number_of_previous_messages *
+                                                 sizeof (ply_progress_message_t *));
+
+  i = 0;
+  for (node = ply_list_get_first_node (progress->previous_message_list);
+       node != NULL;
+       node = ply_list_get_next_node (progress->previous_message_list, node))
+    progress->previous_messages_by_time[i++] = ply_list_node_get_data (node);
+
+  qsort (progress->previous_messages_by_time,
+         progress->number_of_previous_messages,
+         sizeof (ply_progress_message_t *),
+         ply_progress_message_compare_times);
 }
 
 void
@@ -197,9 +239,16 @@ ply_progress_load_cache (ply_progress_t* progress,
       ply_progress_message_t* message = malloc(sizeof(ply_progress_message_t));
       message->time = time;
       message->string = string;
+      message->disabled = false;
       ply_list_append_data(progress->previous_message_list, message);
+
+      /* the first of any duplicates is the one that counts */
+      if (ply_hashtable_lookup (progress->previous_messages, string) == NULL)
+        ply_hashtable_insert (progress->previous_messages, string, message);
     }
   fclose (fp);
+
+  ply_progress_sort_previous_messages (progress);
 }
 
 void
@@ -297,17 +346,17 @@ ply_progress_status_update (ply_progress_t* progress,
                              const char  *status)
 {
   ply_progress_message_t *message, *message_next;
-  message = ply_progress_message_search(progress->current_message_list, status);
+  message = ply_hashtable_lookup (progress->current_messages, (void *) status);
   if (message)
     {
       message->disabled = true;
     }                                                   /* Remove duplicates as they confuse things*/
   else
     {
-      message = ply_progress_message_search(progress->previous_message_list, status);
+      message = ply_hashtable_lookup (progress->previous_messages, (void *) status);
       if (message)
         {
-          message_next = ply_progress_message_search_next(progress->previous_message_list, message->time);
+          message_next = ply_progress_message_search_next (progress, message->time);
           if (message_next)
               progress->next_message_percentage = message_next->time;
           else
@@ -321,6 +370,7 @@ ply_progress_status_update (ply_progress_t* progress,
       message->string = strdup(status);
       message->disabled = false;
       ply_list_append_data(progress->current_message_list, message);
+      ply_hashtable_insert (progress->current_messages, message->string, message);
     }
 }
 
@@ -328,6 +378,82 @@ ply_progress_status_update (ply_progress_t* progress,
 
 #include <stdio.h>
 
+#define TEST_MESSAGE_COUNT 2000
+
+/* Replays a boot with as many units as a typical desktop against the
+ * cache from a boot like it, checking each next message estimate
+ * against a full scan, and reports how long an update takes.
+ */
+static int
+test_realistic_boot (void)
+{
+  ply_progress_t *progress;
+  char filename[] = "/tmp/ply-progress-test-XXXXXX";
+  char status[64];
+  double times[TEST_MESSAGE_COUNT];
+  double start, update_time;
+  FILE *fp;
+  int fd, i, j, errors;
+
+  fd = mkstemp (filename);
+  if (fd < 0)
+    return 1;
+  fp = fdopen (fd, "w");
+
+  /* units don't finish in the order they are listed in, and the cache
+   * only keeps three decimals so plenty of them share a time
+   */
+  for (i = 0; i < TEST_MESSAGE_COUNT; i++)
+    {
+      snprintf (status, sizeof (status), "%.3lf",
+                ((i * 7919) % TEST_MESSAGE_COUNT + 1) / (TEST_MESSAGE_COUNT + 1.0));
+      times[i] = strtod (status, NULL);
+      fprintf (fp, "%s:unit-%d.service\n", status, i);
+    }
+  fclose (fp);
+
+  progress = ply_progress_new ();
+  ply_progress_load_cache (progress, filename);
+  unlink (filename);
+
+  errors = 0;
+  update_time = 0.0;
+  for (i = 0; i < TEST_MESSAGE_COUNT; i++)
+    {
+      double expected;
+
+      snprintf (status, sizeof (status), "unit-%d.service", i);
+      start = ply_get_timestamp ();
+      ply_progress_status_update (progress, status);
+
+      /* a unit that wasn't there last boot, and one saying it again */
+      snprintf (status, sizeof (status), "new-unit-%d.service", i);
+      ply_progress_status_update (progress, status);
+      snprintf (status, sizeof (status), "unit-%d.service", i / 2);
+      ply_progress_status_update (progress, status);
+      update_time += ply_get_timestamp () - start;
+
+      expected = 1;
+      for (j = 0; j < TEST_MESSAGE_COUNT; j++)
+        {
+          if (times[j] > times[i] && times[j] < expected)
+            expected = times[j];
+        }
+      if (progress->next_message_percentage != expected)
+        errors = 1;
+    }
+
+  ply_progress_free (progress);
+
+  printf ("%d messages: %.0fns per status update\n",
+          TEST_MESSAGE_COUNT,
+          update_time * 1000000000.0 / (3 * TEST_MESSAGE_COUNT));
+  if (errors)
+    printf ("realistic boot test failed\n");
+
+  return errors;
+}
+
 int
 main (int    argc,
       char **argv)
@@ -390,7 +516,9 @@ main (int    argc,
     }
   ply_progress_free(progress);
 
-  return 0;
+  printf("\nRealistic boot run\n\n");
+
+  return test_realistic_boot ();
 }
 
 #endif /* PLY_PROGRESS_ENABLE_TEST */
@@ -28,13 +28,51 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include "ply-arena.h"
 #include "ply-list.h"
 #include "ply-rectangle.h"
 
+typedef struct
+{
+  long x1, y1, x2, y2;
+} ply_region_box_t;
+
+/* The region is kept as y-x banded boxes, the way pixman does it:
+ * boxes are sorted by top edge and then by left edge, boxes in the same
+ * band share top and bottom edges, no two boxes in a band touch, and
+ * vertically adjacent bands with the same spans are merged.
+ *
+ * Added rectangles are only collected, and get folded into the bands
+ * in one sweep the next time the region is read.
+ */
 struct _ply_region
 {
+  ply_region_box_t *boxes;
+  int number_of_boxes;
+  int boxes_size;
+
+  ply_region_box_t *pending_boxes;
+  int number_of_pending_boxes;
+  int pending_boxes_size;
+
+  /* where the next fold writes its bands */
+  ply_region_box_t *spare_boxes;
+  int spare_boxes_size;
+
+  ply_region_box_t extents;
+  int max_rectangles;
+
+  /* The rectangle list and scratch space come from an arena.  Regions
+   * made with ply_region_new_with_arena use the caller's for everything
+   * and are gone when it's reset; other regions keep a private one and
+   * reset it each time the rectangle list is rebuilt.
+   */
+  ply_arena_t *arena;
   ply_list_t *rectangle_list;
+  uint32_t rectangle_list_is_stale : 1;
+  uint32_t owns_arena : 1;
 };
 
 ply_region_t *
@@ -44,427 +82,487 @@ ply_region_new (void)
 
   region = calloc (1, sizeof (ply_region_t));
 
-  region->rectangle_list = ply_list_new ();
+  region->arena = ply_arena_new (4096);
+  region->owns_arena = true;
 
   return region;
 }
 
-void
-ply_region_clear (ply_region_t *region)
+ply_region_t *
+ply_region_new_with_arena (ply_arena_t *arena)
 {
-  ply_list_node_t *node;
+  ply_region_t *region;
 
-  node = ply_list_get_first_node (region->rectangle_list);
-  while (node != NULL)
-    {
-      ply_list_node_t *next_node;
-      ply_rectangle_t *rectangle;
+  assert (arena != NULL);
 
-      rectangle = (ply_rectangle_t *) ply_list_node_get_data (node);
+  region = ply_arena_allocate (arena, sizeof (ply_region_t));
 
-      next_node = ply_list_get_next_node (region->rectangle_list, node);
+  region->arena = arena;
+  region->owns_arena = false;
 
-      free (rectangle);
-      ply_list_remove_node (region->rectangle_list, node);
+  return region;
+}
+
+void
+ply_region_clear (ply_region_t *region)
+{
+  region->number_of_boxes = 0;
+  region->number_of_pending_boxes = 0;
+  memset (&region->extents, 0, sizeof (region->extents));
 
-      node = next_node;
+  if (region->owns_arena)
+    {
+      ply_arena_reset (region->arena);
+      region->rectangle_list = NULL;
     }
+  region->rectangle_list_is_stale = true;
 }
 
 void
 ply_region_free (ply_region_t *region)
 {
+  if (region == NULL)
+    return;
+
+  if (!region->owns_arena)
+    return;
 
-  ply_region_clear (region);
-  ply_list_free (region->rectangle_list);
+  ply_arena_free (region->arena);
+  free (region->boxes);
+  free (region->pending_boxes);
+  free (region->spare_boxes);
   free (region);
 }
 
-static ply_rectangle_t *
-copy_rectangle (ply_rectangle_t *rectangle)
+void
+ply_region_set_max_rectangles (ply_region_t *region,
+                               int           max_rectangles)
 {
-  ply_rectangle_t *new_rectangle;
-
-  new_rectangle = malloc (sizeof (*rectangle));
-  *new_rectangle = *rectangle;
+  assert (region != NULL);
+  assert (max_rectangles >= 0);
 
-  return new_rectangle;
+  region->max_rectangles = max_rectangles;
 }
 
 static void
-merge_rectangle_with_sub_list (ply_region_t    *region,
-                               ply_rectangle_t *new_area,
-                               ply_list_node_t *node)
+grow_boxes (ply_region_t      *region,
+            ply_region_box_t **boxes,
+            int                number_of_boxes,
+            int               *boxes_size,
+            int                wanted_size)
 {
+  int new_size;
+
+  if (wanted_size <= *boxes_size)
+    return;
+
+  new_size = MAX (2 * *boxes_size, 16);
+  new_size = MAX (new_size, wanted_size);
 
-  if (ply_rectangle_is_empty (new_area))
+  if (region->owns_arena)
+    *boxes = realloc (*boxes, new_size * sizeof (ply_region_box_t));
+  else
     {
-      free (new_area);
-      return;
+      ply_region_box_t *new_boxes;
+
+      new_boxes = ply_arena_allocate (region->arena,
+                                      new_size * sizeof (ply_region_box_t));
+      memcpy (new_boxes, *boxes, number_of_boxes * sizeof (ply_region_box_t));
+      *boxes = new_boxes;
     }
 
-  while (node != NULL)
+  *boxes_size = new_size;
+}
+
+static ply_region_box_t *
+append_box (ply_region_t      *region,
+            ply_region_box_t **boxes,
+            int               *number_of_boxes,
+            int               *boxes_size)
+{
+  grow_boxes (region, boxes, *number_of_boxes, boxes_size,
+              *number_of_boxes + 1);
+
+  return &(*boxes)[(*number_of_boxes)++];
+}
+
+void
+ply_region_add_rectangle (ply_region_t    *region,
+                          ply_rectangle_t *rectangle)
+{
+  ply_region_box_t *box;
+
+  assert (region != NULL);
+  assert (rectangle != NULL);
+
+  if (ply_rectangle_is_empty (rectangle))
+    return;
+
+  if (ply_region_is_empty (region))
+    {
+      region->extents.x1 = rectangle->x;
+      region->extents.y1 = rectangle->y;
+      region->extents.x2 = rectangle->x + rectangle->width;
+      region->extents.y2 = rectangle->y + rectangle->height;
+    }
+  else
     {
-      ply_list_node_t *next_node;
-      ply_rectangle_t *old_area;
-      ply_rectangle_overlap_t overlap;
+      region->extents.x1 = MIN (region->extents.x1, rectangle->x);
+      region->extents.y1 = MIN (region->extents.y1, rectangle->y);
+      region->extents.x2 = MAX (region->extents.x2,
+                                (long) (rectangle->x + rectangle->width));
+      region->extents.y2 = MAX (region->extents.y2,
+                                (long) (rectangle->y + rectangle->height));
+    }
 
-      old_area = (ply_rectangle_t *) ply_list_node_get_data (node);
+  box = append_box (region, &region->pending_boxes,
+                    &region->number_of_pending_boxes,
+                    &region->pending_boxes_size);
+  box->x1 = rectangle->x;
+  box->y1 = rectangle->y;
+  box->x2 = rectangle->x + rectangle->width;
+  box->y2 = rectangle->y + rectangle->height;
+}
 
-      next_node = ply_list_get_next_node (region->rectangle_list, node);
+static int
+compare_boxes_by_top (const void *element_a,
+                      const void *element_b)
+{
+  const ply_region_box_t *box_a = element_a;
+  const ply_region_box_t *box_b = element_b;
 
-      if (ply_rectangle_is_empty (new_area))
-        overlap = PLY_RECTANGLE_OVERLAP_NO_EDGES;
-      else if (ply_rectangle_is_empty (old_area))
-        overlap = PLY_RECTANGLE_OVERLAP_ALL_EDGES;
-      else
-        overlap = ply_rectangle_find_overlap (old_area, new_area);
+  if (box_a->y1 != box_b->y1)
+    return box_a->y1 < box_b->y1? -1 : 1;
 
-      switch (overlap)
-        {
-          /* NNNN      The new rectangle and node rectangle don't touch,
-           * NNNN OOOO so let's move on to the next one.
-           *      OOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_NONE:
-          break;
-
-          /* NNNNN   We need to split the new rectangle into
-           * NNOOOOO two rectangles:  The top row of Ns and
-           * NNOOOOO the left side of Ns.
-           *   OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_AND_LEFT_EDGES:
-            {
-              ply_rectangle_t *rectangle;
+  return 0;
+}
 
-              rectangle = copy_rectangle (new_area);
-              rectangle->y = old_area->y;
-              rectangle->width = old_area->x - new_area->x;
-              rectangle->height = (new_area->y + new_area->height) - old_area->y;
+static int
+compare_edges (const void *element_a,
+               const void *element_b)
+{
+  long edge_a = *(const long *) element_a;
+  long edge_b = *(const long *) element_b;
 
-              merge_rectangle_with_sub_list (region, rectangle, next_node);
+  if (edge_a != edge_b)
+    return edge_a < edge_b? -1 : 1;
 
-              new_area->height = old_area->y - new_area->y;
-            }
-          break;
-
-          /*   NNNNN We need to split the new rectangle into
-           * OOOOONN two rectangles:  The top row of Ns and
-           * OOOOONN the right side of Ns.
-           * OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_AND_RIGHT_EDGES:
-            {
-              ply_rectangle_t *rectangle;
+  return 0;
+}
+
+/* qsort can malloc behind our back, so sort with scratch space from
+ * the arena instead.
+ */
+static void
+sort_with_arena (ply_arena_t *arena,
+                 void        *elements,
+                 size_t       number_of_elements,
+                 size_t       element_size,
+                 int        (*compare) (const void *, const void *))
+{
+  char *source, *destination;
+  size_t width;
 
-              rectangle = copy_rectangle (new_area);
-              rectangle->x = old_area->x + old_area->width;
-              rectangle->y = old_area->y;
-              rectangle->width = (new_area->x + new_area->width) - (old_area->x + old_area->width);
-              rectangle->height = (new_area->y + new_area->height) - old_area->y;
+  source = elements;
+  destination = ply_arena_allocate (arena, number_of_elements * element_size);
 
-              merge_rectangle_with_sub_list (region, rectangle, next_node);
+  for (width = 1; width < number_of_elements; width *= 2)
+    {
+      size_t start;
+      char *swap;
 
-              new_area->height = old_area->y - new_area->y;
-            }
-          break;
-
-          /* NNNNNNN We need to trim out the part of
-           * NOOOOON old rectangle that overlaps the new
-           * NOOOOON rectangle by shrinking and moving it
-           *  OOOOO  and then we need to add the new rectangle.
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_AND_SIDE_EDGES:
+      for (start = 0; start < number_of_elements; start += 2 * width)
+        {
+          size_t left, left_end, right, right_end, output;
+
+          left = start;
+          left_end = MIN (start + width, number_of_elements);
+          right = left_end;
+          right_end = MIN (start + 2 * width, number_of_elements);
+
+          for (output = start; output < right_end; output++)
             {
-              old_area->height = (old_area->y + old_area->height)
-                                 - (new_area->y + new_area->height);
-              old_area->y = new_area->y + new_area->height;
+              size_t next;
+
+              if (left < left_end &&
+                  (right >= right_end ||
+                   compare (source + left * element_size,
+                            source + right * element_size) <= 0))
+                next = left++;
+              else
+                next = right++;
+
+              memcpy (destination + output * element_size,
+                      source + next * element_size, element_size);
             }
-          break;
-
-          /*   NNN  We only care about the top row of Ns,
-           *  ONNNO everything below that is already handled by
-           *  ONNNO the old rectangle.
-           *  OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_EDGE:
-            new_area->height = old_area->y - new_area->y;
-          break;
-
-          /*   OOOOO We need to split the new rectangle into
-           * NNOOOOO two rectangles:  The left side of Ns and
-           * NNOOOOO the bottom row of Ns.
-           * NNOOOOO
-           * NNNNN
-           */
-          case PLY_RECTANGLE_OVERLAP_BOTTOM_AND_LEFT_EDGES:
-            {
-              ply_rectangle_t *rectangle;
+        }
 
-              rectangle = copy_rectangle (new_area);
+      swap = source;
+      source = destination;
+      destination = swap;
+    }
 
-              rectangle->width = old_area->x - new_area->x;
-              rectangle->height = (old_area->y + old_area->height) - new_area->y;
+  if (source != elements)
+    memcpy (elements, source, number_of_elements * element_size);
+}
 
-              merge_rectangle_with_sub_list (region, rectangle, next_node);
+static bool
+bands_have_same_spans (ply_region_box_t *band_a,
+                       ply_region_box_t *band_b,
+                       int               number_of_spans)
+{
+  int i;
 
-              new_area->height = (new_area->y + new_area->height) - (old_area->y + old_area->height);
-              new_area->y = old_area->y + old_area->height;
-            }
-          break;
-
-          /*   OOOOO   We need to split the new rectangle into
-           *   OOOOONN two rectangles:  The right side of Ns and
-           *   OOOOONN the bottom row of Ns.
-           *   OOOOONN
-           *     NNNNN
-           */
-          case PLY_RECTANGLE_OVERLAP_BOTTOM_AND_RIGHT_EDGES:
-            {
-              ply_rectangle_t *rectangle;
+  for (i = 0; i < number_of_spans; i++)
+    {
+      if (band_a[i].x1 != band_b[i].x1 || band_a[i].x2 != band_b[i].x2)
+        return false;
+    }
 
-              rectangle = copy_rectangle (new_area);
+  return true;
+}
 
-              rectangle->x = old_area->x + old_area->width;
-              rectangle->width = (new_area->x + new_area->width) - (old_area->x + old_area->width);
-              rectangle->height = (old_area->y + old_area->height) - new_area->y;
+/* Sweeps down through every edge, keeping the boxes that cross the
+ * current band sorted by left edge, so each band's spans come out of
+ * a single merge pass.
+ */
+static void
+fold_in_pending_boxes (ply_region_t *region)
+{
+  ply_region_box_t *input_boxes, *output_boxes;
+  ply_region_box_t **active_boxes;
+  long *edges;
+  int number_of_input_boxes, number_of_edges, number_of_active_boxes;
+  int number_of_output_boxes, output_boxes_size;
+  int previous_band_start, previous_band_length;
+  int i, next_box;
+
+  if (region->number_of_pending_boxes == 0)
+    return;
+
+  /* the old rectangle list goes away along with the scratch space */
+  if (region->owns_arena)
+    {
+      ply_arena_reset (region->arena);
+      region->rectangle_list = NULL;
+    }
 
-              merge_rectangle_with_sub_list (region, rectangle, next_node);
+  number_of_input_boxes = region->number_of_boxes +
+                          region->number_of_pending_boxes;
+  input_boxes = ply_arena_allocate (region->arena,
+                                    number_of_input_boxes *
+                                    sizeof (ply_region_box_t));
+  memcpy (input_boxes, region->boxes,
+          region->number_of_boxes * sizeof (ply_region_box_t));
+  memcpy (input_boxes + region->number_of_boxes, region->pending_boxes,
+          region->number_of_pending_boxes * sizeof (ply_region_box_t));
+  sort_with_arena (region->arena, input_boxes, number_of_input_boxes,
+                   sizeof (ply_region_box_t), compare_boxes_by_top);
+
+  edges = ply_arena_allocate (region->arena,
+                              2 * number_of_input_boxes * sizeof (long));
+  for (i = 0; i < number_of_input_boxes; i++)
+    {
+      edges[2 * i] = input_boxes[i].y1;
+      edges[2 * i + 1] = input_boxes[i].y2;
+    }
+  sort_with_arena (region->arena, edges, 2 * number_of_input_boxes,
+                   sizeof (long), compare_edges);
 
-              new_area->height = (new_area->y + new_area->height) - (old_area->y + old_area->height);
-              new_area->y = old_area->y + old_area->height;
-            }
-          break;
-
-          /*  OOOOO  We need to trim out the part of
-           * NOOOOON old rectangle that overlaps the new
-           * NOOOOON rectangle by shrinking it
-           * NNNNNNN and then we need to add the new rectangle.
-           */
-          case PLY_RECTANGLE_OVERLAP_BOTTOM_AND_SIDE_EDGES:
-            {
-              old_area->height = new_area->y - old_area->y;
-            }
-          break;
-
-          /*  OOOOO We only care about the bottom row of Ns,
-           *  ONNNO everything above that is already handled by
-           *  ONNNO the old rectangle.
-           *   NNN
-           */
-          case PLY_RECTANGLE_OVERLAP_BOTTOM_EDGE:
-            {
-              new_area->height = (new_area->y + new_area->height) - (old_area->y + old_area->height);
-              new_area->y = old_area->y + old_area->height;
-            }
-          break;
-
-          /*  NNNN   We need to trim out the part of
-           *  NNNNO  old rectangle that overlaps the new
-           *  NNNNO  rectangle by shrinking it and moving it
-           *  NNNN   and then we need to add the new rectangle.
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_LEFT_AND_BOTTOM_EDGES:
-            {
-              old_area->width = (old_area->x + old_area->width)
-                                 - (new_area->x + new_area->width);
-              old_area->x = new_area->x + new_area->width;
-            }
-          break;
-
-          /*  NNNN  We need to trim out the part of
-           * ONNNN  old rectangle that overlaps the new
-           * ONNNN  rectangle by shrinking it and then we
-           *  NNNN  need to add the new rectangle.
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_RIGHT_AND_BOTTOM_EDGES:
-            old_area->width = new_area->x - old_area->x;
-          break;
-
-          /* NNNNNNN The old rectangle is completely inside the new rectangle
-           * NOOOOON so replace the old rectangle with the new rectangle.
-           * NOOOOON
-           * NNNNNNN
-           */
-          case PLY_RECTANGLE_OVERLAP_ALL_EDGES:
-            merge_rectangle_with_sub_list (region, new_area, next_node);
-            free (old_area);
-            ply_list_remove_node (region->rectangle_list, node);
-          return;
-
-          /*  NNN  We need to split the new rectangle into
-           * ONNNO two rectangles: the top and bottom row of Ns
-           * ONNNO
-           *  NNN
-           */
-          case PLY_RECTANGLE_OVERLAP_TOP_AND_BOTTOM_EDGES:
-            {
-              ply_rectangle_t *rectangle;
+  number_of_edges = 0;
+  for (i = 0; i < 2 * number_of_input_boxes; i++)
+    {
+      if (number_of_edges == 0 || edges[number_of_edges - 1] != edges[i])
+        edges[number_of_edges++] = edges[i];
+    }
 
-              rectangle = copy_rectangle (new_area);
-              rectangle->y = old_area->y + old_area->height;
-              rectangle->width = new_area->width;
-              rectangle->height = (new_area->y + new_area->height) - (old_area->y + old_area->height);
-              merge_rectangle_with_sub_list (region, rectangle, next_node);
+  active_boxes = ply_arena_allocate (region->arena,
+                                     number_of_input_boxes *
+                                     sizeof (ply_region_box_t *));
+  number_of_active_boxes = 0;
 
-              new_area->height = old_area->y - new_area->y;
-            }
-          break;
-
-          /*  OOOOO We only care about the side row of Ns,
-           * NNNNOO everything rigth of that is already handled by
-           * NNNNOO the old rectangle.
-           *  OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_LEFT_EDGE:
-            new_area->width = old_area->x - new_area->x;
-          break;
-
-          /* OOOOO  We only care about the side row of Ns,
-           * NNNNNN everything left of that is already handled by
-           * NNNNNN the old rectangle.
-           * OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_RIGHT_EDGE:
-            {
-              long temp = new_area->x;
-              new_area->x = old_area->x + old_area->width;
-              new_area->width = (temp + new_area->width) - (old_area->x + old_area->width);
-            }
-          break;
-
-          /*  OOOOO  We need to split the new rectangle into
-           * NNNNNNN two rectangles: the side columns of Ns
-           * NNNNNNN
-           *  OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_SIDE_EDGES:
-            {
-              ply_rectangle_t *rectangle;
+  output_boxes = region->spare_boxes;
+  number_of_output_boxes = 0;
+  output_boxes_size = region->spare_boxes_size;
+  previous_band_start = 0;
+  previous_band_length = 0;
 
-              rectangle = copy_rectangle (new_area);
+  next_box = 0;
+  for (i = 0; i + 1 < number_of_edges; i++)
+    {
+      long top, bottom;
+      int j, band_start;
 
-              rectangle->x = old_area->x + old_area->width;
-              rectangle->width = (new_area->x + new_area->width) - (old_area->x + old_area->width);
+      top = edges[i];
+      bottom = edges[i + 1];
 
-              merge_rectangle_with_sub_list (region, rectangle, next_node);
+      /* drop boxes that ended above this band */
+      for (j = 0; j < number_of_active_boxes; j++)
+        {
+          if (active_boxes[j]->y2 <= top)
+            break;
+        }
+      if (j < number_of_active_boxes)
+        {
+          int k;
 
-              new_area->width = old_area->x - new_area->x;
-            }
-          break;
-
-          /* OOOOOOO The new rectangle is completely inside an old rectangle
-           * ONNNNNO so return early without adding the new rectangle.
-           * ONNNNNO
-           * OOOOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_NO_EDGES:
-            free (new_area);
-          return;
-
-          /*  NNNNN We expand the old rectangle up and throw away the new.
-           *  NNNNN We must merge it because the new region may have overlapped
-           *  NNNNN something further down the list.
-           *  OOOOO
-           */
-          case PLY_RECTANGLE_OVERLAP_EXACT_TOP_EDGE:
+          for (k = j + 1; k < number_of_active_boxes; k++)
             {
-              old_area->height = (old_area->y + old_area->height) - new_area->y;
-              old_area->y = new_area->y;
-              free (new_area);
-              merge_rectangle_with_sub_list (region, old_area, next_node);
-              ply_list_remove_node (region->rectangle_list, node);
+              if (active_boxes[k]->y2 > top)
+                active_boxes[j++] = active_boxes[k];
             }
-          return;
-
-          /*  OOOOO We expand the old rectangle down and throw away the new.
-           *  NNNNN We must merge it because the new region may have overlapped
-           *  NNNNN something further down the list.
-           *  NNNNN
-           */
-          case PLY_RECTANGLE_OVERLAP_EXACT_BOTTOM_EDGE:
-            {
-              old_area->height = (new_area->y + new_area->height) - old_area->y;
-              free (new_area);
-              merge_rectangle_with_sub_list (region, old_area, next_node);
-              ply_list_remove_node (region->rectangle_list, node);
-            }
-          return;
+          number_of_active_boxes = j;
+        }
 
-          /*  NNNNNO We expand the old rectangle left and throw away the new.
-           *  NNNNNO We must merge it because the new region may have overlapped
-           *  NNNNNO something further down the list.
-           */
-          case PLY_RECTANGLE_OVERLAP_EXACT_LEFT_EDGE:
+      /* and pick up the ones starting at it */
+      while (next_box < number_of_input_boxes &&
+             input_boxes[next_box].y1 <= top)
+        {
+          ply_region_box_t *box;
+          int low, high;
+
+          box = &input_boxes[next_box++];
+
+          low = 0;
+          high = number_of_active_boxes;
+          while (low < high)
             {
-              old_area->width = (old_area->x + old_area->width) - new_area->x;
-              old_area->x = new_area->x;
-              free (new_area);
-              merge_rectangle_with_sub_list (region, old_area, next_node);
-              ply_list_remove_node (region->rectangle_list, node);
+              int middle;
+
+              middle = (low + high) / 2;
+              if (active_boxes[middle]->x1 <= box->x1)
+                low = middle + 1;
+              else
+                high = middle;
             }
-          return;
 
-          /*  ONNNNN We expand the old rectangle right and throw away the new.
-           *  ONNNNN We must merge it because the new region may have overlapped
-           *  ONNNNN something further down the list.
-           */
-          case PLY_RECTANGLE_OVERLAP_EXACT_RIGHT_EDGE:
+          memmove (&active_boxes[low + 1], &active_boxes[low],
+                   (number_of_active_boxes - low) * sizeof (ply_region_box_t *));
+          active_boxes[low] = box;
+          number_of_active_boxes++;
+        }
+
+      if (number_of_active_boxes == 0)
+        continue;
+
+      band_start = number_of_output_boxes;
+      for (j = 0; j < number_of_active_boxes; j++)
+        {
+          ply_region_box_t *span;
+
+          if (number_of_output_boxes > band_start &&
+              active_boxes[j]->x1 <= output_boxes[number_of_output_boxes - 1].x2)
             {
-              old_area->width = (new_area->x + new_area->width) - old_area->x;
-              free (new_area);
-              merge_rectangle_with_sub_list (region, old_area, next_node);
-              ply_list_remove_node (region->rectangle_list, node);
+              span = &output_boxes[number_of_output_boxes - 1];
+              span->x2 = MAX (span->x2, active_boxes[j]->x2);
+              continue;
             }
-          return;
 
+          span = append_box (region, &output_boxes, &number_of_output_boxes,
+                             &output_boxes_size);
+          span->x1 = active_boxes[j]->x1;
+          span->y1 = top;
+          span->x2 = active_boxes[j]->x2;
+          span->y2 = bottom;
+        }
 
+      /* stretch the band above down instead, if it's the same shape */
+      if (previous_band_length == number_of_output_boxes - band_start &&
+          output_boxes[previous_band_start].y2 == top &&
+          bands_have_same_spans (&output_boxes[previous_band_start],
+                                 &output_boxes[band_start],
+                                 previous_band_length))
+        {
+          for (j = previous_band_start; j < band_start; j++)
+            output_boxes[j].y2 = bottom;
+          number_of_output_boxes = band_start;
+          continue;
         }
 
-      node = ply_list_get_next_node (region->rectangle_list, node);
+      previous_band_start = band_start;
+      previous_band_length = number_of_output_boxes - band_start;
     }
 
-  ply_list_append_data (region->rectangle_list, new_area);
+  region->spare_boxes = region->boxes;
+  region->spare_boxes_size = region->boxes_size;
+  region->boxes = output_boxes;
+  region->number_of_boxes = number_of_output_boxes;
+  region->boxes_size = output_boxes_size;
+  region->number_of_pending_boxes = 0;
+
+  if (region->max_rectangles > 0 &&
+      region->number_of_boxes > region->max_rectangles)
+    {
+      region->boxes[0] = region->extents;
+      region->number_of_boxes = 1;
+    }
+
+  region->rectangle_list_is_stale = true;
 }
 
 void
-ply_region_add_rectangle (ply_region_t    *region,
-                          ply_rectangle_t *rectangle)
+ply_region_get_extents (ply_region_t    *region,
+                        ply_rectangle_t *extents)
 {
-  ply_list_node_t *first_node;
-  ply_rectangle_t *rectangle_copy;
-
   assert (region != NULL);
-  assert (rectangle != NULL);
+  assert (extents != NULL);
 
-  first_node = ply_list_get_first_node (region->rectangle_list);
+  extents->x = region->extents.x1;
+  extents->y = region->extents.y1;
+  extents->width = region->extents.x2 - region->extents.x1;
+  extents->height = region->extents.y2 - region->extents.y1;
+}
 
-  rectangle_copy = copy_rectangle (rectangle);
-  merge_rectangle_with_sub_list (region,
-                                 rectangle_copy,
-                                 first_node);
+bool
+ply_region_is_empty (ply_region_t *region)
+{
+  return region->number_of_boxes == 0 &&
+         region->number_of_pending_boxes == 0;
 }
 
 ply_list_t *
 ply_region_get_rectangle_list (ply_region_t *region)
 {
-  return region->rectangle_list;
-}
+  ply_rectangle_t *rectangles;
+  int i;
 
-static int
-rectangle_compare_y (void *element_a, void *element_b)
-{
-  ply_rectangle_t *rectangle_a = element_a;
-  ply_rectangle_t *rectangle_b = element_b;
-  return rectangle_a->y - rectangle_b->y;
+  fold_in_pending_boxes (region);
+
+  if (region->rectangle_list != NULL && !region->rectangle_list_is_stale)
+    return region->rectangle_list;
+
+  if (region->rectangle_list == NULL)
+    region->rectangle_list = ply_list_new_with_arena (region->arena);
+  else
+    ply_list_remove_all_nodes (region->rectangle_list);
+
+  rectangles = ply_arena_allocate (region->arena,
+                                   region->number_of_boxes *
+                                   sizeof (ply_rectangle_t));
+
+  for (i = 0; i < region->number_of_boxes; i++)
+    {
+      ply_rectangle_t *rectangle;
+
+      rectangle = &rectangles[i];
+      rectangle->x = region->boxes[i].x1;
+      rectangle->y = region->boxes[i].y1;
+      rectangle->width = region->boxes[i].x2 - region->boxes[i].x1;
+      rectangle->height = region->boxes[i].y2 - region->boxes[i].y1;
+
+      ply_list_append_data (region->rectangle_list, rectangle);
+    }
+
+  region->rectangle_list_is_stale = false;
+
+  return region->rectangle_list;
 }
 
+/* banded rectangles are already in top to bottom order */
 ply_list_t *
 ply_region_get_sorted_rectangle_list (ply_region_t *region)
 {
-  ply_list_sort (region->rectangle_list, &rectangle_compare_y);
-  return region->rectangle_list;
+  return ply_region_get_rectangle_list (region);
 }
 
 #ifdef PLY_REGION_ENABLE_TEST
@@ -590,8 +688,42 @@ do_test (void)
       printf("\n");
     }
   printf("errors:%d\n", count);
+  ply_region_free (region);
   return count;
 }
+
+static int
+do_extents_test (void)
+{
+  ply_rectangle_t rectangles[] = { { 10, 10, 5, 5 },
+                                   { 30, 40, 5, 5 },
+                                   { 20, 0, 5, 5 } };
+  ply_rectangle_t extents;
+  ply_region_t *region;
+  int i;
+
+  region = ply_region_new ();
+  ply_region_set_max_rectangles (region, 2);
+
+  for (i = 0; i < 3; i++)
+    ply_region_add_rectangle (region, &rectangles[i]);
+
+  ply_region_get_extents (region, &extents);
+  printf ("extents X=%ld Y=%ld W=%lu H=%lu\n",
+          extents.x, extents.y, extents.width, extents.height);
+
+  if (extents.x != 10 || extents.y != 0 ||
+      extents.width != 25 || extents.height != 45)
+    return 1;
+
+  /* three rectangles is over the limit, so they become the extents */
+  if (ply_list_get_length (ply_region_get_rectangle_list (region)) != 1)
+    return 1;
+
+  ply_region_free (region);
+  return 0;
+}
+
 int
 main (int    argc,
       char **argv)
@@ -602,6 +734,7 @@ main (int    argc,
     {
       if (do_test ()) return 1;
     }
+  if (do_extents_test ()) return 1;
   return 0;
 }
 #endif
@@ -25,6 +25,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "ply-arena.h"
 #include "ply-list.h"
 #include "ply-rectangle.h"
 #include "ply-utils.h"
@@ -33,12 +34,17 @@ typedef struct _ply_region ply_region_t;
 
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_region_t *ply_region_new (void);
+ply_region_t *ply_region_new_with_arena (ply_arena_t *arena);
 void ply_region_free (ply_region_t *region);
 void ply_region_add_rectangle (ply_region_t    *region,
                                ply_rectangle_t *rectangle);
 void ply_region_clear (ply_region_t *region);
 ply_list_t *ply_region_get_rectangle_list (ply_region_t *region);
 ply_list_t *ply_region_get_sorted_rectangle_list (ply_region_t *region);
+void ply_region_get_extents (ply_region_t    *region,
+                             ply_rectangle_t *extents);
+void ply_region_set_max_rectangles (ply_region_t *region,
+                                    int           max_rectangles);
 
 bool ply_region_is_empty (ply_region_t *region);
 
@@ -594,6 +594,16 @@ ply_get_timestamp (void)
   return timestamp;
 }
 
+uint64_t
+ply_get_monotonic_nanoseconds (void)
+{
+  struct timespec now = { 0L, /* zero-filled */ };
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  return PLY_NANOSECONDS_PER_SECOND * now.tv_sec + now.tv_nsec;
+}
+
 void 
 ply_save_errno (void)
 {
@@ -41,6 +41,7 @@
 #endif
 
 #define PLY_UTF8_CHARACTER_SIZE_MAX 4
+#define PLY_NANOSECONDS_PER_SECOND 1000000000ULL
 
 typedef intptr_t ply_module_handle_t;
 typedef void (* ply_module_function_t) (void);
@@ -82,6 +83,7 @@ bool ply_string_has_prefix (const char *string,
                             const char *prefix);
 void ply_close_all_fds (void);
 double ply_get_timestamp (void);
+uint64_t ply_get_monotonic_nanoseconds (void);
 
 void ply_save_errno (void);
 void ply_restore_errno (void);
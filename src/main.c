@@ -57,6 +57,10 @@
 #define PLY_MAX_COMMAND_LINE_SIZE 512
 #endif
 
+#ifndef STATUS_UPDATES_PER_SECOND
+#define STATUS_UPDATES_PER_SECOND 30
+#endif
+
 #define BOOT_DURATION_FILE     PLYMOUTH_TIME_DIRECTORY "/boot-duration"
 #define SHUTDOWN_DURATION_FILE PLYMOUTH_TIME_DIRECTORY "/shutdown-duration"
 
@@ -120,6 +124,12 @@ typedef struct
 
   int number_of_errors;
   ply_list_t *pending_messages;
+
+  ply_list_t *pending_statuses;
+  unsigned long number_of_status_updates;
+  unsigned long number_of_coalesced_status_updates;
+  unsigned long number_of_dropped_status_updates;
+  uint32_t is_waiting_for_status_tick : 1;
 } state_t;
 
 static ply_boot_splash_t *start_boot_splash (state_t    *state,
@@ -163,17 +173,128 @@ on_session_finished (state_t *state)
   ply_trace ("got hang up on terminal session fd");
 }
 
+static void start_status_tick (state_t *state);
+
+static void
+on_status_tick (state_t *state)
+{
+  ply_list_node_t *node;
+
+  state->is_waiting_for_status_tick = false;
+
+  if (ply_list_get_length (state->pending_statuses) == 0)
+    return;
+
+  while ((node = ply_list_get_first_node (state->pending_statuses)) != NULL)
+    {
+      char *status;
+
+      status = ply_list_node_get_data (node);
+      ply_list_remove_node (state->pending_statuses, node);
+
+      if (state->boot_splash != NULL)
+        ply_boot_splash_update_status (state->boot_splash, status);
+      else
+        state->number_of_dropped_status_updates++;
+
+      free (status);
+    }
+
+  if (state->boot_splash != NULL)
+    start_status_tick (state);
+}
+
+static void
+start_status_tick (state_t *state)
+{
+  state->is_waiting_for_status_tick = true;
+  ply_event_loop_watch_for_timeout (state->loop,
+                                    1.0 / STATUS_UPDATES_PER_SECOND,
+                                    (ply_event_loop_timeout_handler_t)
+                                    on_status_tick, state);
+}
+
+/* Statuses like "fsck:sda1:50" name what they are about before their
+ * last colon, and only replace statuses about the same thing.  Plain
+ * statuses all replace each other.
+ */
+static bool
+statuses_are_about_the_same_thing (const char *status,
+                                   const char *other_status)
+{
+  const char *colon, *other_colon;
+  size_t length;
+
+  colon = strrchr (status, ':');
+  other_colon = strrchr (other_status, ':');
+
+  if (colon == NULL || other_colon == NULL)
+    return colon == other_colon;
+
+  length = colon - status;
+
+  return length == (size_t) (other_colon - other_status) &&
+         strncmp (status, other_status, length) == 0;
+}
+
+static void
+queue_pending_status (state_t    *state,
+                      const char *status)
+{
+  ply_list_node_t *node;
+
+  node = ply_list_get_first_node (state->pending_statuses);
+  while (node != NULL)
+    {
+      char *pending_status;
+
+      pending_status = ply_list_node_get_data (node);
+
+      if (statuses_are_about_the_same_thing (status, pending_status))
+        {
+          state->number_of_coalesced_status_updates++;
+          ply_list_node_set_data (node, strdup (status));
+          free (pending_status);
+          return;
+        }
+
+      node = ply_list_get_next_node (state->pending_statuses, node);
+    }
+
+  ply_list_append_data (state->pending_statuses, strdup (status));
+}
+
+/* Every status counts towards progress, but the splash only gets the
+ * newest one about each thing every frame.  A status that comes in
+ * while the splash is idle goes straight through, so lone updates show
+ * up without delay.
+ */
 static void
 on_update (state_t     *state,
            const char  *status)
 {
   ply_trace ("updating status to '%s'", status);
+  state->number_of_status_updates++;
+
   if (strncmp (status, "fsck:", 5))
     ply_progress_status_update (state->progress,
                                 status);
-  if (state->boot_splash != NULL)
-    ply_boot_splash_update_status (state->boot_splash,
-                                   status);
+
+  if (state->boot_splash == NULL)
+    {
+      state->number_of_dropped_status_updates++;
+      return;
+    }
+
+  if (state->is_waiting_for_status_tick)
+    {
+      queue_pending_status (state, status);
+      return;
+    }
+
+  ply_boot_splash_update_status (state->boot_splash,
+                                 status);
+  start_status_tick (state);
 }
 
 static void
@@ -1712,6 +1833,7 @@ initialize_environment (state_t *state)
   state->pixel_displays = ply_list_new ();
   state->text_displays = ply_list_new ();
   state->pending_messages = ply_list_new ();
+  state->pending_statuses = ply_list_new ();
   state->keyboard = NULL;
 
   if (!state->default_tty)
@@ -1802,6 +1924,33 @@ on_crash (int signum)
     raise(signum);
 }
 
+static void
+trace_event_loop_statistics (ply_event_loop_t *loop)
+{
+  ply_event_loop_statistics_t statistics;
+  int i;
+
+  ply_event_loop_get_statistics (loop, &statistics);
+
+  ply_trace ("event loop woke up %lu times for %lu events (at most %lu at once) "
+             "and %lu timeouts",
+             statistics.number_of_wakeups, statistics.number_of_events,
+             statistics.max_events_per_wakeup, statistics.number_of_timeouts);
+
+  for (i = 0; i < PLY_EVENT_LOOP_NUMBER_OF_HANDLER_TIME_BUCKETS; i++)
+    {
+      if (statistics.handler_time_histogram[i] == 0)
+        continue;
+
+      if (i < PLY_EVENT_LOOP_NUMBER_OF_HANDLER_TIME_BUCKETS - 1)
+        ply_trace ("%lu handlers took under %luus",
+                   statistics.handler_time_histogram[i], 1UL << i);
+      else
+        ply_trace ("%lu handlers took %luus or more",
+                   statistics.handler_time_histogram[i], 1UL << (i - 1));
+    }
+}
+
 int
 main (int    argc,
       char **argv)
@@ -1815,6 +1964,7 @@ main (int    argc,
   ply_daemon_handle_t *daemon_handle;
   char *mode_string = NULL;
   char *tty = NULL;
+  ply_list_node_t *node;
 
   state.command_parser = ply_command_parser_new ("plymouthd", "Boot splash control server");
 
@@ -1981,6 +2131,20 @@ main (int    argc,
   ply_trace ("entering event loop");
   exit_code = ply_event_loop_run (state.loop);
   ply_trace ("exited event loop");
+  trace_event_loop_statistics (state.loop);
+
+  ply_trace ("got %lu status updates, %lu coalesced and %lu dropped "
+             "before reaching the splash",
+             state.number_of_status_updates,
+             state.number_of_coalesced_status_updates,
+             state.number_of_dropped_status_updates);
+  node = ply_list_get_first_node (state.pending_statuses);
+  while (node != NULL)
+    {
+      free (ply_list_node_get_data (node));
+      node = ply_list_get_next_node (state.pending_statuses, node);
+    }
+  ply_list_free (state.pending_statuses);
 
   ply_progress_save_cache (state.progress,
                            get_cache_file_for_mode (state.mode));
@@ -29,6 +29,7 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <string.h>
 #include <stdbool.h>
@@ -63,6 +64,11 @@
 
 #define BYTES_PER_PIXEL (4)
 
+/* A few refreshes even at the slowest rates; a flip taking longer than
+ * this isn't going to complete
+ */
+#define PLY_RENDERER_HEAD_FLIP_TIMEOUT (0.1)
+
 struct _ply_renderer_head
 {
   ply_renderer_backend_t *backend;
@@ -78,6 +84,25 @@ struct _ply_renderer_head
   uint32_t encoder_id;
   uint32_t console_buffer_id;
   uint32_t scan_out_buffer_id;
+
+  /* When the scan out buffers have no row padding, flushing copies
+   * into a second, mapped back buffer and flips it to the front.
+   * Mapped buffers are usually write-combined and very slow to read,
+   * so the splash still draws into pixel_buffer, and the back buffer
+   * is only ever written to.  stale_back_region has the areas that
+   * went out in the last flip, which the back buffer doesn't have yet.
+   */
+  uint32_t back_buffer_id;
+  char *front_address;
+  char *back_address;
+  ply_region_t *stale_back_region;
+
+  ply_renderer_frame_done_handler_t frame_done_handler;
+  void *frame_done_user_data;
+
+  uint32_t is_double_buffered : 1;
+  uint32_t flip_pending : 1;
+  uint32_t flush_is_deferred : 1;
 };
 
 struct _ply_renderer_input_source
@@ -101,6 +126,7 @@ struct _ply_renderer_backend
   uint32_t driver_supports_mapping_console;
 
   int device_fd;
+  ply_fd_watch_t *device_watch;
   char *device_name;
   drmModeRes *resources;
 
@@ -119,6 +145,14 @@ static void ply_renderer_head_redraw (ply_renderer_backend_t *backend,
                                       ply_renderer_head_t    *head);
 static bool open_input_source (ply_renderer_backend_t      *backend,
                                ply_renderer_input_source_t *input_source);
+static void ply_renderer_head_wait_for_flip (ply_renderer_backend_t *backend,
+                                             ply_renderer_head_t    *head);
+static void stop_watching_for_frame_done (ply_renderer_backend_t *backend,
+                                          ply_renderer_head_t    *head);
+static void on_device_event (ply_renderer_backend_t *backend,
+                             int                     device_fd);
+static void flush_head (ply_renderer_backend_t *backend,
+                        ply_renderer_head_t    *head);
 
 static ply_renderer_head_t *
 ply_renderer_head_new (ply_renderer_backend_t *backend,
@@ -157,6 +191,7 @@ static void
 ply_renderer_head_free (ply_renderer_head_t *head)
 {
   ply_trace ("freeing %ldx%ld renderer head", head->area.width, head->area.height);
+  stop_watching_for_frame_done (head->backend, head);
   ply_pixel_buffer_free (head->pixel_buffer);
   drmModeFreeConnector (head->connector);
   free (head);
@@ -177,6 +212,88 @@ ply_renderer_head_set_scan_out_buffer (ply_renderer_backend_t *backend,
   return true;
 }
 
+static bool
+ply_renderer_head_start_double_buffering (ply_renderer_backend_t *backend,
+                                          ply_renderer_head_t    *head)
+{
+  unsigned long row_stride;
+  uint32_t *shadow_buffer;
+  size_t size;
+
+  if (head->row_stride != head->area.width * BYTES_PER_PIXEL)
+    {
+      ply_trace ("scan out buffer rows are padded, not double buffering");
+      return false;
+    }
+
+  head->back_buffer_id =
+    backend->driver_interface->create_buffer (backend->driver,
+                                              head->area.width, head->area.height,
+                                              &row_stride);
+
+  if (head->back_buffer_id == 0)
+    return false;
+
+  if (row_stride != head->row_stride ||
+      !backend->driver_interface->map_buffer (backend->driver,
+                                              head->back_buffer_id))
+    {
+      backend->driver_interface->destroy_buffer (backend->driver,
+                                                 head->back_buffer_id);
+      head->back_buffer_id = 0;
+      return false;
+    }
+
+  /* Both buffers stay mapped, and inside a flush, for as long as the
+   * head is mapped.
+   */
+  head->front_address =
+    backend->driver_interface->begin_flush (backend->driver,
+                                            head->scan_out_buffer_id);
+  head->back_address =
+    backend->driver_interface->begin_flush (backend->driver,
+                                            head->back_buffer_id);
+
+  shadow_buffer = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+  size = head->area.height * head->row_stride;
+  memcpy (head->front_address, shadow_buffer, size);
+  memcpy (head->back_address, shadow_buffer, size);
+
+  head->stale_back_region = ply_region_new ();
+  head->is_double_buffered = true;
+
+  ply_region_clear (ply_pixel_buffer_get_updated_areas (head->pixel_buffer));
+
+  ply_trace ("flipping between two scan out buffers for %ldx%ld head",
+             head->area.width, head->area.height);
+  return true;
+}
+
+static void
+ply_renderer_head_stop_double_buffering (ply_renderer_backend_t *backend,
+                                         ply_renderer_head_t    *head)
+{
+  ply_renderer_head_wait_for_flip (backend, head);
+  head->flush_is_deferred = false;
+
+  ply_region_free (head->stale_back_region);
+  head->stale_back_region = NULL;
+  head->front_address = NULL;
+  head->back_address = NULL;
+  head->is_double_buffered = false;
+
+  backend->driver_interface->end_flush (backend->driver,
+                                        head->scan_out_buffer_id);
+  backend->driver_interface->end_flush (backend->driver,
+                                        head->back_buffer_id);
+
+  backend->driver_interface->unmap_buffer (backend->driver,
+                                           head->back_buffer_id);
+  backend->driver_interface->destroy_buffer (backend->driver,
+                                             head->back_buffer_id);
+  head->back_buffer_id = 0;
+}
+
 static bool
 ply_renderer_head_map (ply_renderer_backend_t *backend,
                        ply_renderer_head_t    *head)
@@ -210,13 +327,17 @@ ply_renderer_head_map (ply_renderer_backend_t *backend,
   /* FIXME: Maybe we should blit the fbcon contents instead of the (blank)
    * shadow buffer?
    */
-  ply_renderer_head_redraw (backend, head);
+  if (!ply_renderer_head_start_double_buffering (backend, head))
+    ply_renderer_head_redraw (backend, head);
 
   ply_trace ("Setting scan out buffer of %ldx%ld head to our buffer",
              head->area.width, head->area.height);
   if (!ply_renderer_head_set_scan_out_buffer (backend, head,
                                               head->scan_out_buffer_id))
     {
+      if (head->is_double_buffered)
+        ply_renderer_head_stop_double_buffering (backend, head);
+
       backend->driver_interface->destroy_buffer (backend->driver,
                                                  head->scan_out_buffer_id);
       head->scan_out_buffer_id = 0;
@@ -231,6 +352,9 @@ ply_renderer_head_unmap (ply_renderer_backend_t *backend,
                          ply_renderer_head_t    *head)
 {
   ply_trace ("unmapping %ldx%ld renderer head", head->area.width, head->area.height);
+  if (head->is_double_buffered)
+    ply_renderer_head_stop_double_buffering (backend, head);
+
   backend->driver_interface->unmap_buffer (backend->driver,
                                            head->scan_out_buffer_id);
 
@@ -396,6 +520,8 @@ activate (ply_renderer_backend_t *backend)
       head = (ply_renderer_head_t *) ply_list_node_get_data (node);
       next_node = ply_list_get_next_node (backend->heads, node);
 
+      ply_renderer_head_wait_for_flip (backend, head);
+
       if (head->scan_out_buffer_id != 0)
         ply_renderer_head_set_scan_out_buffer (backend, head,
                                                head->scan_out_buffer_id);
@@ -481,6 +607,11 @@ load_driver (ply_renderer_backend_t *backend)
     }
 
   backend->device_fd = device_fd;
+  backend->device_watch =
+    ply_event_loop_watch_fd (backend->loop, device_fd,
+                             PLY_EVENT_LOOP_FD_STATUS_HAS_DATA,
+                             (ply_event_handler_t) on_device_event,
+                             NULL, backend);
 
   return true;
 }
@@ -494,6 +625,12 @@ unload_driver (ply_renderer_backend_t *backend)
   ply_trace ("unloading driver");
   assert (backend->driver_interface != NULL);
 
+  if (backend->device_watch != NULL)
+    {
+      ply_event_loop_stop_watching_fd (backend->loop, backend->device_watch);
+      backend->device_watch = NULL;
+    }
+
   backend->driver_interface->destroy_driver (backend->driver);
   backend->driver = NULL;
 
@@ -957,6 +1094,8 @@ unmap_from_device (ply_renderer_backend_t *backend)
       head = (ply_renderer_head_t *) ply_list_node_get_data (node);
       next_node = ply_list_get_next_node (backend->heads, node);
 
+      ply_renderer_head_wait_for_flip (backend, head);
+
       if (backend->is_active)
         {
           ply_trace ("scanning out %s directly to console",
@@ -995,6 +1134,271 @@ reset_scan_out_buffer_if_needed (ply_renderer_backend_t *backend,
   drmModeFreeCrtc (controller);
 }
 
+static void
+copy_region_to_back_buffer (ply_renderer_head_t *head,
+                            ply_region_t        *region)
+{
+  ply_list_t *areas_to_flush;
+  ply_list_node_t *node;
+  uint32_t *shadow_buffer;
+
+  shadow_buffer = ply_pixel_buffer_get_argb32_data (head->pixel_buffer);
+  areas_to_flush = ply_region_get_sorted_rectangle_list (region);
+
+  node = ply_list_get_first_node (areas_to_flush);
+  while (node != NULL)
+    {
+      ply_list_node_t *next_node;
+      ply_rectangle_t *area_to_flush;
+      unsigned long offset;
+
+      area_to_flush = (ply_rectangle_t *) ply_list_node_get_data (node);
+
+      next_node = ply_list_get_next_node (areas_to_flush, node);
+
+      offset = area_to_flush->y * head->row_stride + area_to_flush->x * BYTES_PER_PIXEL;
+      flush_area ((char *) shadow_buffer + offset, head->row_stride,
+                  head->back_address + offset, head->row_stride,
+                  area_to_flush);
+
+      node = next_node;
+    }
+}
+
+static void
+add_region_to_region (ply_region_t *region,
+                      ply_region_t *other_region)
+{
+  ply_list_t *rectangles;
+  ply_list_node_t *node;
+
+  rectangles = ply_region_get_rectangle_list (other_region);
+
+  node = ply_list_get_first_node (rectangles);
+  while (node != NULL)
+    {
+      ply_region_add_rectangle (region,
+                                (ply_rectangle_t *) ply_list_node_get_data (node));
+      node = ply_list_get_next_node (rectangles, node);
+    }
+}
+
+static void
+on_frame_done_timeout (ply_renderer_head_t *head)
+{
+  ply_renderer_frame_done_handler_t handler;
+
+  handler = head->frame_done_handler;
+  head->frame_done_handler = NULL;
+
+  if (handler != NULL)
+    handler (head->frame_done_user_data, head);
+
+  /* The handler usually draws and flushes the next frame itself
+   */
+  if (head->flush_is_deferred && !head->flip_pending)
+    {
+      head->flush_is_deferred = false;
+
+      if (head->is_double_buffered)
+        flush_head (head->backend, head);
+    }
+}
+
+static void
+ply_renderer_head_finish_flip (ply_renderer_head_t *head)
+{
+  head->flip_pending = false;
+
+  /* We may be in the middle of drawing or flushing, so let the
+   * handlers run from the main loop
+   */
+  if (head->frame_done_handler != NULL || head->flush_is_deferred)
+    ply_event_loop_watch_for_timeout (head->backend->loop, 0.0,
+                                      (ply_event_loop_timeout_handler_t)
+                                      on_frame_done_timeout, head);
+}
+
+static void
+on_flip_timeout (ply_renderer_head_t *head)
+{
+  ply_trace ("page flip did not complete in time, carrying on without it");
+  ply_renderer_head_finish_flip (head);
+}
+
+static void
+on_page_flipped (int           device_fd,
+                 unsigned int  frame,
+                 unsigned int  seconds,
+                 unsigned int  microseconds,
+                 void         *user_data)
+{
+  ply_renderer_head_t *head = user_data;
+
+  if (!head->flip_pending)
+    return;
+
+  ply_event_loop_stop_watching_for_timeout (head->backend->loop,
+                                            (ply_event_loop_timeout_handler_t)
+                                            on_flip_timeout, head);
+  ply_renderer_head_finish_flip (head);
+}
+
+static bool
+handle_device_events (ply_renderer_backend_t *backend)
+{
+  drmEventContext event_context;
+
+  memset (&event_context, 0, sizeof (event_context));
+  event_context.version = DRM_EVENT_CONTEXT_VERSION;
+  event_context.page_flip_handler = on_page_flipped;
+
+  return drmHandleEvent (backend->device_fd, &event_context) == 0;
+}
+
+static void
+on_device_event (ply_renderer_backend_t *backend,
+                 int                     device_fd)
+{
+  if (!handle_device_events (backend))
+    ply_trace ("could not read drm events: %m");
+}
+
+/* Only for when the head is going away; flushing never waits
+ */
+static void
+ply_renderer_head_wait_for_flip (ply_renderer_backend_t *backend,
+                                 ply_renderer_head_t    *head)
+{
+  struct pollfd poll_fd = { 0 };
+  int result;
+
+  poll_fd.fd = backend->device_fd;
+  poll_fd.events = POLLIN;
+
+  while (head->flip_pending)
+    {
+      result = poll (&poll_fd, 1, PLY_RENDERER_HEAD_FLIP_TIMEOUT * 1000);
+
+      if (result > 0 && handle_device_events (backend))
+        continue;
+
+      if (result < 0 && errno == EINTR)
+        continue;
+
+      if (result == 0)
+        ply_trace ("page flip did not complete in time");
+      else
+        ply_trace ("could not wait for page flip: %m");
+
+      ply_event_loop_stop_watching_for_timeout (backend->loop,
+                                                (ply_event_loop_timeout_handler_t)
+                                                on_flip_timeout, head);
+      ply_renderer_head_finish_flip (head);
+    }
+}
+
+static void
+flip_head (ply_renderer_backend_t *backend,
+           ply_renderer_head_t    *head)
+{
+  ply_region_t *updated_region;
+  uint32_t buffer_id;
+  char *address;
+  bool flip_is_queued;
+
+  /* The front buffer is still waiting for the vblank.  Rather than
+   * block until then, leave the updates for when the flip completes.
+   */
+  if (head->flip_pending)
+    {
+      head->flush_is_deferred = true;
+      return;
+    }
+
+  head->flush_is_deferred = false;
+  updated_region = ply_pixel_buffer_get_updated_areas (head->pixel_buffer);
+
+  if (ply_region_is_empty (updated_region))
+    return;
+
+  /* Bring the back buffer up to date with the last flip as well as
+   * this one, reading only from the shadow buffer
+   */
+  add_region_to_region (head->stale_back_region, updated_region);
+  copy_region_to_back_buffer (head, head->stale_back_region);
+  ply_region_clear (head->stale_back_region);
+
+  /* The flip happens on the next vblank, and the current front buffer
+   * must not be drawn to until then.  If the driver can't queue flips,
+   * switch right away and live with the tearing.
+   */
+  flip_is_queued = drmModePageFlip (backend->device_fd, head->controller_id,
+                                    head->back_buffer_id,
+                                    DRM_MODE_PAGE_FLIP_EVENT, head) == 0;
+
+  if (!flip_is_queued &&
+      !ply_renderer_head_set_scan_out_buffer (backend, head,
+                                              head->back_buffer_id))
+    {
+      /* The back buffer is still the back buffer, and already up to
+       * date, so there is nothing left to sync
+       */
+      ply_trace ("could not flip to back buffer");
+      ply_region_clear (updated_region);
+      return;
+    }
+
+  buffer_id = head->scan_out_buffer_id;
+  head->scan_out_buffer_id = head->back_buffer_id;
+  head->back_buffer_id = buffer_id;
+
+  address = head->front_address;
+  head->front_address = head->back_address;
+  head->back_address = address;
+
+  /* The new back buffer missed what just went out
+   */
+  add_region_to_region (head->stale_back_region, updated_region);
+  ply_region_clear (updated_region);
+
+  if (flip_is_queued)
+    {
+      head->flip_pending = true;
+      ply_event_loop_watch_for_timeout (backend->loop,
+                                        PLY_RENDERER_HEAD_FLIP_TIMEOUT,
+                                        (ply_event_loop_timeout_handler_t)
+                                        on_flip_timeout, head);
+    }
+}
+
+static bool
+watch_for_frame_done (ply_renderer_backend_t            *backend,
+                      ply_renderer_head_t               *head,
+                      ply_renderer_frame_done_handler_t  handler,
+                      void                              *user_data)
+{
+  if (!head->flip_pending)
+    return false;
+
+  head->frame_done_handler = handler;
+  head->frame_done_user_data = user_data;
+
+  return true;
+}
+
+static void
+stop_watching_for_frame_done (ply_renderer_backend_t *backend,
+                              ply_renderer_head_t    *head)
+{
+  head->frame_done_handler = NULL;
+  head->frame_done_user_data = NULL;
+
+  ply_event_loop_stop_watching_for_timeout (backend->loop,
+                                            (ply_event_loop_timeout_handler_t)
+                                            on_frame_done_timeout, head);
+}
+
 static void
 flush_head (ply_renderer_backend_t *backend,
             ply_renderer_head_t    *head)
@@ -1012,6 +1416,13 @@ flush_head (ply_renderer_backend_t *backend,
 
   ply_terminal_set_mode (backend->terminal, PLY_TERMINAL_MODE_GRAPHICS);
   ply_terminal_set_unbuffered_input (backend->terminal);
+
+  if (head->is_double_buffered)
+    {
+      flip_head (backend, head);
+      return;
+    }
+
   pixel_buffer = head->pixel_buffer;
   updated_region = ply_pixel_buffer_get_updated_areas (pixel_buffer);
   areas_to_flush = ply_region_get_sorted_rectangle_list (updated_region);
@@ -1171,7 +1582,9 @@ ply_renderer_backend_get_interface (void)
       .get_input_source = get_input_source,
       .open_input_source = open_input_source,
       .set_handler_for_input_source = set_handler_for_input_source,
-      .close_input_source = close_input_source
+      .close_input_source = close_input_source,
+      .watch_for_frame_done = watch_for_frame_done,
+      .stop_watching_for_frame_done = stop_watching_for_frame_done
     };
 
   return &plugin_interface;
@@ -105,14 +105,42 @@ struct _ply_renderer_backend
   int32_t dither_green;
   int32_t dither_blue;
 
+  /* Indexed by an 8-bit channel value, these give the channel shifted
+   * into place in a device pixel, and the 8-bit value the device will
+   * actually show for it (which feeds the dithering).
+   */
+  uint32_t red_device_values[256];
+  uint32_t green_device_values[256];
+  uint32_t blue_device_values[256];
+  uint32_t alpha_device_values[256];
+  uint8_t red_shown_values[256];
+  uint8_t green_shown_values[256];
+  uint8_t blue_shown_values[256];
+
+  /* For ordered dithering, each 8-bit channel value scaled to the
+   * device's range with 6 extra bits of fraction for the Bayer matrix
+   */
+  uint16_t red_dither_levels[256];
+  uint16_t green_dither_levels[256];
+  uint16_t blue_dither_levels[256];
+
   unsigned int bytes_per_pixel;
   unsigned int row_stride;
 
+  char *row_buffer;
+
   uint32_t is_active : 1;
+  uint32_t uses_ordered_dither : 1;
 
   void (* flush_area) (ply_renderer_backend_t *backend,
                        ply_renderer_head_t    *head,
                        ply_rectangle_t        *area_to_flush);
+  void (* convert_row) (ply_renderer_backend_t *backend,
+                        const uint32_t         *source,
+                        char                   *destination,
+                        unsigned long           x,
+                        unsigned long           y,
+                        unsigned long           width);
 };
 
 ply_renderer_plugin_interface_t *ply_renderer_backend_get_interface (void);
@@ -121,92 +149,299 @@ static void ply_renderer_head_redraw (ply_renderer_backend_t *backend,
 static bool open_input_source (ply_renderer_backend_t      *backend,
                                ply_renderer_input_source_t *input_source);
 
+static void
+fill_channel_tables (uint32_t  bits,
+                     uint32_t  bit_position,
+                     uint32_t *device_values,
+                     uint8_t  *shown_values)
+{
+  int value;
+
+  for (value = 0; value < 256; value++)
+    {
+      uint32_t quantized_value;
+      uint8_t shown_value;
+      uint32_t i;
+
+      if (bits == 0)
+        {
+          device_values[value] = 0;
+          if (shown_values != NULL)
+            shown_values[value] = 0;
+          continue;
+        }
+
+      quantized_value = value >> (8 - bits);
+
+      /* Replicate the high bits into the low bits, so full intensity
+       * on the device is treated as 255
+       */
+      shown_value = quantized_value << (8 - bits);
+      for (i = bits; i < 8; i <<= 1)
+        shown_value |= shown_value >> i;
+
+      device_values[value] = quantized_value << bit_position;
+      if (shown_values != NULL)
+        shown_values[value] = shown_value;
+    }
+}
+
+static const uint8_t bayer_matrix[64] =
+  {
+     0, 32,  8, 40,  2, 34, 10, 42,
+    48, 16, 56, 24, 50, 18, 58, 26,
+    12, 44,  4, 36, 14, 46,  6, 38,
+    60, 28, 52, 20, 62, 30, 54, 22,
+     3, 35, 11, 43,  1, 33,  9, 41,
+    51, 19, 59, 27, 49, 17, 57, 25,
+    15, 47,  7, 39, 13, 45,  5, 37,
+    63, 31, 55, 23, 61, 29, 53, 21
+  };
+
+static void
+fill_channel_dither_levels (uint32_t  bits,
+                            uint16_t *dither_levels)
+{
+  uint32_t largest_device_value;
+  int value;
+
+  if (bits > 8)
+    bits = 8;
+
+  largest_device_value = (1 << bits) - 1;
+  for (value = 0; value < 256; value++)
+    dither_levels[value] = (value * largest_device_value * 64 + 127) / 255;
+}
+
 static inline uint_fast32_t
 argb32_pixel_value_to_device_pixel_value (ply_renderer_backend_t *backend,
                                           uint32_t                pixel_value)
 {
-  uint8_t r, g, b, a;
-  int orig_r, orig_g, orig_b, orig_a;
-  uint8_t new_r, new_g, new_b;
-  int i;
-
-  orig_a = pixel_value >> 24;
-  a = orig_a >> (8 - backend->bits_for_alpha);
+  int orig_r, orig_g, orig_b;
+  uint8_t r, g, b;
 
   orig_r = ((pixel_value >> 16) & 0xff) - backend->dither_red;
-  r = CLAMP (orig_r, 0, 255) >> (8 - backend->bits_for_red);
+  r = CLAMP (orig_r, 0, 255);
 
   orig_g = ((pixel_value >> 8) & 0xff) - backend->dither_green;
-  g = CLAMP (orig_g, 0, 255) >> (8 - backend->bits_for_green);
+  g = CLAMP (orig_g, 0, 255);
 
   orig_b = (pixel_value & 0xff) - backend->dither_blue;
-  b = CLAMP (orig_b, 0, 255) >> (8 - backend->bits_for_blue);
-
-  new_r = r << (8 - backend->bits_for_red);
-  new_g = g << (8 - backend->bits_for_green);
-  new_b = b << (8 - backend->bits_for_blue);
+  b = CLAMP (orig_b, 0, 255);
 
-  for (i = backend->bits_for_red; i < 8; i <<= 1)
-    new_r |= new_r >> i;
+  backend->dither_red = backend->red_shown_values[r] - orig_r;
+  backend->dither_green = backend->green_shown_values[g] - orig_g;
+  backend->dither_blue = backend->blue_shown_values[b] - orig_b;
 
-  for (i = backend->bits_for_green; i < 8; i <<= 1)
-    new_g |= new_g >> i;
+  return (backend->alpha_device_values[pixel_value >> 24]
+          | backend->red_device_values[r]
+          | backend->green_device_values[g]
+          | backend->blue_device_values[b]);
+}
 
-  for (i = backend->bits_for_blue; i < 8; i <<= 1)
-    new_b |= new_b >> i;
+/* Unlike the error diffusion above, this only depends on where the
+ * pixel is on screen, so any area converts the same way every time
+ * regardless of what was flushed before it.
+ */
+static inline uint_fast32_t
+argb32_pixel_value_to_ordered_dither_device_pixel_value (ply_renderer_backend_t *backend,
+                                                         uint32_t                pixel_value,
+                                                         int                     threshold_index)
+{
+  uint_fast32_t threshold, r, g, b;
 
-  backend->dither_red = new_r - orig_r;
-  backend->dither_green = new_g - orig_g;
-  backend->dither_blue = new_b - orig_b;
+  threshold = bayer_matrix[threshold_index];
+  r = (backend->red_dither_levels[(pixel_value >> 16) & 0xff] + threshold) >> 6;
+  g = (backend->green_dither_levels[(pixel_value >> 8) & 0xff] + threshold) >> 6;
+  b = (backend->blue_dither_levels[pixel_value & 0xff] + threshold) >> 6;
 
-  return ((a << backend->alpha_bit_position)
+  return (backend->alpha_device_values[pixel_value >> 24]
           | (r << backend->red_bit_position)
           | (g << backend->green_bit_position)
           | (b << backend->blue_bit_position));
 }
 
+static void
+convert_row_to_any_device (ply_renderer_backend_t *backend,
+                           const uint32_t         *source,
+                           char                   *destination,
+                           unsigned long           x,
+                           unsigned long           y,
+                           unsigned long           width)
+{
+  unsigned long i;
+
+  for (i = 0; i < width; i++)
+    {
+      uint_fast32_t device_pixel_value;
+
+      device_pixel_value = argb32_pixel_value_to_device_pixel_value (backend,
+                                                                     source[i]);
+
+      memcpy (destination, &device_pixel_value, backend->bytes_per_pixel);
+      destination += backend->bytes_per_pixel;
+    }
+}
+
+/* Covers RGB565, RGB555 and their BGR variants; the channel layout
+ * lives in the tables.
+ */
+static void
+convert_row_to_16bpp_device (ply_renderer_backend_t *backend,
+                             const uint32_t         *source,
+                             char                   *destination,
+                             unsigned long           x,
+                             unsigned long           y,
+                             unsigned long           width)
+{
+  uint16_t *device_pixels;
+  unsigned long i;
+
+  device_pixels = (uint16_t *) destination;
+  for (i = 0; i < width; i++)
+    device_pixels[i] = argb32_pixel_value_to_device_pixel_value (backend,
+                                                                 source[i]);
+}
+
+static void
+convert_row_to_any_device_with_ordered_dither (ply_renderer_backend_t *backend,
+                                               const uint32_t         *source,
+                                               char                   *destination,
+                                               unsigned long           x,
+                                               unsigned long           y,
+                                               unsigned long           width)
+{
+  unsigned long i;
+  int row_index;
+
+  row_index = (y & 7) << 3;
+  for (i = 0; i < width; i++)
+    {
+      uint_fast32_t device_pixel_value;
+
+      device_pixel_value =
+        argb32_pixel_value_to_ordered_dither_device_pixel_value (backend, source[i],
+                                                                 row_index | ((x + i) & 7));
+
+      memcpy (destination, &device_pixel_value, backend->bytes_per_pixel);
+      destination += backend->bytes_per_pixel;
+    }
+}
+
+static void
+convert_row_to_16bpp_device_with_ordered_dither (ply_renderer_backend_t *backend,
+                                                 const uint32_t         *source,
+                                                 char                   *destination,
+                                                 unsigned long           x,
+                                                 unsigned long           y,
+                                                 unsigned long           width)
+{
+  uint16_t *device_pixels;
+  unsigned long i;
+  int row_index;
+
+  device_pixels = (uint16_t *) destination;
+  row_index = (y & 7) << 3;
+  for (i = 0; i < width; i++)
+    device_pixels[i] =
+      argb32_pixel_value_to_ordered_dither_device_pixel_value (backend, source[i],
+                                                               row_index | ((x + i) & 7));
+}
+
+static void
+convert_row_to_8bpp_device_with_ordered_dither (ply_renderer_backend_t *backend,
+                                                const uint32_t         *source,
+                                                char                   *destination,
+                                                unsigned long           x,
+                                                unsigned long           y,
+                                                unsigned long           width)
+{
+  uint8_t *device_pixels;
+  unsigned long i;
+  int row_index;
+
+  device_pixels = (uint8_t *) destination;
+  row_index = (y & 7) << 3;
+  for (i = 0; i < width; i++)
+    device_pixels[i] =
+      argb32_pixel_value_to_ordered_dither_device_pixel_value (backend, source[i],
+                                                               row_index | ((x + i) & 7));
+}
+
+/* With 8 bits per channel there's nothing to dither, so 24bpp
+ * devices just need the bytes moved around.
+ */
+static void
+convert_row_to_rgb888_device (ply_renderer_backend_t *backend,
+                              const uint32_t         *source,
+                              char                   *destination,
+                              unsigned long           x,
+                              unsigned long           y,
+                              unsigned long           width)
+{
+  uint8_t *device_bytes;
+  unsigned long i;
+
+  device_bytes = (uint8_t *) destination;
+  for (i = 0; i < width; i++)
+    {
+      device_bytes[0] = source[i];
+      device_bytes[1] = source[i] >> 8;
+      device_bytes[2] = source[i] >> 16;
+      device_bytes += 3;
+    }
+}
+
+static void
+convert_row_to_bgr888_device (ply_renderer_backend_t *backend,
+                              const uint32_t         *source,
+                              char                   *destination,
+                              unsigned long           x,
+                              unsigned long           y,
+                              unsigned long           width)
+{
+  uint8_t *device_bytes;
+  unsigned long i;
+
+  device_bytes = (uint8_t *) destination;
+  for (i = 0; i < width; i++)
+    {
+      device_bytes[0] = source[i] >> 16;
+      device_bytes[1] = source[i] >> 8;
+      device_bytes[2] = source[i];
+      device_bytes += 3;
+    }
+}
+
 static void
 flush_area_to_any_device (ply_renderer_backend_t *backend,
                           ply_renderer_head_t    *head,
                           ply_rectangle_t        *area_to_flush)
 {
-  unsigned long row, column;
+  unsigned long row;
   uint32_t *shadow_buffer;
-  char *row_backend;
   size_t bytes_per_row;
-  unsigned long x1, y1, x2, y2;
+  unsigned long x1, y1, y2;
 
   x1 = area_to_flush->x;
   y1 = area_to_flush->y;
-  x2 = x1 + area_to_flush->width;
   y2 = y1 + area_to_flush->height;
 
   bytes_per_row = area_to_flush->width * backend->bytes_per_pixel;
-  row_backend = malloc (backend->row_stride);
   shadow_buffer = ply_pixel_buffer_get_argb32_data (backend->head.pixel_buffer);
   for (row = y1; row < y2; row++)
     {
       unsigned long offset;
 
-      for (column = x1; column < x2; column++)
-        {
-          uint32_t pixel_value;
-          uint_fast32_t device_pixel_value;
-
-          pixel_value = shadow_buffer[row * head->area.width + column];
-
-          device_pixel_value = argb32_pixel_value_to_device_pixel_value (backend,
-                                                                         pixel_value);
-
-          memcpy (row_backend + column * backend->bytes_per_pixel,
-                  &device_pixel_value, backend->bytes_per_pixel);
-        }
+      backend->convert_row (backend,
+                            &shadow_buffer[row * head->area.width + x1],
+                            backend->row_buffer,
+                            x1, row,
+                            area_to_flush->width);
 
       offset = row * backend->row_stride + x1 * backend->bytes_per_pixel;
-      memcpy (head->map_address + offset, row_backend + x1 * backend->bytes_per_pixel,
-              area_to_flush->width * backend->bytes_per_pixel);
+      memcpy (head->map_address + offset, backend->row_buffer, bytes_per_row);
     }
-  free (row_backend);
 }
 
 static void
@@ -305,6 +540,7 @@ destroy_backend (ply_renderer_backend_t *backend)
              backend->device_name);
   free (backend->device_name);
   uninitialize_head (backend, &backend->head);
+  free (backend->row_buffer);
 
   ply_list_free (backend->heads);
 
@@ -417,6 +653,16 @@ static const char const *get_visual_name (int visual)
   return visuals[visual];
 }
 
+static bool
+should_use_ordered_dither (void)
+{
+  const char *dither_mode;
+
+  dither_mode = getenv ("PLYMOUTH_FRAMEBUFFER_DITHER");
+
+  return dither_mode != NULL && strcmp (dither_mode, "ordered") == 0;
+}
+
 static bool
 query_device (ply_renderer_backend_t *backend)
 {
@@ -473,8 +719,13 @@ query_device (ply_renderer_backend_t *backend)
         return false;
     }
 
+  backend->uses_ordered_dither = should_use_ordered_dither ();
+
+  /* 8bpp is only worth showing if it's dithered the cheap way
+   */
   if (fixed_screen_info.visual != FB_VISUAL_TRUECOLOR ||
-      variable_screen_info.bits_per_pixel < 16)
+      variable_screen_info.bits_per_pixel < 8 ||
+      (variable_screen_info.bits_per_pixel < 16 && !backend->uses_ordered_dither))
     {
       ply_trace ("Visual is %s; not using graphics\n",
                  get_visual_name (fixed_screen_info.visual));
@@ -520,7 +771,55 @@ query_device (ply_renderer_backend_t *backend)
       backend->blue_bit_position == 0 && backend->bits_for_blue == 8)
     backend->flush_area = flush_area_to_xrgb32_device;
   else
-    backend->flush_area = flush_area_to_any_device;
+    {
+      backend->flush_area = flush_area_to_any_device;
+
+      fill_channel_tables (backend->bits_for_red, backend->red_bit_position,
+                           backend->red_device_values,
+                           backend->red_shown_values);
+      fill_channel_tables (backend->bits_for_green, backend->green_bit_position,
+                           backend->green_device_values,
+                           backend->green_shown_values);
+      fill_channel_tables (backend->bits_for_blue, backend->blue_bit_position,
+                           backend->blue_device_values,
+                           backend->blue_shown_values);
+      fill_channel_tables (backend->bits_for_alpha, backend->alpha_bit_position,
+                           backend->alpha_device_values, NULL);
+
+      if (backend->bytes_per_pixel == 3 && backend->bits_for_alpha == 0 &&
+          backend->bits_for_red == 8 && backend->bits_for_green == 8 &&
+          backend->bits_for_blue == 8 && backend->green_bit_position == 8 &&
+          backend->red_bit_position == 16 && backend->blue_bit_position == 0)
+        backend->convert_row = convert_row_to_rgb888_device;
+      else if (backend->bytes_per_pixel == 3 && backend->bits_for_alpha == 0 &&
+               backend->bits_for_red == 8 && backend->bits_for_green == 8 &&
+               backend->bits_for_blue == 8 && backend->green_bit_position == 8 &&
+               backend->red_bit_position == 0 && backend->blue_bit_position == 16)
+        backend->convert_row = convert_row_to_bgr888_device;
+      else if (backend->uses_ordered_dither)
+        {
+          fill_channel_dither_levels (backend->bits_for_red,
+                                      backend->red_dither_levels);
+          fill_channel_dither_levels (backend->bits_for_green,
+                                      backend->green_dither_levels);
+          fill_channel_dither_levels (backend->bits_for_blue,
+                                      backend->blue_dither_levels);
+
+          if (backend->bytes_per_pixel == 2)
+            backend->convert_row = convert_row_to_16bpp_device_with_ordered_dither;
+          else if (backend->bytes_per_pixel == 1)
+            backend->convert_row = convert_row_to_8bpp_device_with_ordered_dither;
+          else
+            backend->convert_row = convert_row_to_any_device_with_ordered_dither;
+        }
+      else if (backend->bytes_per_pixel == 2)
+        backend->convert_row = convert_row_to_16bpp_device;
+      else
+        backend->convert_row = convert_row_to_any_device;
+
+      free (backend->row_buffer);
+      backend->row_buffer = malloc (backend->row_stride);
+    }
 
   initialize_head (backend, &backend->head);
 
@@ -64,6 +64,12 @@
 #define PLY_FRAME_BUFFER_DEFAULT_FB_DEVICE_NAME "/dev/fb0"
 #endif
 
+#define COLOR_CACHE_BITS 10
+#define COLOR_CACHE_SIZE (1 << COLOR_CACHE_BITS)
+#define COLOR_CACHE_EMPTY_KEY 0xffffffff
+
+#define NUMBER_OF_PLANES 4
+
 struct _ply_renderer_head
 {
   ply_pixel_buffer_t *pixel_buffer;
@@ -76,6 +82,13 @@ struct _ply_renderer_head
   uint16_t blue[16];
   uint32_t palette_size;
   bool     palette_overflow;
+
+  /* Maps colors, at the precision the palette is currently matched
+   * with, to palette indices.  Emptied whenever the palette is rebuilt
+   * or starts matching more loosely.
+   */
+  uint32_t color_cache_keys[COLOR_CACHE_SIZE];
+  uint8_t  color_cache_indices[COLOR_CACHE_SIZE];
 };
 
 struct _ply_renderer_input_source
@@ -104,6 +117,9 @@ struct _ply_renderer_backend
   unsigned int row_stride;
   unsigned int bits_per_pixel;
 
+  /* One row of each plane, packed and ready to write out */
+  unsigned char *plane_buffer;
+
   uint32_t is_active : 1;
 };
 
@@ -113,6 +129,16 @@ static void ply_renderer_head_redraw (ply_renderer_backend_t *backend,
 static bool open_input_source (ply_renderer_backend_t      *backend,
                                ply_renderer_input_source_t *input_source);
 
+static void
+clear_color_cache (ply_renderer_head_t *head)
+{
+  unsigned int i;
+
+  /* Keys are 24-bit colors, so the empty key never matches one */
+  for (i = 0; i < COLOR_CACHE_SIZE; i++)
+    head->color_cache_keys[i] = COLOR_CACHE_EMPTY_KEY;
+}
+
 static ply_renderer_backend_t *
 create_backend (const char *device_name,
                 ply_terminal_t *terminal)
@@ -153,6 +179,7 @@ initialize_head (ply_renderer_backend_t *backend,
 
   head->palette_size = 0;
   head->palette_overflow = false;
+  clear_color_cache (head);
 
   ply_list_append_data (backend->heads, head);
 }
@@ -176,6 +203,7 @@ destroy_backend (ply_renderer_backend_t *backend)
 
   free (backend->device_name);
   uninitialize_head (backend, &backend->head);
+  free (backend->plane_buffer);
 
   ply_list_free (backend->heads);
 
@@ -316,6 +344,9 @@ query_device (ply_renderer_backend_t *backend)
   backend->bits_per_pixel = variable_screen_info.bits_per_pixel;
   backend->head.size = backend->head.area.height * backend->row_stride;
 
+  free (backend->plane_buffer);
+  backend->plane_buffer = malloc (backend->row_stride * NUMBER_OF_PLANES);
+
   initialize_head (backend, &backend->head);
 
   return true;
@@ -369,9 +400,9 @@ unmap_from_device (ply_renderer_backend_t *backend)
 }
 
 static unsigned int
-argb32_pixel_value_to_color_index (ply_renderer_backend_t *backend,
-                                   ply_renderer_head_t    *head,
-                                   uint32_t                pixel_value)
+find_color_index (ply_renderer_backend_t *backend,
+                  ply_renderer_head_t    *head,
+                  uint32_t                pixel_value)
 {
   uint16_t red, green, blue;
   unsigned int min_shift, max_shift, shift, index;
@@ -435,59 +466,113 @@ argb32_pixel_value_to_color_index (ply_renderer_backend_t *backend,
   return head->palette_size - 1;;
 }
 
+static unsigned int
+argb32_pixel_value_to_color_index (ply_renderer_backend_t *backend,
+                                   ply_renderer_head_t    *head,
+                                   uint32_t                pixel_value)
+{
+  uint32_t key;
+  unsigned int slot, index;
+  bool was_overflowed;
+
+  /* Once the palette has overflowed, colors are matched on their top
+   * two bits, so every color sharing those maps to the same index
+   */
+  was_overflowed = head->palette_overflow;
+  if (was_overflowed)
+    key = pixel_value & 0xc0c0c0;
+  else
+    key = pixel_value & 0xffffff;
+
+  slot = (key * 2654435761U) >> (32 - COLOR_CACHE_BITS);
+
+  if (head->color_cache_keys[slot] == key)
+    return head->color_cache_indices[slot];
+
+  index = find_color_index (backend, head, pixel_value);
+
+  if (head->palette_overflow != was_overflowed)
+    {
+      clear_color_cache (head);
+      return index;
+    }
+
+  head->color_cache_keys[slot] = key;
+  head->color_cache_indices[slot] = index;
+
+  return index;
+}
+
+/* For each color index, a bit in the top of the byte for every plane
+ * the index has set
+ */
+static const uint32_t color_index_plane_bits[16] =
+  {
+    0x00000000, 0x00000080, 0x00008000, 0x00008080,
+    0x00800000, 0x00800080, 0x00808000, 0x00808080,
+    0x80000000, 0x80000080, 0x80008000, 0x80008080,
+    0x80800000, 0x80800080, 0x80808000, 0x80808080
+  };
+
 static void
 flush_area (ply_renderer_backend_t *backend,
             ply_renderer_head_t    *head,
             ply_rectangle_t        *area_to_flush)
 {
-  unsigned char *mask;
   uint32_t *shadow_buffer;
-  unsigned long x1, x2, y1, y2, x, y;
-  unsigned int c, b;
-
-  mask = malloc (backend->row_stride * 16);
+  unsigned long b1, b2, y1, y2, b, y;
+  unsigned int plane;
 
   shadow_buffer = ply_pixel_buffer_get_argb32_data (backend->head.pixel_buffer);
 
-  x1 = area_to_flush->x;
+  /* Whole bytes get written to each plane, so widen the area to byte
+   * boundaries; the extra pixels come from the shadow buffer too.
+   */
+  b1 = area_to_flush->x / 8;
+  b2 = (area_to_flush->x + area_to_flush->width + 7) / 8;
   y1 = area_to_flush->y;
-  x2 = x1 + area_to_flush->width;
   y2 = y1 + area_to_flush->height;
 
   for (y = y1; y < y2; y++)
     {
-      memset (mask, 0, backend->row_stride * 16);
+      uint32_t *row;
+      char *destination;
+
+      row = &shadow_buffer[y * head->area.width];
 
-      for (x = x1; x < x2; x++)
+      for (b = b1; b < b2; b++)
         {
-          unsigned int index;
-          uint32_t pixel;
+          unsigned long x, x2;
+          uint32_t plane_bits;
+          unsigned int bit;
+
+          x = b * 8;
+          x2 = MIN (x + 8, head->area.width);
+          plane_bits = 0;
+          for (bit = 0; x < x2; x++, bit++)
+            {
+              unsigned int index;
 
-          pixel = shadow_buffer[x + y * head->area.width];
-          index = argb32_pixel_value_to_color_index (backend, head, pixel);
+              index = argb32_pixel_value_to_color_index (backend, head, row[x]);
+              plane_bits |= color_index_plane_bits[index] >> bit;
+            }
 
-          mask[index * backend->row_stride + x / 8] |= (0x80 >> (x % 8));
+          for (plane = 0; plane < NUMBER_OF_PLANES; plane++)
+            backend->plane_buffer[plane * backend->row_stride + b] = plane_bits >> (8 * plane);
         }
 
-      for (c = 0; c < 16; c++)
+      destination = head->map_address + y * backend->row_stride;
+      for (plane = 0; plane < NUMBER_OF_PLANES; plane++)
         {
-          for (b = x1 / 8; b < x2 / 8 + 1; b++)
-            {
-              char *p;
-
-              if (!mask[c * backend->row_stride + b])
-                continue;
+          unsigned char *plane_row;
 
-              vga_set_reset (c);
-              vga_bit_mask (mask[c * backend->row_stride + b]);
+          plane_row = &backend->plane_buffer[plane * backend->row_stride];
 
-              p = head->map_address + y * backend->row_stride + b;
-              *p |= 1;
-            }
+          vga_map_mask (1 << plane);
+          for (b = b1; b < b2; b++)
+            destination[b] = plane_row[b];
         }
     }
-
-  free (mask);
 }
 
 static void
@@ -509,12 +594,13 @@ flush_head (ply_renderer_backend_t *backend,
   ply_terminal_set_mode (backend->terminal, PLY_TERMINAL_MODE_GRAPHICS);
   ply_terminal_set_unbuffered_input (backend->terminal);
 
-  /* Reset to basic values; enable use of the Set/Reset register for all
-   * planes.
+  /* Reset to basic values; bytes are written straight to one plane at
+   * a time, picked with the Map Mask register.
    */
-  vga_enable_set_reset (0xf);
+  vga_enable_set_reset (0);
   vga_mode (0);
   vga_data_rotate (0);
+  vga_bit_mask (0xff);
   vga_map_mask (0xff);
 
   was_overflowed = backend->head.palette_overflow;
@@ -547,6 +633,7 @@ flush_head (ply_renderer_backend_t *backend,
       ply_trace ("palette overflowed, redrawing entire screen with new palette");
 
       head->palette_size = 0;
+      clear_color_cache (head);
       ply_renderer_head_redraw (backend, head);
     }
 }
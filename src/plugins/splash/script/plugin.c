@@ -69,6 +69,11 @@
 #define FRAMES_PER_SECOND 50
 #endif
 
+/* in kilobytes, overridden by ImageCacheSize in the theme file */
+#ifndef DEFAULT_IMAGE_CACHE_SIZE
+#define DEFAULT_IMAGE_CACHE_SIZE 8192
+#endif
+
 struct _ply_boot_splash_plugin
 {
   ply_event_loop_t      *loop;
@@ -78,6 +83,7 @@ struct _ply_boot_splash_plugin
 
   char *script_filename;
   char *image_dir;
+  size_t image_cache_size;
 
   script_op_t                   *script_main_op;
 
@@ -142,6 +148,8 @@ static ply_boot_splash_plugin_t *
 create_plugin (ply_key_file_t *key_file)
 {
   ply_boot_splash_plugin_t *plugin;
+  char *image_cache_size;
+
   plugin = calloc (1, sizeof (ply_boot_splash_plugin_t));
   plugin->image_dir = ply_key_file_get_value (key_file, 
                                               "script",
@@ -149,6 +157,16 @@ create_plugin (ply_key_file_t *key_file)
   plugin->script_filename = ply_key_file_get_value (key_file,
                                                     "script",
                                                     "ScriptFile");
+
+  image_cache_size = ply_key_file_get_value (key_file,
+                                             "script",
+                                             "ImageCacheSize");
+  if (image_cache_size != NULL)
+    plugin->image_cache_size = strtoul (image_cache_size, NULL, 10) * 1024;
+  else
+    plugin->image_cache_size = DEFAULT_IMAGE_CACHE_SIZE * 1024;
+  free (image_cache_size);
+
   plugin->displays = ply_list_new ();
   return plugin;
 }
@@ -212,7 +230,8 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
 
   plugin->script_state = script_state_new (plugin);
   plugin->script_image_lib = script_lib_image_setup (plugin->script_state,
-                                                     plugin->image_dir);
+                                                     plugin->image_dir,
+                                                     plugin->image_cache_size);
   plugin->script_sprite_lib = script_lib_sprite_setup (plugin->script_state,
                                                        plugin->displays);
   plugin->script_plymouth_lib = script_lib_plymouth_setup (plugin->script_state,
@@ -0,0 +1,74 @@
+/* script-atom.c - Interned strings used as hash keys
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * Written by: agent <agent@local>
+ */
+#include "ply-hashtable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script-atom.h"
+
+#define SCRIPT_ATOM_NUMBER_CACHE_SIZE 32
+
+static ply_hashtable_t *script_atom_hash = NULL;
+static const char *script_atom_number_cache[SCRIPT_ATOM_NUMBER_CACHE_SIZE];
+
+static void script_atom_setup (void)
+{
+  if (!script_atom_hash)
+    script_atom_hash = ply_hashtable_new (ply_hashtable_string_hash,
+                                          ply_hashtable_string_compare);
+}
+
+const char *script_atom_lookup (const char *string)
+{
+  script_atom_setup ();
+  return ply_hashtable_lookup (script_atom_hash, (void *) string);
+}
+
+const char *script_atom_from_string (const char *string)
+{
+  char *atom = (char *) script_atom_lookup (string);
+
+  if (!atom)
+    {
+      atom = strdup (string);
+      ply_hashtable_insert (script_atom_hash, atom, atom);
+    }
+  return atom;
+}
+
+const char *script_atom_from_number (int number)      /* used for set and argument indexes */
+{
+  char string[16];
+  const char *atom;
+
+  if (number >= 0 && number < SCRIPT_ATOM_NUMBER_CACHE_SIZE &&
+      script_atom_number_cache[number])
+    return script_atom_number_cache[number];
+
+  snprintf (string, sizeof (string), "%d", number);
+  atom = script_atom_from_string (string);
+
+  if (number >= 0 && number < SCRIPT_ATOM_NUMBER_CACHE_SIZE)
+    script_atom_number_cache[number] = atom;
+  return atom;
+}
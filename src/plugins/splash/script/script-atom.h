@@ -0,0 +1,33 @@
+/* script-atom.h - Interned strings used as hash keys
+ *
+ * Copyright (C) 2026 agent <agent@local>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ *
+ * Written by: agent <agent@local>
+ */
+#ifndef SCRIPT_ATOM_H
+#define SCRIPT_ATOM_H
+
+/* An atom is the one shared copy of a string.  Equal strings always give
+ * the same atom, so atoms can be compared and hashed by pointer.  Atoms
+ * are never freed.
+ */
+const char *script_atom_from_string (const char *string);
+const char *script_atom_lookup (const char *string);
+const char *script_atom_from_number (int number);
+
+#endif /* SCRIPT_ATOM_H */
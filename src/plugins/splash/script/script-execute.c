@@ -34,6 +34,7 @@
 #include <math.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-debug.h"
 #include "script-execute.h"
 #include "script-object.h"
@@ -88,13 +89,31 @@ static script_obj_t *script_evaluate_apply_function_and_assign (script_state_t *
   return obj;
 }
 
+/* Keys which are constant strings (e.g. "a.b") already have their atom */
+static const char *script_evaluate_key_atom (script_state_t *state,
+                                            script_exp_t   *exp)
+{
+  script_obj_t *key;
+  const char *atom;
+  char *name;
+
+  if (exp->type == SCRIPT_EXP_TYPE_TERM_STRING)
+    return exp->data.atom;
+
+  key = script_evaluate (state, exp);
+  name = script_obj_as_string (key);
+  atom = script_atom_from_string (name);
+  free (name);
+  script_obj_unref (key);
+  return atom;
+}
+
 static script_obj_t *script_evaluate_hash (script_state_t *state,
                                            script_exp_t   *exp)
 {
   script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
-  script_obj_t *key  = script_evaluate (state, exp->data.dual.sub_b);
+  const char *atom = script_evaluate_key_atom (state, exp->data.dual.sub_b);
   script_obj_t *obj;
-  char *name = script_obj_as_string (key);
 
   if (!script_obj_is_hash(hash))
     {
@@ -103,25 +122,77 @@ static script_obj_t *script_evaluate_hash (script_state_t *state,
       script_obj_unref (newhash);
     }
   
-  obj = script_obj_hash_get_element (hash, name);
-  free(name);
+  obj = script_obj_hash_get_element_atom (hash, atom);
   
   script_obj_unref (hash);
-  script_obj_unref (key);
+  return obj;
+}
+
+static bool script_evaluate_var_has_slot (script_state_t *state,
+                                          script_exp_t   *exp)
+{
+  return exp->data.var.slot >= 0 && exp->data.var.slot < state->slot_count;
+}
+
+/* Locals of a script function live in the slots the parser gave them.
+ * Once the local hash exists (because something used "local") it is
+ * the real store, and the slots just cache what was found in it.
+ */
+static script_obj_t *script_evaluate_var_peek_local (script_state_t *state,
+                                                     script_exp_t   *exp)
+{
+  int slot = exp->data.var.slot;
+  script_obj_t *local_hash;
+  script_obj_t *obj;
+
+  if (!script_evaluate_var_has_slot (state, exp))
+    return script_obj_hash_peek_element_atom (script_state_get_local (state),
+                                              exp->data.var.atom);
+
+  if (state->local)
+    {
+      local_hash = script_obj_deref_direct (state->local);
+      if (local_hash != state->slot_hash)   /* "local" was assigned to */
+        {
+          script_state_reset_slots (state);
+          if (local_hash->type != SCRIPT_OBJ_TYPE_HASH)
+            return script_obj_hash_peek_element_atom (state->local, exp->data.var.atom);
+          script_obj_ref (local_hash);
+          state->slot_hash = local_hash;
+        }
+      if (!state->slots[slot])
+        {
+          obj = script_obj_hash_peek_element_atom (local_hash, exp->data.var.atom);
+          if (!obj) return NULL;
+          state->slots[slot] = obj;
+        }
+    }
+
+  obj = state->slots[slot];
+  if (!obj) return NULL;
+  script_obj_ref (obj);
   return obj;
 }
 
 static script_obj_t *script_evaluate_var (script_state_t *state,
                                           script_exp_t   *exp)
 {
-  char *name = exp->data.string;
-  script_obj_t *obj = script_obj_hash_peek_element (state->local, name);
+  const char *atom = exp->data.var.atom;
+  script_obj_t *obj = script_evaluate_var_peek_local (state, exp);
   if (obj) return obj;
-  obj = script_obj_hash_peek_element (state->this, name);
+  obj = script_obj_hash_peek_element_atom (state->this, atom);
   if (obj) return obj;
-  obj = script_obj_hash_peek_element (state->global, name);
+  obj = script_obj_hash_peek_element_atom (state->global, atom);
   if (obj) return obj;
-  obj = script_obj_hash_get_element (state->local, name);
+
+  if (script_evaluate_var_has_slot (state, exp) && !state->local)
+    {
+      obj = script_obj_new_null ();
+      state->slots[exp->data.var.slot] = obj;
+      script_obj_ref (obj);
+      return obj;
+    }
+  obj = script_obj_hash_get_element_atom (script_state_get_local (state), atom);
   return obj;
 }
 
@@ -137,11 +208,9 @@ static script_obj_t *script_evaluate_set (script_state_t *state,
     {
       script_exp_t *data_exp = ply_list_node_get_data (node_data);
       script_obj_t *data_obj = script_evaluate (state, data_exp);
-      char *name;
-      asprintf (&name, "%d", index);
+      script_obj_hash_add_element_atom (obj, data_obj,
+                                        script_atom_from_number (index));
       index++;
-      script_obj_hash_add_element (obj, data_obj, name);
-      free(name);
       
       node_data = ply_list_get_next_node (parameter_data, node_data);
     }
@@ -298,31 +367,27 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
   
   if (name_exp->type == SCRIPT_EXP_TYPE_HASH)
     {
-      script_obj_t *this_key  = script_evaluate (state, name_exp->data.dual.sub_b);
+      const char *this_key_atom = script_evaluate_key_atom (state, name_exp->data.dual.sub_b);
       this_obj = script_evaluate (state, name_exp->data.dual.sub_a);
-      char *this_key_name = script_obj_as_string (this_key);
-      script_obj_unref (this_key);
-      func_obj = script_obj_hash_peek_element (this_obj, this_key_name);
+      func_obj = script_obj_hash_peek_element_atom (this_obj, this_key_atom);
 
       if (!func_obj && script_obj_is_string (this_obj))
         {
           script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
-          func_obj = script_obj_hash_peek_element (string_hash, this_key_name);
+          func_obj = script_obj_hash_peek_element_atom (string_hash, this_key_atom);
           script_obj_unref (string_hash);
         }
 
       if (!func_obj)
-        func_obj = script_obj_hash_get_element (this_obj, this_key_name);
-
-      free(this_key_name);
+        func_obj = script_obj_hash_get_element_atom (this_obj, this_key_atom);
     }
   else if (name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR)
     {
-      char *name = name_exp->data.string;
-      func_obj = script_obj_hash_peek_element (state->local, name);
+      const char *atom = name_exp->data.var.atom;
+      func_obj = script_evaluate_var_peek_local (state, name_exp);
       if (!func_obj)
         {
-          func_obj = script_obj_hash_peek_element (state->this, name);
+          func_obj = script_obj_hash_peek_element_atom (state->this, atom);
           if (func_obj)
             {
               this_obj = state->this;
@@ -330,7 +395,7 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
             }
           else
             {
-              func_obj = script_obj_hash_peek_element (state->global, name);
+              func_obj = script_obj_hash_peek_element_atom (state->global, atom);
               if (!func_obj) func_obj = script_obj_new_null ();
             }
         }
@@ -455,7 +520,7 @@ static script_obj_t *script_evaluate (script_state_t *state,
 
       case SCRIPT_EXP_TYPE_TERM_STRING:
         {
-          return script_obj_new_string (exp->data.string);
+          return script_obj_new_string (exp->data.atom);
         }
 
       case SCRIPT_EXP_TYPE_TERM_NULL:
@@ -465,8 +530,9 @@ static script_obj_t *script_evaluate (script_state_t *state,
 
       case SCRIPT_EXP_TYPE_TERM_LOCAL:
         {
-          script_obj_ref (state->local);
-          return state->local;
+          script_obj_t *local = script_state_get_local (state);
+          script_obj_ref (local);
+          return local;
         }
 
       case SCRIPT_EXP_TYPE_TERM_GLOBAL:
@@ -588,39 +654,49 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
                                                              script_obj_t      *this,
                                                              ply_list_t        *parameter_data)
 {
-  script_state_t *sub_state = script_state_init_sub (state, this);
+  script_state_t *sub_state;
+  if (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+    sub_state = script_state_init_frame (state, this, function);
+  else
+    sub_state = script_state_init_sub (state, this);
   ply_list_t *parameter_names = function->parameters;
   ply_list_node_t *node_name = ply_list_get_first_node (parameter_names);
   ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
   int index = 0;;
   script_obj_t *arg_obj = script_obj_new_hash ();
+  static const char *count_atom, *args_atom, *this_atom;
+
+  if (!count_atom)
+    {
+      count_atom = script_atom_from_string ("count");
+      args_atom = script_atom_from_string ("_args");
+      this_atom = script_atom_from_string ("this");
+    }
   
   while (node_data)
     {
       script_obj_t *data_obj = ply_list_node_get_data (node_data);
-      char *name;
-      asprintf (&name, "%d", index);
+      script_obj_hash_add_element_atom (arg_obj, data_obj,
+                                        script_atom_from_number (index));
       index++;
-      script_obj_hash_add_element (arg_obj, data_obj, name);
-      free(name);
       
       if (node_name)
         {
-          name = ply_list_node_get_data (node_name);
-          script_obj_hash_add_element (sub_state->local, data_obj, name);
+          const char *atom = ply_list_node_get_data (node_name);
+          script_state_add_local (sub_state, data_obj, atom);
           node_name = ply_list_get_next_node (parameter_names, node_name);
         }
       node_data = ply_list_get_next_node (parameter_data, node_data);
     }
 
   script_obj_t *count_obj = script_obj_new_number (index);
-  script_obj_hash_add_element (arg_obj, count_obj, "count");
-  script_obj_hash_add_element (sub_state->local, arg_obj, "_args");
+  script_obj_hash_add_element_atom (arg_obj, count_obj, count_atom);
+  script_state_add_local (sub_state, arg_obj, args_atom);
   script_obj_unref (count_obj);
   script_obj_unref (arg_obj);
 
   if (this)
-    script_obj_hash_add_element (sub_state->local, this, "this");
+    script_state_add_local (sub_state, this, this_atom);
 
   script_return_t reply;
   switch (function->type)
@@ -20,8 +20,11 @@
  * Written by: Charlie Brej <cbrej@cs.man.ac.uk>
  */
 #define _GNU_SOURCE
+#include "ply-hashtable.h"
 #include "ply-image.h"
 #include "ply-label.h"
+#include "ply-list.h"
+#include "ply-logger.h"
 #include "ply-pixel-buffer.h"
 #include "ply-utils.h"
 #include "script.h"
@@ -31,6 +34,7 @@
 #include "script-execute.h"
 #include "script-lib-image.h"
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -39,13 +43,268 @@
 
 #include "script-lib-image.script.h"
 
+/* Rotation angles are rounded to this many steps per turn, so scripts
+ * that spin an image by small increments keep hitting the cache.
+ */
+#define IMAGE_CACHE_ANGLE_STEPS 4096
+
+/* How often to report cache hits and misses */
+#define IMAGE_CACHE_TRACE_INTERVAL 256
+
+typedef enum
+{
+  IMAGE_CACHE_OPERATION_ROTATE,
+  IMAGE_CACHE_OPERATION_SCALE,
+} image_cache_operation_t;
+
+typedef struct
+{
+  script_obj_t           *source;
+  script_obj_t           *result;
+  image_cache_operation_t operation;
+  long                    angle;
+  int                     width;
+  int                     height;
+  size_t                  size;
+  ply_list_node_t        *node;
+} image_cache_entry_t;
+
+static void image_cache_forget_source (script_lib_image_data_t *data,
+                                       script_obj_t            *source);
+
 static void image_free (script_obj_t *obj)
 {
   ply_pixel_buffer_t *image = obj->data.native.object_data;
 
+  image_cache_forget_source (obj->data.native.class->user_data, obj);
   ply_pixel_buffer_free (image);
 }
 
+static void *image_direct_as_native_obj (script_obj_t *obj,
+                                         void         *user_data)
+{
+  script_obj_native_class_t *class = user_data;
+
+  if (obj->type == SCRIPT_OBJ_TYPE_NATIVE && obj->data.native.class == class)
+    return obj;
+  return NULL;
+}
+
+static unsigned int image_cache_entry_hash (void *element)
+{
+  image_cache_entry_t *entry = element;
+  uintptr_t key;
+
+  key = (uintptr_t) entry->source;
+  key = key * 31 + entry->operation;
+  key = key * 31 + entry->angle;
+  key = key * 31 + entry->width;
+  key = key * 31 + entry->height;
+
+  return ply_hashtable_direct_hash ((void *) key);
+}
+
+static int image_cache_entry_compare (void *elementa,
+                                      void *elementb)
+{
+  image_cache_entry_t *entry_a = elementa;
+  image_cache_entry_t *entry_b = elementb;
+
+  if (entry_a->source != entry_b->source ||
+      entry_a->operation != entry_b->operation)
+    return 1;
+
+  return entry_a->angle != entry_b->angle ||
+         entry_a->width != entry_b->width ||
+         entry_a->height != entry_b->height;
+}
+
+/* Whether a result of the given size would be kept at all; when it
+ * wouldn't, the transform is done exactly as asked.
+ */
+static bool image_cache_would_keep (script_lib_image_data_t *data,
+                                    int                      width,
+                                    int                      height)
+{
+  return (size_t) width * height * sizeof (uint32_t) <= data->max_cache_size;
+}
+
+/* Takes an entry out of the LRU list and both indexes
+ */
+static void image_cache_remove_entry (script_lib_image_data_t *data,
+                                      image_cache_entry_t     *entry)
+{
+  uintptr_t source_entries;
+
+  ply_hashtable_remove (data->cache_entries, entry);
+  ply_list_remove_node (data->cache, entry->node);
+  data->cache_size -= entry->size;
+
+  source_entries = (uintptr_t) ply_hashtable_remove (data->cache_sources,
+                                                     entry->source);
+  if (source_entries > 1)
+    ply_hashtable_insert (data->cache_sources, entry->source,
+                          (void *) (source_entries - 1));
+}
+
+/* Freeing the result can free images other entries were made from,
+ * so only call this once the entry is out of the cache.
+ */
+static void image_cache_entry_free (image_cache_entry_t *entry)
+{
+  script_obj_unref (entry->result);
+  free (entry);
+}
+
+static void image_cache_trace_statistics (script_lib_image_data_t *data)
+{
+  ply_trace ("image cache: %lu hits, %lu misses, %d entries using %zu bytes",
+             data->cache_hits, data->cache_misses,
+             ply_list_get_length (data->cache), data->cache_size);
+}
+
+/* Looks up a transformed image, keyed on the native object of the
+ * source image, since image objects never change once created.  The
+ * cache doesn't hold a reference on the source; instead its entries
+ * are dropped when the source is freed, before its address can be
+ * reused.  Hits are moved to the front of the list, so the least
+ * recently used entry is always last.
+ */
+static script_obj_t *image_cache_lookup (script_lib_image_data_t *data,
+                                         script_obj_t            *source,
+                                         image_cache_operation_t  operation,
+                                         long                     angle,
+                                         int                      width,
+                                         int                      height)
+{
+  image_cache_entry_t key;
+  image_cache_entry_t *entry;
+
+  if ((data->cache_hits + data->cache_misses) % IMAGE_CACHE_TRACE_INTERVAL == 0 &&
+      data->cache_hits + data->cache_misses > 0)
+    image_cache_trace_statistics (data);
+
+  key.source = source;
+  key.operation = operation;
+  key.angle = angle;
+  key.width = width;
+  key.height = height;
+
+  entry = ply_hashtable_lookup (data->cache_entries, &key);
+
+  if (entry == NULL)
+    {
+      data->cache_misses++;
+      return NULL;
+    }
+
+  ply_list_remove_node (data->cache, entry->node);
+  entry->node = ply_list_prepend_data (data->cache, entry);
+  data->cache_hits++;
+
+  script_obj_ref (entry->result);
+  return entry->result;
+}
+
+static void image_cache_add (script_lib_image_data_t *data,
+                             script_obj_t            *source,
+                             script_obj_t            *result,
+                             image_cache_operation_t  operation,
+                             long                     angle,
+                             int                      width,
+                             int                      height)
+{
+  image_cache_entry_t *entry;
+  ply_rectangle_t size;
+  uintptr_t source_entries;
+
+  ply_pixel_buffer_get_size (result->data.native.object_data, &size);
+
+  if (!image_cache_would_keep (data, size.width, size.height))
+    return;
+
+  entry = calloc (1, sizeof (image_cache_entry_t));
+  entry->source = source;
+  entry->result = result;
+  entry->operation = operation;
+  entry->angle = angle;
+  entry->width = width;
+  entry->height = height;
+  entry->size = size.width * size.height * sizeof (uint32_t);
+
+  script_obj_ref (result);
+  entry->node = ply_list_prepend_data (data->cache, entry);
+  ply_hashtable_insert (data->cache_entries, entry, entry);
+  data->cache_size += entry->size;
+
+  source_entries = (uintptr_t) ply_hashtable_remove (data->cache_sources,
+                                                     source);
+  ply_hashtable_insert (data->cache_sources, source,
+                        (void *) (source_entries + 1));
+
+  while (data->cache_size > data->max_cache_size)
+    {
+      ply_list_node_t *last_node = ply_list_get_last_node (data->cache);
+      image_cache_entry_t *last_entry = ply_list_node_get_data (last_node);
+
+      image_cache_remove_entry (data, last_entry);
+      image_cache_entry_free (last_entry);
+    }
+}
+
+static void image_cache_forget_source (script_lib_image_data_t *data,
+                                       script_obj_t            *source)
+{
+  ply_list_t *entries;
+  ply_list_node_t *node;
+
+  if (ply_hashtable_lookup (data->cache_sources, source) == NULL)
+    return;
+
+  entries = ply_list_new ();
+
+  for (node = ply_list_get_first_node (data->cache);
+       node;
+       node = ply_list_get_next_node (data->cache, node))
+    {
+      image_cache_entry_t *entry = ply_list_node_get_data (node);
+
+      if (entry->source == source)
+        ply_list_append_data (entries, entry);
+    }
+
+  for (node = ply_list_get_first_node (entries);
+       node;
+       node = ply_list_get_next_node (entries, node))
+    image_cache_remove_entry (data, ply_list_node_get_data (node));
+
+  for (node = ply_list_get_first_node (entries);
+       node;
+       node = ply_list_get_next_node (entries, node))
+    image_cache_entry_free (ply_list_node_get_data (node));
+
+  ply_list_free (entries);
+}
+
+static void image_cache_free (script_lib_image_data_t *data)
+{
+  ply_list_node_t *node;
+
+  image_cache_trace_statistics (data);
+
+  while ((node = ply_list_get_first_node (data->cache)) != NULL)
+    {
+      image_cache_entry_t *entry = ply_list_node_get_data (node);
+
+      image_cache_remove_entry (data, entry);
+      image_cache_entry_free (entry);
+    }
+
+  ply_list_free (data->cache);
+  ply_hashtable_free (data->cache_entries);
+  ply_hashtable_free (data->cache_sources);
+}
+
 static script_return_t image_new (script_state_t *state,
                                   void           *user_data)
 {
@@ -120,18 +379,48 @@ static script_return_t image_rotate (script_state_t *state,
                                      void           *user_data)
 {
   script_lib_image_data_t *data = user_data;
-  ply_pixel_buffer_t *image = script_obj_as_native_of_class (state->this, data->class);
+  script_obj_t *image_obj = script_obj_as_custom (state->this,
+                                                  image_direct_as_native_obj,
+                                                  data->class);
   float angle = script_obj_hash_get_number (state->local, "angle");
   ply_rectangle_t size;
   
-  if (image)
+  if (image_obj)
     {
+      ply_pixel_buffer_t *image = image_obj->data.native.object_data;
+      script_obj_t *reply;
+      long angle_step;
+
       ply_pixel_buffer_get_size (image, &size);
+
+      if (!image_cache_would_keep (data, size.width, size.height))
+        {
+          ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate (image,
+                                                                   size.width / 2,
+                                                                   size.height / 2,
+                                                                   angle);
+          return script_return_obj (script_obj_new_native (new_image, data->class));
+        }
+
+      angle_step = lround (angle * IMAGE_CACHE_ANGLE_STEPS / (2 * M_PI)) %
+                   IMAGE_CACHE_ANGLE_STEPS;
+      if (angle_step < 0)
+        angle_step += IMAGE_CACHE_ANGLE_STEPS;
+
+      reply = image_cache_lookup (data, image_obj, IMAGE_CACHE_OPERATION_ROTATE,
+                                  angle_step, 0, 0);
+      if (reply)
+        return script_return_obj (reply);
+
       ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate (image,
                                                                size.width / 2,
                                                                size.height / 2,
-                                                               angle);
-      return script_return_obj (script_obj_new_native (new_image, data->class));
+                                                               angle_step * 2 * M_PI /
+                                                               IMAGE_CACHE_ANGLE_STEPS);
+      reply = script_obj_new_native (new_image, data->class);
+      image_cache_add (data, image_obj, reply, IMAGE_CACHE_OPERATION_ROTATE,
+                       angle_step, 0, 0);
+      return script_return_obj (reply);
     }
   return script_return_obj_null ();
 }
@@ -140,14 +429,33 @@ static script_return_t image_scale (script_state_t *state,
                                     void           *user_data)
 {
   script_lib_image_data_t *data = user_data;
-  ply_pixel_buffer_t *image = script_obj_as_native_of_class (state->this, data->class);
+  script_obj_t *image_obj = script_obj_as_custom (state->this,
+                                                  image_direct_as_native_obj,
+                                                  data->class);
   int width = script_obj_hash_get_number (state->local, "width");
   int height = script_obj_hash_get_number (state->local, "height");
 
-  if (image)
+  if (image_obj)
     {
+      ply_pixel_buffer_t *image = image_obj->data.native.object_data;
+      script_obj_t *reply;
+
+      if (!image_cache_would_keep (data, width, height))
+        {
+          ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize (image, width, height);
+          return script_return_obj (script_obj_new_native (new_image, data->class));
+        }
+
+      reply = image_cache_lookup (data, image_obj, IMAGE_CACHE_OPERATION_SCALE,
+                                  0, width, height);
+      if (reply)
+        return script_return_obj (reply);
+
       ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize (image, width, height);
-      return script_return_obj (script_obj_new_native (new_image, data->class));
+      reply = script_obj_new_native (new_image, data->class);
+      image_cache_add (data, image_obj, reply, IMAGE_CACHE_OPERATION_SCALE,
+                       0, width, height);
+      return script_return_obj (reply);
     }
   return script_return_obj_null ();
 }
@@ -197,12 +505,22 @@ static script_return_t image_text (script_state_t *state,
 }
 
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
-                                                 char         *image_dir)
+                                                 char         *image_dir,
+                                                 size_t        max_cache_size)
 {
   script_lib_image_data_t *data = malloc (sizeof (script_lib_image_data_t));
 
   data->class = script_obj_native_class_new (image_free, "image", data);
   data->image_dir = strdup (image_dir);
+  data->cache = ply_list_new ();
+  data->cache_entries = ply_hashtable_new (image_cache_entry_hash,
+                                           image_cache_entry_compare);
+  data->cache_sources = ply_hashtable_new (ply_hashtable_direct_hash,
+                                           ply_hashtable_direct_compare);
+  data->cache_size = 0;
+  data->max_cache_size = max_cache_size;
+  data->cache_hits = 0;
+  data->cache_misses = 0;
 
   script_obj_t *image_hash = script_obj_hash_get_element (state->global, "Image");
   
@@ -255,6 +573,7 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
 
 void script_lib_image_destroy (script_lib_image_data_t *data)
 {
+  image_cache_free (data);
   script_obj_native_class_destroy (data->class);
   free (data->image_dir);
   script_parse_op_free (data->script_main_op);
@@ -23,16 +23,27 @@
 #define SCRIPT_LIB_IMAGE_H
 
 #include "script.h"
+#include "ply-hashtable.h"
+#include "ply-list.h"
 
 typedef struct
 {
   script_obj_native_class_t *class;
   script_op_t               *script_main_op;
   char *image_dir;
+
+  ply_list_t                *cache;
+  ply_hashtable_t           *cache_entries;
+  ply_hashtable_t           *cache_sources;
+  size_t                     cache_size;
+  size_t                     max_cache_size;
+  unsigned long              cache_hits;
+  unsigned long              cache_misses;
 } script_lib_image_data_t;
 
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
-                                                 char           *image_dir);
+                                                 char           *image_dir,
+                                                 size_t          max_cache_size);
 void script_lib_image_destroy (script_lib_image_data_t *data);
 
 #endif /* SCRIPT_LIB_IMAGE_H */
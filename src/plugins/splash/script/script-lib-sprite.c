@@ -38,6 +38,11 @@
 
 #include "script-lib-sprite.script.h"
 
+/* Each redrawn area walks every sprite, so past this many areas just
+ * redraw their bounding box once.
+ */
+#define MAX_REFRESH_AREAS 128
+
 static void sprite_free (script_obj_t *obj)
 {
   sprite_t *sprite = obj->data.native.object_data;
@@ -59,8 +64,10 @@ static script_return_t sprite_new (script_state_t *state,
   sprite->old_x = 0;
   sprite->old_y = 0;
   sprite->old_z = 0;
-  sprite->old_width = 0;
-  sprite->old_height = 0;
+  sprite->old_area.x = 0;
+  sprite->old_area.y = 0;
+  sprite->old_area.width = 0;
+  sprite->old_area.height = 0;
   sprite->old_opacity = 1.0;
   sprite->refresh_me = false;
   sprite->remove_me = false;
@@ -513,12 +520,12 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
 
       if ((sprite_area.x + (int) sprite_area.width) <= x) continue;
       if ((sprite_area.y + (int) sprite_area.height) <= y) continue;
-      ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip (pixel_buffer,
-                                                                   &sprite_area,
-                                                                   &clip_area,
-                                                                   0, 0,
-                                                                   ply_pixel_buffer_get_argb32_data (sprite->image),
-                                                                   sprite->opacity);
+      ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (pixel_buffer,
+                                                              sprite->image,
+                                                              sprite_area.x,
+                                                              sprite_area.y,
+                                                              &clip_area,
+                                                              sprite->opacity);
     }
 }
 
@@ -554,6 +561,7 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
   data->class = script_obj_native_class_new (sprite_free, "sprite", data);
   data->sprite_list = ply_list_new ();
   data->displays = ply_list_new ();
+  data->frame_arena = ply_arena_new (4096);
 
   max_width = 0;
   max_height = 0;
@@ -749,9 +757,14 @@ void
 script_lib_sprite_refresh (script_lib_sprite_data_t *data)
 {
   ply_list_node_t *node;
-  ply_region_t *region = ply_region_new ();
+  ply_region_t *region;
   ply_list_t *rectable_list;
 
+  /* everything the refresh needs comes out of the frame arena */
+  ply_arena_reset (data->frame_arena);
+  region = ply_region_new_with_arena (data->frame_arena);
+
+  ply_region_set_max_rectangles (region, MAX_REFRESH_AREAS);
   ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
 
   node = ply_list_get_first_node (data->sprite_list);
@@ -782,11 +795,7 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
       if (sprite->remove_me)
         {
           if (sprite->image)
-            region_add_area (region,
-                             sprite->old_x,
-                             sprite->old_y,
-                             sprite->old_width,
-                             sprite->old_height);
+            ply_region_add_rectangle (region, &sprite->old_area);
           ply_list_remove_node (data->sprite_list, node);
           script_obj_unref (sprite->image_obj);
           free (sprite);
@@ -806,24 +815,21 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
           || (fabs (sprite->old_opacity - sprite->opacity) > 0.01)      /* People can't see the difference between */
           || sprite->refresh_me)
         {
-          ply_rectangle_t size;
-          ply_pixel_buffer_get_size (sprite->image, &size);
-          region_add_area (region,
-                           sprite->x,
-                           sprite->y,
-                           size.width,
-                           size.height);
-          region_add_area (region,
-                           sprite->old_x,
-                           sprite->old_y,
-                           sprite->old_width,
-                           sprite->old_height);
+          ply_rectangle_t area;
+
+          /* Only the part of the image that isn't transparent needs
+           * redrawing, which for rotated images can be a lot smaller
+           */
+          ply_pixel_buffer_get_visible_area (sprite->image, &area);
+          area.x += sprite->x;
+          area.y += sprite->y;
+          ply_region_add_rectangle (region, &area);
+          ply_region_add_rectangle (region, &sprite->old_area);
 
           sprite->old_x = sprite->x;
           sprite->old_y = sprite->y;
           sprite->old_z = sprite->z;
-          sprite->old_width = size.width;
-          sprite->old_height = size.height;
+          sprite->old_area = area;
           sprite->old_opacity = sprite->opacity;
           sprite->refresh_me = false;
         }
@@ -872,6 +878,7 @@ void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
     }
 
   ply_list_free (data->sprite_list);
+  ply_arena_free (data->frame_arena);
   script_parse_op_free (data->script_main_op);
   script_obj_native_class_destroy (data->class);
   free (data);
@@ -35,6 +35,7 @@ typedef struct
   uint32_t                   background_color_start;
   uint32_t                   background_color_end;
   bool                       full_refresh;
+  ply_arena_t               *frame_arena;
 } script_lib_sprite_data_t;
 
 typedef struct
@@ -54,8 +55,7 @@ typedef struct
   int                 old_x;
   int                 old_y;
   int                 old_z;
-  int                 old_width;
-  int                 old_height;
+  ply_rectangle_t     old_area;
   double              old_opacity;
   bool                refresh_me;
   bool                remove_me;
@@ -34,6 +34,7 @@
 #include <values.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-object.h"
 
 void script_obj_reset (script_obj_t *obj);
@@ -66,7 +67,6 @@ static void foreach_free_variable (void *key,
   script_variable_t *variable = data;
 
   script_obj_unref (variable->object);
-  free (variable->name);
   free (variable);
 }
 
@@ -99,18 +99,8 @@ void script_obj_reset (script_obj_t *obj)
         {
           if (obj->data.function->freeable)
             {
-              ply_list_node_t *node;
-              for (node =
-                     ply_list_get_first_node (obj->data.function->parameters);
-                   node;
-                   node =
-                     ply_list_get_next_node (obj->data.function->parameters,
-                                             node))
-                {
-                  char *operand = ply_list_node_get_data (node);
-                  free (operand);
-                }
               ply_list_free (obj->data.function->parameters);
+              free (obj->data.function->slot_atoms);
               free (obj->data.function);
             }
         }
@@ -177,8 +167,7 @@ script_obj_t *script_obj_new_hash (void)
   script_obj_t *obj = malloc (sizeof (script_obj_t));
 
   obj->type = SCRIPT_OBJ_TYPE_HASH;
-  obj->data.hash = ply_hashtable_new (ply_hashtable_string_hash,
-                                      ply_hashtable_string_compare);
+  obj->data.hash = ply_hashtable_new (NULL, NULL);     /* keyed on atoms */
   obj->refcount = 1;
   return obj;
 }
@@ -405,32 +394,48 @@ void script_obj_assign (script_obj_t *obj_a,
 static void *script_obj_direct_as_hash_element (script_obj_t *obj,
                                                 void         *user_data)
 {
-  const char *name = user_data;
+  const char *atom = user_data;
   if (obj->type == SCRIPT_OBJ_TYPE_HASH)
     {
-      script_variable_t *variable = ply_hashtable_lookup (obj->data.hash, (void *) name);
+      script_variable_t *variable = ply_hashtable_lookup (obj->data.hash, (void *) atom);
       if (variable)
         return variable->object;
     }
   return NULL;
 }
 
-script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
-                                            const char   *name)
+script_obj_t *script_obj_hash_peek_element_atom (script_obj_t *hash,
+                                                 const char   *atom)
 {
   script_obj_t *object;
-  if (!name) return script_obj_new_null ();
   object = script_obj_as_custom(hash,
                                 script_obj_direct_as_hash_element,
-                                (void*) name);
+                                (void*) atom);
   if (object) script_obj_ref (object);
   return object;
 }
 
+script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
+                                            const char   *name)
+{
+  const char *atom;
+  if (!name) return script_obj_new_null ();
+  atom = script_atom_lookup (name);       /* no atom means no hash has it */
+  if (!atom) return NULL;
+  return script_obj_hash_peek_element_atom (hash, atom);
+}
+
 script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name)
 {
-  script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+  if (!name) return script_obj_new_null ();
+  return script_obj_hash_get_element_atom (hash, script_atom_from_string (name));
+}
+
+script_obj_t *script_obj_hash_get_element_atom (script_obj_t *hash,
+                                                const char   *atom)
+{
+  script_obj_t *obj = script_obj_hash_peek_element_atom (hash, atom);
   if (obj) return obj;
   script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
   if (!realhash)
@@ -439,13 +444,30 @@ script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
       script_obj_assign (hash, realhash);
     }
   script_variable_t *variable = malloc (sizeof (script_variable_t));
-  variable->name = strdup (name);
+  variable->name = atom;
   variable->object = script_obj_new_null ();
-  ply_hashtable_insert (realhash->data.hash, variable->name, variable);
+  ply_hashtable_insert (realhash->data.hash, (void *) variable->name, variable);
   script_obj_ref (variable->object);
   return variable->object;
 }
 
+/* Unlike script_obj_hash_add_element the object itself becomes the
+ * variable, so anything already holding it sees later assignments.
+ */
+void script_obj_hash_add_variable_atom (script_obj_t *hash,
+                                        script_obj_t *variable_object,
+                                        const char   *atom)
+{
+  script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
+  script_variable_t *variable = malloc (sizeof (script_variable_t));
+
+  assert (realhash);
+  variable->name = atom;
+  variable->object = variable_object;
+  script_obj_ref (variable_object);
+  ply_hashtable_insert (realhash->data.hash, (void *) variable->name, variable);
+}
+
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name)
 {
@@ -502,7 +524,14 @@ void script_obj_hash_add_element (script_obj_t *hash,
                                   script_obj_t *element,
                                   const char   *name)
 {
-  script_obj_t *obj = script_obj_hash_get_element (hash, name);
+  script_obj_hash_add_element_atom (hash, element, script_atom_from_string (name));
+}
+
+void script_obj_hash_add_element_atom (script_obj_t *hash,
+                                       script_obj_t *element,
+                                       const char   *atom)
+{
+  script_obj_t *obj = script_obj_hash_get_element_atom (hash, atom);
   script_obj_assign (obj, element);
   script_obj_unref (obj);
 }
@@ -82,6 +82,10 @@ script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
                                             const char   *name);
 script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name);
+script_obj_t *script_obj_hash_peek_element_atom (script_obj_t *hash,
+                                                 const char   *atom);
+script_obj_t *script_obj_hash_get_element_atom (script_obj_t *hash,
+                                                const char   *atom);
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name);
 bool script_obj_hash_get_bool (script_obj_t *hash,
@@ -97,6 +101,12 @@ void *script_obj_hash_get_native_of_class_name (script_obj_t *hash,
 void script_obj_hash_add_element (script_obj_t *hash,
                                   script_obj_t *element,
                                   const char   *name);
+void script_obj_hash_add_element_atom (script_obj_t *hash,
+                                       script_obj_t *element,
+                                       const char   *atom);
+void script_obj_hash_add_variable_atom (script_obj_t *hash,
+                                        script_obj_t *variable_object,
+                                        const char   *atom);
 script_obj_t *script_obj_plus (script_obj_t *script_obj_a_in,
                                script_obj_t *script_obj_b_in);
 script_obj_t *script_obj_minus (script_obj_t *script_obj_a_in,
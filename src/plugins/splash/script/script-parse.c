@@ -30,9 +30,11 @@
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
 
+#include "script-atom.h"
 #include "script-debug.h"
 #include "script-scan.h"
 #include "script-parse.h"
@@ -92,7 +94,7 @@ static script_exp_t *script_parse_new_exp_string (char                    *strin
                                                   script_debug_location_t *location)
 {
   script_exp_t *exp = script_parse_new_exp(SCRIPT_EXP_TYPE_TERM_STRING, location);
-  exp->data.string = strdup(string);
+  exp->data.atom = script_atom_from_string (string);
   return exp;
 }
 
@@ -100,7 +102,8 @@ static script_exp_t *script_parse_new_exp_var (char                    *string,
                                                script_debug_location_t *location)
 {
   script_exp_t *exp = script_parse_new_exp(SCRIPT_EXP_TYPE_TERM_VAR, location);
-  exp->data.string = strdup(string);
+  exp->data.var.atom = script_atom_from_string (string);
+  exp->data.var.slot = -1;
   return exp;
 }
 
@@ -233,8 +236,8 @@ static script_function_t *script_parse_function_def (script_scan_t *scan)
             "Function declaration parameters must be valid identifiers");
           return NULL;
         }
-      char *parameter = strdup (curtoken->data.string);
-      ply_list_append_data (parameter_list, parameter);
+      const char *parameter = script_atom_from_string (curtoken->data.string);
+      ply_list_append_data (parameter_list, (void *) parameter);
 
       curtoken = script_scan_get_next_token (scan);
 
@@ -949,22 +952,14 @@ static void script_parse_exp_free (script_exp_t *exp)
         {
           if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT) 
             script_parse_op_free (exp->data.function_def->data.script);
-          ply_list_node_t *node;
-          for (node = ply_list_get_first_node (exp->data.function_def->parameters);
-               node;
-               node = ply_list_get_next_node (exp->data.function_def->parameters, node))
-            {
-              char *arg = ply_list_node_get_data (node);
-              free (arg);
-            }
           ply_list_free (exp->data.function_def->parameters);
+          free (exp->data.function_def->slot_atoms);
           free (exp->data.function_def);
           break;
         }
 
       case SCRIPT_EXP_TYPE_TERM_STRING:
-      case SCRIPT_EXP_TYPE_TERM_VAR:
-        free (exp->data.string);
+      case SCRIPT_EXP_TYPE_TERM_VAR:          /* atoms are never freed */
         break;
     }
   script_debug_remove_element (exp);
@@ -1021,6 +1016,181 @@ static void script_parse_op_list_free (ply_list_t *op_list)
   return;
 }
 
+/* The resolver gives every variable named in a function body (not
+ * counting nested functions) a slot in that function's call frame, so
+ * the executor can find locals again without hashing their names.
+ */
+typedef struct
+{
+  ply_hashtable_t *slots;               /* atom -> slot + 1 */
+  int slot_count;
+} script_parse_frame_t;
+
+static void script_parse_resolve_op (script_op_t          *op,
+                                     script_parse_frame_t *frame);
+
+static int script_parse_frame_get_slot (script_parse_frame_t *frame,
+                                        const char           *atom)
+{
+  intptr_t slot = (intptr_t) ply_hashtable_lookup (frame->slots, (void *) atom);
+
+  if (!slot)
+    {
+      slot = ++frame->slot_count;
+      ply_hashtable_insert (frame->slots, (void *) atom, (void *) slot);
+    }
+  return slot - 1;
+}
+
+static void script_parse_frame_add_slot_atom (void *key,
+                                              void *data,
+                                              void *user_data)
+{
+  const char **slot_atoms = user_data;
+
+  slot_atoms[(intptr_t) data - 1] = key;
+}
+
+static void script_parse_resolve_function (script_function_t *function)
+{
+  script_parse_frame_t frame;
+  ply_list_node_t *node;
+
+  if (function->type != SCRIPT_FUNCTION_TYPE_SCRIPT) return;
+
+  frame.slots = ply_hashtable_new (NULL, NULL);
+  frame.slot_count = 0;
+  for (node = ply_list_get_first_node (function->parameters);
+       node;
+       node = ply_list_get_next_node (function->parameters, node))
+    script_parse_frame_get_slot (&frame, ply_list_node_get_data (node));
+  script_parse_frame_get_slot (&frame, script_atom_from_string ("_args"));
+  script_parse_frame_get_slot (&frame, script_atom_from_string ("this"));
+
+  script_parse_resolve_op (function->data.script, &frame);
+
+  function->slot_atoms = malloc (frame.slot_count * sizeof (const char *));
+  function->slot_count = frame.slot_count;
+  ply_hashtable_foreach (frame.slots,
+                         script_parse_frame_add_slot_atom,
+                         function->slot_atoms);
+  ply_hashtable_free (frame.slots);
+}
+
+static void script_parse_resolve_exp (script_exp_t         *exp,
+                                      script_parse_frame_t *frame)
+{
+  ply_list_node_t *node;
+
+  if (!exp) return;
+  switch (exp->type)
+    {
+      case SCRIPT_EXP_TYPE_PLUS:
+      case SCRIPT_EXP_TYPE_MINUS:
+      case SCRIPT_EXP_TYPE_MUL:
+      case SCRIPT_EXP_TYPE_DIV:
+      case SCRIPT_EXP_TYPE_MOD:
+      case SCRIPT_EXP_TYPE_EQ:
+      case SCRIPT_EXP_TYPE_NE:
+      case SCRIPT_EXP_TYPE_GT:
+      case SCRIPT_EXP_TYPE_GE:
+      case SCRIPT_EXP_TYPE_LT:
+      case SCRIPT_EXP_TYPE_LE:
+      case SCRIPT_EXP_TYPE_AND:
+      case SCRIPT_EXP_TYPE_OR:
+      case SCRIPT_EXP_TYPE_EXTEND:
+      case SCRIPT_EXP_TYPE_ASSIGN:
+      case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+      case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+      case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+      case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+      case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+      case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+      case SCRIPT_EXP_TYPE_HASH:
+        script_parse_resolve_exp (exp->data.dual.sub_a, frame);
+        script_parse_resolve_exp (exp->data.dual.sub_b, frame);
+        break;
+
+      case SCRIPT_EXP_TYPE_NOT:
+      case SCRIPT_EXP_TYPE_POS:
+      case SCRIPT_EXP_TYPE_NEG:
+      case SCRIPT_EXP_TYPE_PRE_INC:
+      case SCRIPT_EXP_TYPE_PRE_DEC:
+      case SCRIPT_EXP_TYPE_POST_INC:
+      case SCRIPT_EXP_TYPE_POST_DEC:
+        script_parse_resolve_exp (exp->data.sub, frame);
+        break;
+
+      case SCRIPT_EXP_TYPE_TERM_NUMBER:
+      case SCRIPT_EXP_TYPE_TERM_STRING:
+      case SCRIPT_EXP_TYPE_TERM_NULL:
+      case SCRIPT_EXP_TYPE_TERM_LOCAL:
+      case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+      case SCRIPT_EXP_TYPE_TERM_THIS:
+        break;
+
+      case SCRIPT_EXP_TYPE_TERM_VAR:          /* top level variables stay in the global hash */
+        if (frame)
+          exp->data.var.slot = script_parse_frame_get_slot (frame, exp->data.var.atom);
+        break;
+
+      case SCRIPT_EXP_TYPE_TERM_SET:
+        for (node = ply_list_get_first_node (exp->data.parameters);
+             node;
+             node = ply_list_get_next_node (exp->data.parameters, node))
+          script_parse_resolve_exp (ply_list_node_get_data (node), frame);
+        break;
+
+      case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+        for (node = ply_list_get_first_node (exp->data.function_exe.parameters);
+             node;
+             node = ply_list_get_next_node (exp->data.function_exe.parameters, node))
+          script_parse_resolve_exp (ply_list_node_get_data (node), frame);
+        script_parse_resolve_exp (exp->data.function_exe.name, frame);
+        break;
+
+      case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+        script_parse_resolve_function (exp->data.function_def);
+        break;
+    }
+}
+
+static void script_parse_resolve_op (script_op_t          *op,
+                                     script_parse_frame_t *frame)
+{
+  ply_list_node_t *node;
+
+  if (!op) return;
+  switch (op->type)
+    {
+      case SCRIPT_OP_TYPE_EXPRESSION:
+      case SCRIPT_OP_TYPE_RETURN:
+        script_parse_resolve_exp (op->data.exp, frame);
+        break;
+
+      case SCRIPT_OP_TYPE_OP_BLOCK:
+        for (node = ply_list_get_first_node (op->data.list);
+             node;
+             node = ply_list_get_next_node (op->data.list, node))
+          script_parse_resolve_op (ply_list_node_get_data (node), frame);
+        break;
+
+      case SCRIPT_OP_TYPE_IF:
+      case SCRIPT_OP_TYPE_WHILE:
+      case SCRIPT_OP_TYPE_DO_WHILE:
+      case SCRIPT_OP_TYPE_FOR:
+        script_parse_resolve_exp (op->data.cond_op.cond, frame);
+        script_parse_resolve_op (op->data.cond_op.op1, frame);
+        script_parse_resolve_op (op->data.cond_op.op2, frame);
+        break;
+
+      case SCRIPT_OP_TYPE_FAIL:
+      case SCRIPT_OP_TYPE_BREAK:
+      case SCRIPT_OP_TYPE_CONTINUE:
+        break;
+    }
+}
+
 script_op_t *script_parse_file (const char *filename)
 {
   script_scan_t *scan = script_scan_file (filename);
@@ -1041,6 +1211,7 @@ script_op_t *script_parse_file (const char *filename)
       return NULL;
     }
   script_op_t *op = script_parse_new_op_block (list, &location);
+  script_parse_resolve_op (op, NULL);
   script_scan_free (scan);
   return op;
 }
@@ -1066,6 +1237,7 @@ script_op_t *script_parse_string (const char *string,
       return NULL;
     }
   script_op_t *op = script_parse_new_op_block (list, &location);
+  script_parse_resolve_op (op, NULL);
   script_scan_free (scan);
   return op;
 }
@@ -33,6 +33,7 @@
 #include <stdarg.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-parse.h"
 #include "script-object.h"
 
@@ -44,6 +45,8 @@ script_function_t *script_function_script_new (script_op_t *script,
 
   function->type = SCRIPT_FUNCTION_TYPE_SCRIPT;
   function->parameters = parameter_list;
+  function->slot_atoms = NULL;
+  function->slot_count = 0;
   function->data.script = script;
   function->freeable = false;
   function->user_data = user_data;
@@ -58,6 +61,8 @@ script_function_t *script_function_native_new (script_native_function_t  native_
 
   function->type = SCRIPT_FUNCTION_TYPE_NATIVE;
   function->parameters = parameter_list;
+  function->slot_atoms = NULL;
+  function->slot_count = 0;
   function->data.native = native_function;
   function->freeable = true;
   function->user_data = user_data;
@@ -79,7 +84,7 @@ void script_add_native_function (script_obj_t            *hash,
   va_start (args, first_arg);
   while (arg)
     {
-      ply_list_append_data (parameter_list, strdup (arg));
+      ply_list_append_data (parameter_list, (void *) script_atom_from_string (arg));
       arg = va_arg (args, const char *);
     }
   va_end (args);
@@ -119,6 +124,10 @@ script_state_t *script_state_new (void *user_data)
   script_obj_unref(global_hash);
   state->local = script_obj_new_ref (global_hash);
   state->this = script_obj_new_null();
+  state->slots = NULL;
+  state->slot_atoms = NULL;
+  state->slot_count = 0;
+  state->slot_hash = NULL;
   state->user_data = user_data;
   return state;
 }
@@ -132,12 +141,90 @@ script_state_t *script_state_init_sub (script_state_t *oldstate, script_obj_t *t
   newstate->global = script_obj_new_ref (oldstate->global);
   if (this) newstate->this = script_obj_new_ref (this);
   else newstate->this = script_obj_new_ref (oldstate->this);
+  newstate->slots = NULL;
+  newstate->slot_atoms = NULL;
+  newstate->slot_count = 0;
+  newstate->slot_hash = NULL;
   newstate->user_data = oldstate->user_data;
   return newstate;
 }
 
+/* Script function calls keep their locals in the slots the parser gave
+ * them.  The local hash is only made if something needs it by name.
+ */
+script_state_t *script_state_init_frame (script_state_t    *oldstate,
+                                         script_obj_t      *this,
+                                         script_function_t *function)
+{
+  script_state_t *newstate = malloc (sizeof (script_state_t));
+  newstate->local = NULL;
+  newstate->global = script_obj_new_ref (oldstate->global);
+  if (this) newstate->this = script_obj_new_ref (this);
+  else newstate->this = script_obj_new_ref (oldstate->this);
+  newstate->slots = calloc (function->slot_count, sizeof (script_obj_t *));
+  newstate->slot_atoms = function->slot_atoms;
+  newstate->slot_count = function->slot_count;
+  newstate->slot_hash = NULL;
+  newstate->user_data = oldstate->user_data;
+  return newstate;
+}
+
+script_obj_t *script_state_get_local (script_state_t *state)
+{
+  script_obj_t *local_hash;
+  int i;
+
+  if (state->local) return state->local;
+
+  local_hash = script_obj_new_hash ();
+  for (i = 0; i < state->slot_count; i++)
+    {
+      if (state->slots[i])
+        script_obj_hash_add_variable_atom (local_hash,
+                                           state->slots[i],
+                                           state->slot_atoms[i]);
+    }
+  state->local = script_obj_new_ref (local_hash);
+  state->slot_hash = local_hash;
+  return state->local;
+}
+
+void script_state_add_local (script_state_t *state,
+                             script_obj_t   *element,
+                             const char     *atom)
+{
+  int i;
+
+  if (!state->local)
+    {
+      for (i = 0; i < state->slot_count; i++)
+        {
+          if (state->slot_atoms[i] != atom) continue;
+          if (!state->slots[i]) state->slots[i] = script_obj_new_null ();
+          script_obj_assign (state->slots[i], element);
+          return;
+        }
+    }
+  script_obj_hash_add_element_atom (script_state_get_local (state), element, atom);
+}
+
+void script_state_reset_slots (script_state_t *state)
+{
+  int i;
+
+  for (i = 0; i < state->slot_count; i++)
+    {
+      script_obj_unref (state->slots[i]);
+      state->slots[i] = NULL;
+    }
+  script_obj_unref (state->slot_hash);
+  state->slot_hash = NULL;
+}
+
 void script_state_destroy (script_state_t *state)
 {
+  script_state_reset_slots (state);
+  free (state->slots);
   script_obj_unref (state->global);
   script_obj_unref (state->local);
   script_obj_unref (state->this);
@@ -49,6 +49,10 @@ typedef struct
   struct script_obj_t *global;
   struct script_obj_t *local;
   struct script_obj_t *this;
+  struct script_obj_t **slots;      /* local variables of a script function call */
+  const char **slot_atoms;
+  int slot_count;
+  struct script_obj_t *slot_hash;   /* the local hash the slots were filled from */
 } script_state_t;
 
 typedef enum
@@ -62,7 +66,9 @@ typedef script_return_t (*script_native_function_t)(script_state_t *, void *);
 typedef struct script_function_t
 {
   script_function_type_t type;
-  ply_list_t *parameters;           /*  list of char* typedef names */
+  ply_list_t *parameters;           /*  list of parameter name atoms */
+  const char **slot_atoms;          /*  names of the local variable slots */
+  int slot_count;
   void *user_data;
   union
   {
@@ -175,7 +181,12 @@ typedef struct script_exp_t
       struct script_exp_t *sub_b;
     } dual;
     struct script_exp_t *sub;
-    char *string;
+    const char *atom;                 /* for TERM_STRING */
+    struct
+    {
+      const char *atom;
+      int slot;                       /* -1 if not a function local */
+    } var;
     script_number_t number;
     struct
     {
@@ -219,7 +230,7 @@ typedef struct script_op_t
 
 typedef struct
 {
-  char *name;
+  const char *name;                 /* an atom */
   script_obj_t *object;
 } script_variable_t;
 
@@ -251,6 +262,14 @@ script_obj_native_class_t *script_obj_native_class_new (script_obj_function_t fr
 void script_obj_native_class_destroy (script_obj_native_class_t * class);
 script_state_t *script_state_new (void *user_data);
 script_state_t *script_state_init_sub (script_state_t *oldstate, script_obj_t *this);
+script_state_t *script_state_init_frame (script_state_t    *oldstate,
+                                         script_obj_t      *this,
+                                         script_function_t *function);
+struct script_obj_t *script_state_get_local (script_state_t *state);
+void script_state_add_local (script_state_t      *state,
+                             struct script_obj_t *element,
+                             const char          *atom);
+void script_state_reset_slots (script_state_t *state);
 void script_state_destroy (script_state_t *state);
 
 #endif /* SCRIPT_H */
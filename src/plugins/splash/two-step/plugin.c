@@ -681,12 +681,10 @@ on_draw (view_t                   *view,
   if (plugin->state == PLY_BOOT_SPLASH_DISPLAY_QUESTION_ENTRY ||
       plugin->state == PLY_BOOT_SPLASH_DISPLAY_PASSWORD_ENTRY  )
     {
-      uint32_t *box_data, *lock_data;
-
-      box_data = ply_image_get_data (plugin->box_image);
-      ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
-                                              &view->box_area, 0, 0,
-                                              box_data);
+      ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                         ply_image_get_buffer (plugin->box_image),
+                                         view->box_area.x,
+                                         view->box_area.y);
 
       ply_entry_draw_area (view->entry,
                            pixel_buffer,
@@ -695,10 +693,10 @@ on_draw (view_t                   *view,
                            pixel_buffer,
                            x, y, width, height);
 
-      lock_data = ply_image_get_data (plugin->lock_image);
-      ply_pixel_buffer_fill_with_argb32_data (pixel_buffer,
-                                              &view->lock_area, 0, 0,
-                                              lock_data);
+      ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                         ply_image_get_buffer (plugin->lock_image),
+                                         view->lock_area.x,
+                                         view->lock_area.y);
     }
   else
     {
@@ -723,7 +721,9 @@ on_draw (view_t                   *view,
           image_area.x = screen_area.width - image_area.width - 20;
           image_area.y = screen_area.height - image_area.height - 20;
 
-          ply_pixel_buffer_fill_with_argb32_data (pixel_buffer, &image_area, 0, 0, ply_image_get_data (plugin->corner_image));
+          ply_pixel_buffer_fill_with_buffer (pixel_buffer,
+                                             ply_image_get_buffer (plugin->corner_image),
+                                             image_area.x, image_area.y);
 
         }
     }
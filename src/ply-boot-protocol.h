@@ -23,8 +23,28 @@
 #define PLY_BOOT_PROTOCOL_H
 
 #define PLY_BOOT_PROTOCOL_SOCKET_PATH "\0/ply-boot-protocol"
+
+/* Version 1 requests are a command byte, then either a NUL or \002,
+ * an argument length byte and the argument.
+ *
+ * A client can ask for a newer version with a handshake request whose
+ * argument is the highest version it speaks.  The daemon answers with
+ * the version to use from then on.  Version 2 frames start with a
+ * 32-bit length of the rest of the frame and a 32-bit sequence number.
+ * Requests follow that with a command byte, an argument count byte and
+ * for each argument a type byte, a 32-bit length and the bytes.
+ * Replies follow it with the response type byte and the answer.  All
+ * integers are little endian.
+ */
+#define PLY_BOOT_PROTOCOL_VERSION 2
+#define PLY_BOOT_PROTOCOL_MAX_FRAME_SIZE (1024 * 1024)
+
+#define PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_STRING "s"
+#define PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_BOOLEAN "b"
+
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING "P"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE "U"
+#define PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE_BATCH "u"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_SYSTEM_INITIALIZED "S"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_DEACTIVATE "D"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_REACTIVATE "r"
@@ -42,6 +62,7 @@
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_NEWROOT "R"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_HAS_ACTIVE_VT "V"
 #define PLY_BOOT_PROTOCOL_REQUEST_TYPE_ERROR "!"
+#define PLY_BOOT_PROTOCOL_REQUEST_TYPE_HANDSHAKE "v"
 
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK "\x6"
 #define PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK "\x15"
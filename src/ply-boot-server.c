@@ -43,8 +43,32 @@ typedef struct
   int fd;
   ply_fd_watch_t *watch;
   ply_boot_server_t *server;
+  ply_buffer_t *request_buffer;
+  ply_buffer_t *reply_buffer;
+  int protocol_version;
+  uint32_t sequence;
+
+  uint32_t credentials_checked : 1;
+  uint32_t is_from_root : 1;
+  uint32_t is_processing_requests : 1;
 } ply_boot_connection_t;
 
+typedef struct
+{
+  uint32_t sequence;
+  char command[2];
+  char **arguments;
+} ply_boot_request_t;
+
+/* Lets a reply that has to wait on a trigger find its way back to
+ * the request it answers
+ */
+typedef struct
+{
+  ply_boot_connection_t *connection;
+  uint32_t sequence;
+} ply_boot_deferred_reply_t;
+
 struct _ply_boot_server
 {
   ply_event_loop_t *loop;
@@ -147,10 +171,13 @@ ply_boot_connection_new (ply_boot_server_t *server,
 {
   ply_boot_connection_t *connection;
 
-  connection = calloc (1, sizeof (ply_boot_server_t));
+  connection = calloc (1, sizeof (ply_boot_connection_t));
   connection->fd = fd;
   connection->server = server;
   connection->watch = NULL;
+  connection->request_buffer = ply_buffer_new ();
+  connection->reply_buffer = ply_buffer_new ();
+  connection->protocol_version = 1;
 
   return connection;
 }
@@ -162,6 +189,8 @@ ply_boot_connection_free (ply_boot_connection_t *connection)
     return;
 
   close (connection->fd);
+  ply_buffer_free (connection->request_buffer);
+  ply_buffer_free (connection->reply_buffer);
   free (connection);
 }
 
@@ -185,43 +214,146 @@ ply_boot_server_stop_listening (ply_boot_server_t *server)
   assert (server != NULL);
 }
 
-static bool
-ply_boot_connection_read_request (ply_boot_connection_t  *connection,
-                                  char                  **command,
-                                  char                  **argument)
+static uint32_t
+ply_boot_get_uint32 (const uint8_t *bytes)
 {
-  uint8_t header[2];
+  return (bytes[0] << 0) |
+         (bytes[1] << 8) |
+         (bytes[2] << 16) |
+         ((uint32_t) bytes[3] << 24);
+}
 
-  assert (connection != NULL);
-  assert (connection->fd >= 0);
+static void
+ply_boot_append_uint32 (ply_buffer_t *buffer,
+                        uint32_t      value)
+{
+  uint8_t bytes[4];
 
-  if (!ply_read (connection->fd, header, sizeof (header)))
-    return false;
+  bytes[0] = (value >> 0) & 0xFF;
+  bytes[1] = (value >> 8) & 0xFF;
+  bytes[2] = (value >> 16) & 0xFF;
+  bytes[3] = (value >> 24) & 0xFF;
+
+  ply_buffer_append_bytes (buffer, bytes, sizeof (bytes));
+}
+
+static void
+ply_boot_request_free (ply_boot_request_t *request)
+{
+  ply_free_string_array (request->arguments);
+}
+
+/* Pulls one complete version 1 request off the front of bytes.
+ * Returns the number of bytes the request took up, or 0 if the whole
+ * request hasn't arrived yet.
+ */
+static size_t
+ply_boot_connection_parse_request (const uint8_t      *bytes,
+                                   size_t              size,
+                                   ply_boot_request_t *request)
+{
+  size_t argument_size;
 
-  *command = calloc (2, sizeof (char));
-  *command[0] = header[0];
+  if (size < 2)
+    return 0;
 
-  *argument = NULL;
-  if (header[1] == '\002')
+  if (bytes[1] != '\002')
     {
-      uint8_t argument_size;
+      request->command[0] = bytes[0];
+      request->arguments = calloc (1, sizeof (char *));
+      return 2;
+    }
 
-      if (!ply_read (connection->fd, &argument_size, sizeof (uint8_t)))
-        {
-          free (*command);
-          return false;
-        }
+  if (size < 3)
+    return 0;
+
+  argument_size = bytes[2];
+
+  if (size < 3 + argument_size)
+    return 0;
+
+  request->command[0] = bytes[0];
+  request->arguments = calloc (2, sizeof (char *));
+  request->arguments[0] = calloc (argument_size + 1, sizeof (char));
+  memcpy (request->arguments[0], bytes + 3, argument_size);
+
+  return 3 + argument_size;
+}
+
+/* Same as above for version 2 frames.  Returns -1 if the frame length
+ * can't be made sense of.  A frame with bad arguments is passed on with
+ * an empty command, so it gets refused without losing track of the
+ * frames after it.  Boolean arguments are handed on as one character
+ * strings, the way version 1 clients send them.
+ */
+static ssize_t
+ply_boot_connection_parse_framed_request (const uint8_t      *bytes,
+                                          size_t              size,
+                                          ply_boot_request_t *request)
+{
+  const uint8_t *end;
+  uint32_t frame_size, argument_size;
+  int i, number_of_arguments;
+
+  if (size < sizeof (uint32_t))
+    return 0;
+
+  frame_size = ply_boot_get_uint32 (bytes);
+
+  if (frame_size < sizeof (uint32_t) + 2 ||
+      frame_size > PLY_BOOT_PROTOCOL_MAX_FRAME_SIZE)
+    return -1;
+
+  if (size - sizeof (uint32_t) < frame_size)
+    return 0;
+
+  end = bytes + sizeof (uint32_t) + frame_size;
+  bytes += sizeof (uint32_t);
+
+  request->sequence = ply_boot_get_uint32 (bytes);
+  bytes += sizeof (uint32_t);
+  request->command[0] = *bytes++;
+  number_of_arguments = *bytes++;
+
+  request->arguments = calloc (number_of_arguments + 1, sizeof (char *));
+  for (i = 0; i < number_of_arguments; i++)
+    {
+      uint8_t type;
+
+      if (end - bytes < 1 + (ssize_t) sizeof (uint32_t))
+        goto malformed;
 
-      *argument = calloc (argument_size, sizeof (char));
+      type = *bytes++;
+      argument_size = ply_boot_get_uint32 (bytes);
+      bytes += sizeof (uint32_t);
 
-      if (!ply_read (connection->fd, *argument, argument_size))
+      if ((size_t) (end - bytes) < argument_size)
+        goto malformed;
+
+      if (type == PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_BOOLEAN[0] && argument_size == 1)
+        {
+          request->arguments[i] = calloc (2, sizeof (char));
+          request->arguments[i][0] = bytes[0] != 0;
+        }
+      else if (type == PLY_BOOT_PROTOCOL_ARGUMENT_TYPE_STRING[0])
         {
-          free (*argument);
-          free (*command);
-          return false;
+          request->arguments[i] = calloc (argument_size + 1, sizeof (char));
+          memcpy (request->arguments[i], bytes, argument_size);
         }
+      else
+        goto malformed;
+
+      bytes += argument_size;
     }
-  return true;
+
+  return sizeof (uint32_t) + frame_size;
+
+malformed:
+  ply_free_string_array (request->arguments);
+  request->arguments = calloc (1, sizeof (char *));
+  request->command[0] = '\0';
+
+  return sizeof (uint32_t) + frame_size;
 }
 
 static bool
@@ -229,128 +361,208 @@ ply_boot_connection_is_from_root (ply_boot_connection_t *connection)
 {
   uid_t uid;
 
-  if (!ply_get_credentials_from_fd (connection->fd, NULL, &uid, NULL))
-    return false;
+  /* The peer credentials are fixed when the socket is connected,
+   * so only ask the kernel once per connection
+   */
+  if (!connection->credentials_checked)
+    {
+      connection->is_from_root =
+          ply_get_credentials_from_fd (connection->fd, NULL, &uid, NULL) &&
+          uid == 0;
+      connection->credentials_checked = true;
+    }
 
-  return uid == 0;
+  return connection->is_from_root;
 }
 
+static void
+ply_boot_connection_flush_replies (ply_boot_connection_t *connection)
+{
+  size_t size;
+
+  size = ply_buffer_get_size (connection->reply_buffer);
+
+  if (size == 0)
+    return;
+
+  if (!ply_write (connection->fd,
+                  ply_buffer_get_bytes (connection->reply_buffer), size))
+    ply_error ("could not write bytes: %m");
+
+  ply_buffer_clear (connection->reply_buffer);
+}
+
+/* Replies are queued up while a batch of requests is being handled
+ * and go out together once the batch is done.  Replies that come in
+ * later, from triggers, are written right away.  Answers carry their
+ * size, bare replies don't.
+ */
+static void
+ply_boot_connection_send_reply (ply_boot_connection_t *connection,
+                                const char            *type,
+                                const char            *answer,
+                                uint32_t               answer_size)
+{
+  if (connection->protocol_version >= 2)
+    {
+      ply_boot_append_uint32 (connection->reply_buffer,
+                              sizeof (uint32_t) + 1 + answer_size);
+      ply_boot_append_uint32 (connection->reply_buffer, connection->sequence);
+      ply_buffer_append_bytes (connection->reply_buffer, type, 1);
+    }
+  else
+    {
+      ply_buffer_append_bytes (connection->reply_buffer, type, 1);
+      if (answer != NULL)
+        ply_boot_append_uint32 (connection->reply_buffer, answer_size);
+    }
+
+  if (answer_size > 0)
+    ply_buffer_append_bytes (connection->reply_buffer, answer, answer_size);
+
+  if (!connection->is_processing_requests)
+    ply_boot_connection_flush_replies (connection);
+}
 
 static void
 ply_boot_connection_send_answer (ply_boot_connection_t *connection,
                                  const char            *answer)
 {
-  uint32_t size;
-
   /* splash plugin isn't able to ask for password,
    * punt to client
    */
   if (answer == NULL)
-    {
-      if (!ply_write (connection->fd,
-                      PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
-                      strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
-        ply_error ("could not write bytes: %m");
-    }
+    ply_boot_connection_send_reply (connection,
+                                    PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
+                                    NULL, 0);
   else
-    {
-      size = strlen (answer);
+    ply_boot_connection_send_reply (connection,
+                                    PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER,
+                                    answer, strlen (answer));
+}
 
-      if (!ply_write (connection->fd,
-                      PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER,
-                      strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ANSWER)) ||
-          !ply_write_uint32 (connection->fd,
-                             size) ||
-          !ply_write (connection->fd,
-                      answer, size))
-          ply_error ("could not write bytes: %m");
+static ply_boot_deferred_reply_t *
+ply_boot_connection_defer_reply (ply_boot_connection_t *connection)
+{
+  ply_boot_deferred_reply_t *reply;
 
-    }
+  reply = calloc (1, sizeof (ply_boot_deferred_reply_t));
+  reply->connection = connection;
+  reply->sequence = connection->sequence;
 
+  return reply;
 }
 
+/* Points the connection back at the deferred request while its reply
+ * goes out, then at whatever request it was on before
+ */
 static void
-ply_boot_connection_on_password_answer (ply_boot_connection_t *connection,
-                                        const char            *password)
+ply_boot_deferred_reply_send (ply_boot_deferred_reply_t *reply,
+                              const char                *type,
+                              const char                *answer,
+                              uint32_t                   answer_size)
+{
+  ply_boot_connection_t *connection;
+  uint32_t sequence;
+
+  connection = reply->connection;
+  sequence = connection->sequence;
+
+  connection->sequence = reply->sequence;
+  if (type != NULL)
+    ply_boot_connection_send_reply (connection, type, answer, answer_size);
+  else
+    ply_boot_connection_send_answer (connection, answer);
+  connection->sequence = sequence;
+
+  free (reply);
+}
+
+static void
+ply_boot_connection_on_password_answer (ply_boot_deferred_reply_t *reply,
+                                        const char                *password)
 {
   ply_trace ("got password answer");
 
-  ply_boot_connection_send_answer (connection, password);
   if (password != NULL)
-    ply_list_append_data (connection->server->cached_passwords,
+    ply_list_append_data (reply->connection->server->cached_passwords,
                           strdup (password));
-
+  ply_boot_deferred_reply_send (reply, NULL, password, 0);
 }
 
 static void
-ply_boot_connection_on_deactivated (ply_boot_connection_t *connection)
+ply_boot_connection_on_deactivated (ply_boot_deferred_reply_t *reply)
 {
   ply_trace ("deactivated");
-  if (!ply_write (connection->fd,
-                  PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                  strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
-    {
-      ply_error ("could not write bytes: %m");
-    }
+  ply_boot_deferred_reply_send (reply, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                NULL, 0);
 }
 
 static void
-ply_boot_connection_on_quit_complete (ply_boot_connection_t *connection)
+ply_boot_connection_on_quit_complete (ply_boot_deferred_reply_t *reply)
 {
   ply_trace ("quit complete");
-  if (!ply_write (connection->fd,
-                  PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                  strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
-    {
-      ply_error ("could not write bytes: %m");
-    }
+  ply_boot_deferred_reply_send (reply, PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                NULL, 0);
 }
 
 static void
-ply_boot_connection_on_question_answer (ply_boot_connection_t *connection,
-                                        const char             *answer)
+ply_boot_connection_on_question_answer (ply_boot_deferred_reply_t *reply,
+                                        const char                *answer)
 {
   ply_trace ("got question answer: %s", answer);
-  ply_boot_connection_send_answer (connection, answer);
+  ply_boot_deferred_reply_send (reply, NULL, answer, 0);
 }
 
 static void
-ply_boot_connection_on_keystroke_answer (ply_boot_connection_t *connection,
-                                        const char            *key)
+ply_boot_connection_on_keystroke_answer (ply_boot_deferred_reply_t *reply,
+                                         const char                *key)
 {
   ply_trace ("got key: %s", key);
-  ply_boot_connection_send_answer (connection, key);
+  ply_boot_deferred_reply_send (reply, NULL, key, 0);
 }
 
 static void
-ply_boot_connection_on_request (ply_boot_connection_t *connection)
+ply_boot_connection_on_handshake (ply_boot_connection_t *connection,
+                                  const char            *argument)
 {
-  ply_boot_server_t *server;
-  char *command, *argument;
+  char answer[16];
+  int version;
 
-  assert (connection != NULL);
-  assert (connection->fd >= 0);
+  version = argument != NULL? atoi (argument) : 1;
+  version = CLAMP (version, 1, PLY_BOOT_PROTOCOL_VERSION);
 
-  server = connection->server;
-  assert (server != NULL);
+  ply_trace ("client asked for protocol version %s, using %d",
+             argument, version);
 
-  if (!ply_boot_connection_read_request (connection,
-                                         &command, &argument))
-    {
-      ply_trace ("could not read connection request");
-      return;
-    }
+  /* the answer goes out in the framing the client asked in
+   */
+  snprintf (answer, sizeof (answer), "%d", version);
+  ply_boot_connection_send_answer (connection, answer);
+
+  connection->protocol_version = version;
+}
+
+static void
+ply_boot_connection_handle_request (ply_boot_connection_t *connection,
+                                    ply_boot_request_t    *request)
+{
+  ply_boot_server_t *server;
+  const char *command;
+  char *argument;
+
+  server = connection->server;
+  command = request->command;
+  argument = request->arguments[0];
+  connection->sequence = request->sequence;
 
   if (!ply_boot_connection_is_from_root (connection))
     {
       ply_error ("request came from non-root user");
 
-      if (!ply_write (connection->fd,
-                      PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                      strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
-        ply_error ("could not write bytes: %m");
-
-      free (command);
+      ply_boot_connection_send_reply (connection,
+                                      PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                      NULL, 0);
       return;
     }
 
@@ -359,7 +571,32 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       ply_trace ("got update request");
       if (server->update_handler != NULL)
         server->update_handler (server->user_data, argument, server);
-      free (argument);
+    }
+  else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_UPDATE_BATCH) == 0)
+    {
+      char *status, *end;
+      int i;
+
+      ply_trace ("got update batch request");
+
+      /* version 2 clients send each status as its own argument,
+       * version 1 clients separate them with newlines
+       */
+      for (i = 0; request->arguments[i] != NULL; i++)
+        {
+          status = request->arguments[i];
+          while (status != NULL && *status != '\0')
+            {
+              end = strchr (status, '\n');
+              if (end != NULL)
+                *end = '\0';
+
+              if (*status != '\0' && server->update_handler != NULL)
+                server->update_handler (server->user_data, status, server);
+
+              status = end != NULL? end + 1 : NULL;
+            }
+        }
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_SYSTEM_INITIALIZED) == 0)
     {
@@ -383,14 +620,13 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
     {
       bool retain_tty;
 
-      retain_tty = (bool) argument[0];
+      retain_tty = argument != NULL && argument[0] != '\0';
 
       ply_trace ("got hide-splash %srequest", retain_tty? "--retain-tty " : "");
 
       if (server->hide_splash_handler != NULL)
         server->hide_splash_handler (server->user_data, retain_tty, server);
 
-      free(argument);
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_DEACTIVATE) == 0)
     {
@@ -403,13 +639,11 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       ply_trigger_add_handler (deactivate_trigger,
                                (ply_trigger_handler_t)
                                ply_boot_connection_on_deactivated,
-                               connection);
+                               ply_boot_connection_defer_reply (connection));
 
       if (server->deactivate_handler != NULL)
         server->deactivate_handler (server->user_data, deactivate_trigger, server);
 
-      free (argument);
-      free (command);
       return;
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_REACTIVATE) == 0)
@@ -423,7 +657,7 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       bool retain_splash;
       ply_trigger_t *quit_trigger;
 
-      retain_splash = (bool) argument[0];
+      retain_splash = argument != NULL && argument[0] != '\0';
 
       ply_trace ("got quit %srequest", retain_splash? "--retain-splash " : "");
 
@@ -432,13 +666,11 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       ply_trigger_add_handler (quit_trigger,
                                (ply_trigger_handler_t)
                                ply_boot_connection_on_quit_complete,
-                               connection);
+                               ply_boot_connection_defer_reply (connection));
 
       if (server->quit_handler != NULL)
         server->quit_handler (server->user_data, retain_splash, quit_trigger, server);
 
-      free(argument);
-      free(command);
       return;
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PASSWORD) == 0)
@@ -451,16 +683,15 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       ply_trigger_add_handler (answer,
                                (ply_trigger_handler_t)
                                ply_boot_connection_on_password_answer,
-                               connection);
+                               ply_boot_connection_defer_reply (connection));
 
       if (server->ask_for_password_handler != NULL)
         server->ask_for_password_handler (server->user_data,
-                                          argument,
+                                          argument != NULL? strdup (argument) : NULL,
                                           answer,
                                           server);
       /* will reply later
        */
-      free(command);
       return;
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_CACHED_PASSWORD) == 0)
@@ -502,10 +733,9 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       */
       if (buffer_size == 0)
         {
-          if (!ply_write (connection->fd,
-                          PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
-                          strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER)))
-              ply_error ("could not write bytes: %m");
+          ply_boot_connection_send_reply (connection,
+                                          PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NO_ANSWER,
+                                          NULL, 0);
         }
       else
         {
@@ -513,18 +743,12 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
 
           ply_trace ("writing %d cached answers",
                      ply_list_get_length (server->cached_passwords));
-          if (!ply_write (connection->fd,
-                          PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS,
-                          strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS)) ||
-              !ply_write_uint32 (connection->fd,
-                                 size) ||
-              !ply_write (connection->fd,
-                          ply_buffer_get_bytes (buffer), size))
-              ply_error ("could not write bytes: %m");
+          ply_boot_connection_send_reply (connection,
+                                          PLY_BOOT_PROTOCOL_RESPONSE_TYPE_MULTIPLE_ANSWERS,
+                                          ply_buffer_get_bytes (buffer), size);
         }
 
       ply_buffer_free (buffer);
-      free(command);
       return;
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_QUESTION) == 0)
@@ -537,16 +761,15 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       ply_trigger_add_handler (answer,
                                (ply_trigger_handler_t)
                                ply_boot_connection_on_question_answer,
-                               connection);
+                               ply_boot_connection_defer_reply (connection));
 
       if (server->ask_question_handler != NULL)
         server->ask_question_handler (server->user_data,
-                                          argument,
+                                          argument != NULL? strdup (argument) : NULL,
                                           answer,
                                           server);
       /* will reply later
        */
-      free(command);
       return;
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_MESSAGE) == 0)
@@ -565,16 +788,15 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
       ply_trigger_add_handler (answer,
                                (ply_trigger_handler_t)
                                ply_boot_connection_on_keystroke_answer,
-                               connection);
+                               ply_boot_connection_defer_reply (connection));
 
       if (server->watch_for_keystroke_handler != NULL)
         server->watch_for_keystroke_handler (server->user_data,
-                                          argument,
+                                          argument != NULL? strdup (argument) : NULL,
                                           answer,
                                           server);
       /* will reply later
        */
-      free(command);
       return;
     }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_KEYSTROKE_REMOVE) == 0)
@@ -615,35 +837,103 @@ ply_boot_connection_on_request (ply_boot_connection_t *connection)
 
       if (!answer)
         {
-          if (!ply_write (connection->fd,
-                          PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                          strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
-            ply_error ("could not write bytes: %m");
+          ply_boot_connection_send_reply (connection,
+                                          PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                          NULL, 0);
 
-          free(command);
           return;
         }
     }
+  else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_HANDSHAKE) == 0)
+    {
+      ply_boot_connection_on_handshake (connection, argument);
+      return;
+    }
   else if (strcmp (command, PLY_BOOT_PROTOCOL_REQUEST_TYPE_PING) != 0)
     {
       ply_error ("received unknown command '%s' from client", command);
 
-      if (!ply_write (connection->fd,
-                      PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
-                      strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK)))
-        ply_error ("could not write bytes: %m");
+      ply_boot_connection_send_reply (connection,
+                                      PLY_BOOT_PROTOCOL_RESPONSE_TYPE_NAK,
+                                      NULL, 0);
 
-      free(command);
       return;
     }
 
-  if (!ply_write (connection->fd, 
-                  PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
-                  strlen (PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK)))
+  ply_boot_connection_send_reply (connection,
+                                  PLY_BOOT_PROTOCOL_RESPONSE_TYPE_ACK,
+                                  NULL, 0);
+}
+
+/* Clients may pipeline requests, so handle every complete request
+ * that has arrived before going back to the event loop, and answer
+ * them all with one write.
+ */
+static void
+ply_boot_connection_on_request (ply_boot_connection_t *connection)
+{
+  const uint8_t *bytes;
+  size_t size, offset;
+  ssize_t request_size;
+  ply_boot_request_t request;
+  bool should_hang_up;
+
+  assert (connection != NULL);
+  assert (connection->fd >= 0);
+  assert (connection->server != NULL);
+
+  ply_buffer_append_from_fd (connection->request_buffer, connection->fd);
+
+  bytes = (const uint8_t *) ply_buffer_get_bytes (connection->request_buffer);
+  size = ply_buffer_get_size (connection->request_buffer);
+  offset = 0;
+  should_hang_up = false;
+
+  connection->is_processing_requests = true;
+  while (true)
+    {
+      memset (&request, 0, sizeof (request));
+
+      /* the version can change part way through, after a handshake
+       */
+      if (connection->protocol_version >= 2)
+        request_size = ply_boot_connection_parse_framed_request (bytes + offset,
+                                                                 size - offset,
+                                                                 &request);
+      else
+        request_size = ply_boot_connection_parse_request (bytes + offset,
+                                                          size - offset,
+                                                          &request);
+
+      /* There's no telling where the next frame would start, so the
+       * rest of the stream is lost
+       */
+      if (request_size < 0)
+        {
+          ply_error ("could not make sense of request from client, hanging up");
+          ply_boot_request_free (&request);
+          should_hang_up = true;
+          break;
+        }
+
+      if (request_size == 0)
+        break;
+
+      offset += request_size;
+      ply_boot_connection_handle_request (connection, &request);
+      ply_boot_request_free (&request);
+    }
+  connection->is_processing_requests = false;
+
+  ply_buffer_remove_bytes (connection->request_buffer, offset);
+  ply_boot_connection_flush_replies (connection);
+
+  if (should_hang_up)
     {
-      ply_error ("could not write bytes: %m");
+      ply_event_loop_stop_watching_fd (connection->server->loop,
+                                       connection->watch);
+      ply_boot_connection_on_hangup (connection);
     }
-  free(command);
 }
 
 static void